@@ -1,46 +1,116 @@
 #ifndef ENCRYPT_HEADER
 #define ENCRYPT_HEADER
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace fn
 {
 
 /*
-    Encryptor class allows to encrypt files or directories recursively
+    Behaviour of the encryptor on every file
 */
-class Encryptor final
+enum class EncryptMode
+{
+    InPlace,    // read and write the same file with two descriptors
+    Rename,     // encrypt in place, then rename file to <name>.encrypted
+    NewFile,    // write encrypted copy to <name>.encrypted, then unlink the original
+    Mmap,       // map the file and encrypt it in memory, so there are no read/write calls
+};
+
+struct EncryptOptions
 {
+    EncryptMode mode = EncryptMode::InPlace;
+    // amount of threads that encrypt files in parallel
+    unsigned threads = 1;
     // block size to read/write file by blocks
-    static const uint32_t m_blockSize = 1024;
+    size_t blockSize = 1024;
+    // encrypt only first bytes of every file, 0 - whole file
+    size_t partialBytes = 0;
+    // limit of encryption speed over all threads in bytes per second, 0 - no limit
+    double rate = 0;
+};
+
+/*
+    Encryption statistics
+*/
+struct EncryptStats
+{
+    uint64_t files;
+    uint64_t failedFiles;
+    uint64_t bytes;
+    double seconds;
+};
+
+/*
+    Encryptor class allows to encrypt files or directories recursively. It emulates different
+    behaviours of ransomware to stress-test detector
+*/
+class Encryptor final
+{
+    using clock = std::chrono::steady_clock;
+
     uint32_t m_key;
+    EncryptOptions m_options;
+
+    std::atomic<uint64_t> m_files;
+    std::atomic<uint64_t> m_failedFiles;
+    std::atomic<uint64_t> m_bytes;
+    clock::time_point m_start;
 
     /*
-        Encrypt given file
+        Encrypt given file with the configured mode
         @param fileName file name (recursive or absolute path)
+        @param buffer buffer of block size
+    */
+    void EncryptFile(const std::string& fileName, std::vector<char>& buffer);
+
+    /*
+        Encrypt bytes of the file from inputFd and write them to outputFd
+        @param copyTail copy the rest of the file as is after partial encryption (when output is a new file)
+        @return amount of encrypted bytes
+    */
+    uint64_t EncryptStream(int inputFd, int outputFd, std::vector<char>& buffer, bool copyTail);
+
+    /*
+        Encrypt mapped file
+        @return amount of encrypted bytes
+    */
+    uint64_t EncryptMapped(const std::string& fileName);
+
+    /*
+        Sleep if encryption is faster than the configured rate
+        @param bytes amount of bytes encrypted by the caller
     */
-    void EncryptFile(const std::string& fileName);
+    void Throttle(uint64_t bytes);
 
     /*
-        Encrypt given directory recursively
+        Collect regular files of the given directory recursively
         @param dirName directory name (recursive or absolute path)
+        @param files output list of files
     */
-    void EncryptDirectory(const std::string& dirName);
+    void CollectFiles(const std::string& dirName, std::vector<std::string>& files);
 public:
     /*
         Initialize encryptor with the given key. It will be used to encrypt/decrypt data
     */
-    Encryptor(uint32_t key) :
-        m_key(key) {}
+    Encryptor(uint32_t key, const EncryptOptions& options = {});
 
     /*
-        Encrypt given file/directory. Directories are encrypted recursively.
-        Original files are deleted after the encryption, and they are replaced
-        with file with the subfix ".ecnrypted".
+        Encrypt given file/directory. Directories are encrypted recursively by configured amount of threads.
+        Depending on the mode, original files are replaced with files with the suffix ".encrypted".
 
         @param name path to the file/directory
     */
     void Encrypt(const std::string& name);
+
+    /*
+        Statistics of the last Encrypt() call
+    */
+    EncryptStats Stats() const;
 };
 
 }
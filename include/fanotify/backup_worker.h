@@ -0,0 +1,174 @@
+#ifndef BACKUP_WORKER_HEADER
+#define BACKUP_WORKER_HEADER
+
+#include <fanotify/event_source.h>
+#include <fanotify/latency_histogram.h>
+#include <fanotify/detector_stats.h>
+#include <fanotify/config.h>
+#include <sqlite/backup_store.h>
+
+// c++ includes
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+// c includes
+#include <sys/stat.h>
+
+namespace fn
+{
+
+/**
+ * @brief Backup Worker takes snapshots of files in the background thread.
+ *
+ * Permission event of the file is answered only after its snapshot is taken, so the process
+ * can't modify the file before it is backed up. The snapshot is taken in a separate thread,
+ * because the main loop must keep answering permission events of the detector itself
+ * (snapshot creation opens files too), otherwise they would deadlock.
+ *
+ * Another low priority thread keeps the store within configured budget: it evicts backups of benign pids,
+ * outdated and the oldest ones, and returns freed database pages to the filesystem by small steps.
+ */
+class BackupWorker final
+{
+    struct Task
+    {
+        fanotify_event_metadata event;
+        std::string path;
+        EventSource::time_point received;
+    };
+
+    EventSource& m_source;
+    std::unique_ptr<sqlite::BackupStore> m_store;
+    std::vector<std::string> m_backupPaths;
+
+    static constexpr std::chrono::seconds m_maintenancePeriod{10};
+    // snapshot of a modified file is replaced only when it is older, a file modified right after its snapshot
+    // might be modified by an encryptor that isn't detected yet
+    static constexpr int64_t m_refreshAge = 60;
+    // killed suspects are forgotten from the oldest one when there are more of them
+    static constexpr size_t m_maxSuspects = 1024;
+    static constexpr std::chrono::milliseconds m_vacuumPause{100};
+    static constexpr int m_vacuumPages = 256;
+
+    // maintenance thread uses its own connection to the store
+    std::unique_ptr<sqlite::BackupStore> m_maintenanceStore;
+    int64_t m_maxSize;
+    int64_t m_maxAge;
+
+    std::queue<Task> m_tasks;
+    // memory of queued tasks, guarded by m_mutex
+    size_t m_queuedBytes;
+    // Process is identified by its pid and start time (unix time in seconds), so a reused pid isn't confused with it
+    struct ProcessId
+    {
+        int pid;
+        int64_t started;
+    };
+    std::vector<ProcessId> m_benignPids;
+
+    // Processes the detector has frozen or killed, snapshots taken because of them while they lived are never replaced
+    struct SuspectInfo
+    {
+        ProcessId process;
+        int64_t killed; // unix time in seconds, 0 while the process is frozen
+    };
+    std::vector<SuspectInfo> m_suspects;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::condition_variable m_maintenanceCondition;
+    bool m_stop;
+    std::thread m_thread;
+    std::thread m_maintenanceThread;
+
+    // latency of deferred permission events (from reading to answer), written only by m_thread
+    LatencyHistogram m_latency;
+    // snapshots taken and their size, written only by m_thread
+    StatCounter m_backupFiles;
+    StatCounter m_backupBytes;
+
+    void Run();
+    void Backup(const Task& task);
+    // snapshot is missing, or the file has changed since it and the snapshot can be replaced
+    bool IsSnapshotOutdated(const std::string& path, const struct stat& st);
+    void Maintain();
+
+    /**
+     * @brief Wait for the given time or until the worker is stopped
+     *
+     * @return false if the worker is stopped
+     */
+    template <typename Duration>
+    bool MaintenanceSleep(Duration duration)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        return !m_maintenanceCondition.wait_for(lock, duration, [this]{ return m_stop; });
+    }
+public:
+    /**
+     * @brief Open backup store described in config and start the worker thread
+     *
+     * @param cfg detector config (backupPaths, backupDbPath and backupDir fields are used)
+     * @param source event source to answer permission events with
+     */
+    BackupWorker(const Config& cfg, EventSource& source);
+
+    /**
+     * @brief Check if the file must be backed up according to config
+     *
+     * @param path absolute path to the file
+     */
+    bool IsProtected(const std::string& path) const;
+
+    /**
+     * @brief Take snapshot of the file and allow the event afterwards. Event fd is closed by the worker.
+     *
+     * @param event permission event (FAN_OPEN_PERM) that is not answered yet
+     * @param path path to the file of the event
+     * @param received time the event was read from the source
+     */
+    void Submit(const fanotify_event_metadata& event, std::string path, EventSource::time_point received);
+
+    /**
+     * @brief Backups made because of this process are not needed anymore, they will be evicted in background
+     *
+     * @param pid pid that is judged benign
+     * @param started start time of the process (unix time in seconds), backups made before it are kept
+     */
+    void MarkBenign(int pid, int64_t started);
+
+    /**
+     * @brief Snapshots made because of this process hold versions of files before it, they are kept as they are
+     *
+     * @param pid pid that is frozen or about to be killed as an encryptor
+     * @param started start time of the process (unix time in seconds)
+     */
+    void MarkSuspect(int pid, int64_t started);
+
+    /**
+     * @brief Detector has dropped the suspect: acquitted one is forgotten, snapshots of the killed one stay
+     * protected until they are evicted by age (or until there are too many killed suspects)
+     */
+    void ReleaseSuspect(int pid, bool isKilled);
+
+    /**
+     * @brief Latency of permission events answered by the worker
+     */
+    const LatencyHistogram& Latency() const { return m_latency; }
+
+    /**
+     * @brief Add counters of the worker to the snapshot (backup files and bytes, memory of the queue)
+     */
+    void AddStats(StatsSnapshot& stats) const;
+
+    ~BackupWorker();
+};
+
+}
+
+#endif // #define BACKUP_WORKER_HEADER
@@ -0,0 +1,108 @@
+#ifndef CANARY_KEEPER_HEADER
+#define CANARY_KEEPER_HEADER
+
+// c includes
+#include <sys/types.h>
+
+// c++ includes
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fn
+{
+
+/*
+    File Id identifies a file without its path: device and inode (see fstat)
+*/
+struct FileId
+{
+    uint64_t dev;
+    uint64_t ino;
+
+    friend bool operator==(const FileId& a, const FileId& b) { return a.dev == b.dev && a.ino == b.ino; }
+};
+
+struct FileIdHash
+{
+    size_t operator()(const FileId& id) const noexcept
+    {
+        return std::hash<uint64_t>{}(id.ino * 0x9e3779b97f4a7c15ull ^ id.dev);
+    }
+};
+
+/**
+ * @brief Canary Keeper places canary (honeypot) files into directories and keeps them in place in a background thread.
+ *
+ * Canaries are decoy documents that no legitimate program writes, so a write to one of them is a verdict by itself.
+ * Missing or modified canaries are recreated on every refresh. An existing file with the name of a canary is never
+ * touched, unless it is a canary of the previous run.
+ */
+class CanaryKeeper final
+{
+    std::vector<std::string> m_paths;
+    std::chrono::seconds m_refreshPeriod;
+
+    struct Canary
+    {
+        FileId id;
+        // modification time when it was written, a canary with another one is rewritten
+        int64_t mtimeNs;
+    };
+    // placed canaries by path, they are used only by the keeper thread
+    std::unordered_map<std::string, Canary> m_canaries;
+
+    // canaries published to the detector, generation changes every time they change
+    std::unordered_set<FileId, FileIdHash> m_ids;
+    std::unordered_set<std::string> m_publishedPaths;
+    std::atomic<uint64_t> m_generation;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop;
+    std::thread m_thread;
+
+    void Run();
+    // @return true if canaries have changed
+    bool Refresh();
+    // @return false if the path is taken by a file of somebody else or it can't be written
+    bool Place(const std::string& path, Canary& canary);
+public:
+    /**
+     * @brief Start the keeper thread, canaries are placed at once
+     *
+     * @param dirs directories to place canaries into
+     * @param names file names of canaries in every directory
+     * @param refreshPeriod period of checking and recreating canaries
+     */
+    CanaryKeeper(const std::vector<std::string>& dirs, const std::vector<std::string>& names,
+        std::chrono::seconds refreshPeriod);
+
+    CanaryKeeper(const CanaryKeeper&) = delete;
+    CanaryKeeper& operator=(const CanaryKeeper&) = delete;
+
+    /**
+     * @brief Copy placed canaries if they have changed since the given generation
+     *
+     * @param ids devices and inodes of canaries
+     * @param paths paths of canaries (for events without a file descriptor)
+     * @param generation generation of the copy, it is updated
+     * @return false if nothing has changed, the copy is left as is
+     */
+    bool Update(std::unordered_set<FileId, FileIdHash>& ids, std::unordered_set<std::string>& paths,
+        uint64_t& generation);
+
+    ~CanaryKeeper();
+};
+
+}
+
+#endif // #define CANARY_KEEPER_HEADER
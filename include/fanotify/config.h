@@ -12,6 +12,7 @@
 #include <filesystem>
 
 #include <fanotify/fanotify_helpers.h>
+#include <fanotify/score_model.h>
 
 namespace fn
 {
@@ -23,6 +24,8 @@ struct Config
     unsigned fanotifyEventFlags;
     // Flags that we pass to fanotify mark (events that we track)
     std::vector<ssize_t> markFlags;
+    // Directory entry events (create, delete, move) from event_track, they are tracked by the separate group
+    std::vector<ssize_t> directoryMarkFlags;
     // Maximum amount of all kind of suspicious operations
     // If any of events count exceeds maximum, it is considered suspicious
     struct FileIOSuspect
@@ -31,10 +34,100 @@ struct Config
         unsigned writes;
     } fileIOSuspect;
     
+    // Pid that writes fileIOSuspect.writes files and deletes or renames this amount of files is suspicious too
+    // (encryptor writes a new file and removes the original one), 0 - don't use this rule
+    unsigned replaceSuspect;
+
     // Maximum life time of each event stored (in millieseconds)
     int64_t fileIOMaxAge;
     std::string logPath;
     std::vector<std::string> whiteList;
+
+    // Files under these paths are backed up before they are opened, backup is disabled if empty
+    std::vector<std::string> backupPaths;
+    // Path to the sqlite database with backups (or with their index if backupDir is set)
+    std::string backupDbPath;
+    // Directory for reflink snapshots, if empty file content is stored in the database itself
+    std::string backupDir;
+    // Budget of backups in bytes, the oldest ones are evicted when it is exceeded (0 - no limit)
+    int64_t backupMaxSize;
+    // Maximum age of backups in seconds (0 - no limit)
+    int64_t backupMaxAge;
+
+    // Budget of memory held by state of tracked pids in bytes, the least recently active pids are evicted (0 - no limit)
+    int64_t pidStateMaxSize;
+
+    // Worker threads that sample entropy of written files (0 - entropy check is disabled)
+    unsigned entropyThreads;
+    // Pages (4 KB) read from every written file
+    unsigned entropySamplePages;
+    // Entropy in bits per byte (0..8) from which the file is considered encrypted
+    double entropyThreshold;
+    // Pid is suspicious if at least entropyMinFiles files are sampled and entropyRatio of them have high entropy
+    unsigned entropyMinFiles;
+    double entropyRatio;
+
+    // Counters of pids are rolled up to this amount of ancestors, to process group and to session of the pid
+    // (0 and false - no aggregation), aggregated counters are checked against aggregateSuspect
+    unsigned aggregateAncestors;
+    bool aggregateProcessGroup;
+    bool aggregateSession;
+    FileIOSuspect aggregateSuspect;
+    // Ancestor that reached thresholds is killed along with its tracked members (it spawns them). Session leaders
+    // and direct children of init are never killed
+    bool aggregateKillAncestor;
+
+    // Counters of pids are rolled up to their cgroup (container), cgroup thresholds are aggregateSuspect
+    // unless the cgroup path starts with prefix of an override (the longest prefix wins)
+    struct CgroupSuspect
+    {
+        std::string prefix;
+        FileIOSuspect suspect;
+    };
+    bool aggregateCgroup;
+    std::vector<CgroupSuspect> cgroupSuspect;
+
+    // Mounts and filesystems watched besides the mount point of the detector, an event is attributed to the
+    // longest path it is under, pids are judged by thresholds of the mount their events are attributed to
+    struct WatchedMount
+    {
+        std::string path;
+        // mark the whole filesystem (FAN_MARK_FILESYSTEM), so its bind mounts are watched too
+        bool isFilesystem;
+        FileIOSuspect suspect;
+    };
+    std::vector<WatchedMount> mounts;
+
+    // Suspects are stopped instead of killed and wait for the verdict of entropy sampler up to this time
+    // (in milliseconds), 0 - kill suspects immediately
+    int64_t freezeTimeout;
+
+    // File with this amount of events in a second, all made by white-listed executables, is ignored by
+    // the kernel (ignore mark) for ignoreMarkTtl seconds, at most ignoreMaxMarks files at once (0 - don't ignore)
+    unsigned ignoreHotEvents;
+    unsigned ignoreMaxMarks;
+    int64_t ignoreMarkTtl;
+
+    // Canary files with these names are placed into these directories and recreated every canaryRefresh seconds,
+    // write, rename or delete of a canary by a pid that is not white-listed is a verdict (no canaries if empty)
+    std::vector<std::string> canaryDirs;
+    std::vector<std::string> canaryNames;
+    int64_t canaryRefresh;
+
+    // Model that scores features of pids, it replaces read/write and replace rules if it is set
+    ScoreModel scoreModel;
+
+    // Period of tracing permission event latency percentiles in seconds (0 - don't trace)
+    int64_t latencyReportPeriod;
+
+    // File to record the event stream to (see fanotify_replay), recording is disabled if empty
+    std::string recordPath;
+
+    // Unix domain socket of stats endpoint (see StatsServer), the endpoint is disabled if empty
+    std::string statsSocketPath;
+
+    // Account time of main loop stages and dump it to trace on SIGUSR1
+    bool profileStages;
 };
 
 Config GetConfig();
@@ -4,18 +4,28 @@
 #include <fanotify/fanotify_wrapper.h>
 #include <fanotify/fanotify_helpers.h>
 #include <fanotify/config.h>
-#include <sqlite/filedb.h>
+#include <fanotify/backup_worker.h>
+#include <fanotify/event_trace.h>
+#include <fanotify/latency_histogram.h>
+#include <fanotify/detector_stats.h>
+#include <fanotify/stats_server.h>
+#include <fanotify/stage_profiler.h>
+#include <fanotify/entropy_sampler.h>
+#include <fanotify/process_tree.h>
+#include <fanotify/canary_keeper.h>
 #include <tracer/tracer.h>
 
 // c++ include
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <unordered_map>
 #include <array>
 #include <queue>
 #include <chrono>
 #include <fstream>
 #include <vector>
+#include <memory>
 
 // c include
 #include <limits.h>
@@ -31,8 +41,8 @@ namespace fn
 */
 class EncryptorDetector
 {
-    using time_point = std::chrono::time_point<std::chrono::high_resolution_clock>;
-    using clock = std::chrono::high_resolution_clock;
+    using time_point = EventSource::time_point;
+    using clock = EventSource::clock;
     using ms = std::chrono::milliseconds;
 
     static constexpr unsigned m_markFlags = FAN_MARK_ADD | FAN_MARK_MOUNT;
@@ -41,20 +51,88 @@ class EncryptorDetector
     // Current config of detector
     Config m_config;
 
-    // Fanotify wrapper class that will be used to interact with fanotify C API
-    FanotifyWrapper m_fanotify;
+    // Source of events, by default it is fanotify wrapper class that interacts with fanotify C API
+    std::unique_ptr<EventSource> m_source;
     // Mount point for fanotify
     std::string_view m_mount;
 
+    /*
+        Mount Info describes a watched mount or filesystem, the mount point of the detector is the first one.
+        Mounts with the same thresholds share a bucket of per-pid counters, so a pid reading on one of them
+        and writing on another is judged by all its events
+    */
+    struct MountInfo
+    {
+        std::string path;
+        // device of the mount root, events of files on other devices are not attributed to it
+        dev_t dev;
+        bool isFilesystem;
+        size_t bucket;
+        // events attributed to the mount, they are read by stats server thread
+        std::array<StatCounter, EVENT_COUNT> events;
+    };
+    std::vector<MountInfo> m_mounts;
+    // thresholds of buckets, per-pid counters are split by buckets only if there are several of them
+    std::vector<Config::FileIOSuspect> m_bucketSuspects;
+    // Backup of protected files, nullptr if backup is disabled in config
+    std::unique_ptr<BackupWorker> m_backup;
+    // Recording of the event stream, nullptr if recording is disabled in config
+    std::unique_ptr<EventTraceWriter> m_recorder;
+    // Entropy sampler of written files, nullptr if it is disabled in config
+    std::unique_ptr<EntropySampler> m_entropy;
+    // Canary files, nullptr if there are none in config
+    std::unique_ptr<CanaryKeeper> m_canaryKeeper;
+    // copy of placed canaries, it is taken from the keeper when they change
+    std::unordered_set<FileId, FileIdHash> m_canaryIds;
+    std::unordered_set<std::string> m_canaryPaths;
+    uint64_t m_canaryGeneration;
+
+    static constexpr size_t m_entropyMaxQueue = 1024;
+    static constexpr std::chrono::seconds m_entropySweepPeriod{1};
+    // maximal wait for events while pids are frozen, verdict is late by this time at most
+    static constexpr int64_t m_freezeCheckPeriodMs = 100;
+    static constexpr std::chrono::seconds m_entropyMaxIdle{60};
+
     /*
         Proc Event struct describes certain event - its type and relative time it was added
     */
     struct ProcEvent
     {
         int type;
+        // bucket of the mount the event is attributed to
+        uint32_t bucket;
         time_point birth;
     };
 
+    // Kinds of groups of processes that counters of pids are rolled up to
+    enum GroupKind
+    {
+        GROUP_ANCESTOR,
+        GROUP_PROCESS_GROUP,
+        GROUP_SESSION,
+        GROUP_CGROUP,
+    };
+
+    /*
+        Group Info struct describes alive events of all tracked members of the group (ancestor, process group,
+        session or cgroup). Counters are updated together with counters of members, so the group has the same
+        sliding window without its own event queue
+    */
+    struct GroupInfo
+    {
+        int64_t key;
+        std::array<size_t, EVENT_COUNT> eventsCount;
+        Config::FileIOSuspect suspect;
+        // tracked pids that belong to the group, the group is removed with the last one
+        size_t pids;
+        // group is waiting to be judged in m_suspectGroups
+        bool isReported;
+        // ancestor was alive about this time (its child was looked up), an ancestor pid reused later isn't killed
+        time_point created;
+        // cgroup path, empty for other kinds
+        std::string name;
+    };
+
     /*
         Proc Info struct describes all events of the certain proc - number of "alive" events (not outdated) and a queue if these events
     */
@@ -62,6 +140,19 @@ class EncryptorDetector
     {
         std::array<size_t, EVENT_COUNT> eventsCount;
         std::queue<ProcEvent> eventsQueue;
+        // reads and writes by buckets of mounts, empty if all mounts share thresholds
+        std::vector<std::array<size_t, 2>> bucketCounts;
+        // pid has new or expired events since the last check, it is in m_dirtyPids
+        bool isDirty;
+        // features of score model that are not in the time window: bitmap of touched files (linear counting)
+        // and renames that changed extension, they are kept while the pid is tracked
+        std::array<uint64_t, 8> files;
+        unsigned extensionChanges;
+        size_t movedFromExtension;
+        // time of the last event, the least recently active pids are evicted first
+        time_point lastActive;
+        // groups the pid is counted in (pointers to values of m_groupMap stay valid on rehash)
+        std::vector<GroupInfo*> groups;
     };
 
     /*
@@ -74,17 +165,258 @@ class EncryptorDetector
         - check if any of processes is suspicious
     */
     std::map<int, ProcInfo> m_pidEventMap;
+    // Pids whose counters have changed since the last check, only they can become suspicious
+    std::vector<int> m_dirtyPids;
+
+    // Buffers of score model, they are reused by every check: features by columns, scores and pids of rows
+    ScoreModel::Columns m_featureColumns;
+    std::vector<float> m_scores;
+    std::vector<int> m_scoredPids;
     // White list - list of paths to binaries that must not be considered as suspicious
     std::vector<std::string> m_whiteList;
 
-    void ProcessEvent(fanotify_event_metadata& event);
+    /*
+        Entropy Info struct describes files written by the pid, it is kept longer than events
+        (until the pid doesn't write for m_entropyMaxIdle), so slow encryptors are noticed too
+    */
+    struct EntropyInfo
+    {
+        unsigned sampled;
+        unsigned highEntropy;
+        time_point lastSample;
+    };
+    std::unordered_map<int, EntropyInfo> m_entropyMap;
+    time_point m_lastEntropySweep;
+
+    // Groups with tracked members, the key is made by GroupKey()
+    std::unordered_map<int64_t, GroupInfo> m_groupMap;
+    // Groups that have reached thresholds since the last check
+    std::vector<int64_t> m_suspectGroups;
+    // Cache of parents, process groups and sessions of pids
+    ProcessTree m_processTree;
+
+    /*
+        Hot File is a file (by device and inode) with events in the current second, a candidate for an ignore mark.
+        The file is judged once per second, when it reaches m_config.ignoreHotEvents events
+    */
+    struct HotFile
+    {
+        unsigned events;
+        uint64_t mask;
+        // distinct pids of the events, the file is not ignored if there are more of them
+        std::array<int, 4> pids;
+        size_t pidCount;
+        bool isJudged;
+    };
+    std::unordered_map<FileId, HotFile, FileIdHash> m_hotFiles;
+    time_point m_hotWindowStart;
+    static constexpr std::chrono::seconds m_hotWindow{1};
+    static constexpr size_t m_maxHotFiles = 4096;
+
+    // Ignore marks installed on hot files of white-listed programs, they are removed when they expire
+    struct IgnoreMark
+    {
+        uint64_t mask;
+        time_point expires;
+        // O_PATH descriptor pins the marked inode, the mark is removed through it even if the file is renamed
+        int fd;
+    };
+    std::unordered_map<FileId, IgnoreMark, FileIdHash> m_ignoreMarks;
+    // union of tracked events, only they are put into ignore marks
+    uint64_t m_markMask;
+
+    /*
+        Suspect is a pid to respond to on this iteration. All suspects are pinned first and signaled afterwards,
+        so pids of killed members of a tree can't be taken by new processes while the rest are signaled
+    */
+    struct Suspect
+    {
+        int pid;
+        // time the process was surely alive at, a process that started later has reused the pid
+        time_point seen;
+        // proven by high entropy writes, it is killed even if freezing is enabled
+        bool isProven;
+    };
+    std::vector<Suspect> m_suspects;
+
+    // Pids stopped until the verdict, they stay pinned by pidfd until they are killed or thawed
+    struct FrozenInfo
+    {
+        time_point frozen;
+        int pidfd;
+        // process group stopped with the pid, it is thawed or killed with it (pgid 0 - only the pid is stopped)
+        StoppedGroup group;
+    };
+    std::unordered_map<int, FrozenInfo> m_frozenPids;
+
+    // Estimated memory held by m_pidEventMap (tree nodes and event queues), it is kept within m_config.pidStateMaxSize
+    size_t m_pidStateBytes;
+
+    // Latency of permission events answered by the main loop (from reading of the event to the answer)
+    LatencyHistogram m_permLatency;
+    // Permission latency at the last report, the next report covers only events after it
+    LatencyHistogram::Snapshot m_reportedLatency;
+    time_point m_lastLatencyReport;
+
+    // Counters of the main loop, they are read by stats server thread
+    std::array<StatCounter, EVENT_COUNT> m_eventCounters;
+    StatCounter m_trackedPids;
+    StatCounter m_overflows;
+    StatCounter m_kills;
+    StatCounter m_freezes;
+    StatCounter m_thaws;
+    StatCounter m_staleSuspects;
+    StatCounter m_whiteListHits;
+    StatCounter m_evictedPids;
+    StatCounter m_pidTableBytes;
+    StatCounter m_eventQueueBytes;
+    StatCounter m_recorderBytes;
+    StatCounter m_entropyTableBytes;
+    StatCounter m_entropySamples;
+    StatCounter m_highEntropySamples;
+    StatCounter m_trackedGroups;
+    StatCounter m_groupDetections;
+    StatCounter m_groupTableBytes;
+    StatCounter m_processCacheBytes;
+    StatCounter m_ignoreMarkCount;
+    StatCounter m_canaryCount;
+    StatCounter m_canaryHits;
+    StatCounter m_ignoreMarksInstalled;
+    LatencyHistogram m_loopTime;
+    // Time spent in stages of the main loop, dumped to trace on SIGUSR1 (if it is enabled in config)
+    StageProfiler m_profiler;
+    // Stats endpoint, nullptr if it is disabled in config. It is started at the end of constructor, when all members are
+    // set up, and it is the last member to be stopped before counters are destroyed
+    std::unique_ptr<StatsServer> m_statsServer;
+
+    /**
+     * @param event event to process
+     * @param received real time the event was read at
+     */
+    void ProcessEvent(fanotify_event_metadata& event, time_point received);
+    /**
+     * @brief Add event of the given type on the given mount to the time window of the pid
+     *
+     * @param fileHash hash of the file path to estimate unique files, 0 if score model is not set
+     */
+    void CountEvent(int pid, int type, size_t mount, time_point now, size_t fileHash);
+    void MarkDirty(int pid, ProcInfo& procInfo);
+    // judge dirty pids by rules of thresholds, suspects are added to pidsToRemove
+    void CheckRules(std::vector<int>& pidsToRemove);
+    // judge dirty pids by score model, suspects are added to pidsToRemove
+    void CheckScores(std::vector<int>& pidsToRemove);
+    // count renames of the pid that change file extension (moved from and moved to come one after another)
+    void CountExtensionChange(int pid, uint64_t mask, const std::string& path);
+    // mark the mount point and mounts from config
+    void MarkMounts(uint64_t markMask, uint64_t directoryMask);
+    /**
+     * @brief Find the watched mount of the file: the longest path it is under among mounts of its device
+     *
+     * @param fd descriptor of the file to get its device, -1 if it is unknown (directory and replayed events)
+     * @return index in m_mounts, the first mount if the file is not under any of them
+     */
+    size_t MountOf(const std::string& path, int fd) const;
+    // pid has reached thresholds on any bucket of mounts
+    bool IsCopying(const ProcInfo& procInfo) const;
+    // pid has reached write threshold on any bucket of mounts
+    bool IsWriting(const ProcInfo& procInfo) const;
+    // pid writes and deletes or renames files (encrypted copies replace originals), see replaceSuspect
+    bool IsReplacing(const ProcInfo& procInfo) const;
     void CheckForOutdatedEvents();
     void ProcessEvents();
+    // count creates, deletes and renames reported by the directory group
+    void ProcessDirectoryEvents();
     void CheckForSuspiciousPids();
+    /**
+     * @brief Queue the pid for response on this iteration, the caller removes it from tracked pids
+     *
+     * @param seen time the process was surely alive at (time of its event)
+     * @param isProven the pid is proven to be an encryptor (high entropy writes), it is killed even if freezing is enabled
+     */
+    void HandleSuspect(int pid, time_point seen, bool isProven = false);
+    // pin queued suspects, check white list, then kill them or freeze them until the verdict
+    void RespondToSuspects();
+    // process that has exited is white-listed too, there is nothing to respond to
+    bool IsWhiteListed(int pid);
+    bool IsWhiteListedExecutable(const std::string& executable) const;
+    // start time of the process (unix time in seconds), 0 if it doesn't exist
+    int64_t GetStartTime(int pid);
+    /**
+     * @brief Count the event of the file, ignore the file in kernel if it is hot and only white-listed pids touch it
+     *
+     * @param fd event descriptor of the file, events without it (replayed ones) are not learned
+     */
+    void LearnHotFile(const std::string& path, int fd, int pid, uint64_t mask);
+    // start the next window of hot files and remove expired ignore marks
+    void CheckIgnoreMarks();
+    /**
+     * @brief Check if the file is a canary: by device and inode of the descriptor, by path if there is no descriptor
+     */
+    bool IsCanary(const std::string& path, int fd) const;
+    // canary has been written, renamed or deleted, the pid is judged without thresholds
+    void HandleCanary(int pid, const std::string& path);
+    void FreezeSuspect(int pid, int pidfd);
+    // group is stopped with the pid by FreezeSuspect(), its pgid is 0 if the pid isn't frozen
+    void KillSuspect(int pid, int pidfd, const StoppedGroup& group);
+    // kill or thaw frozen pids when entropy of their files is known or the freeze timeout is over
+    void CheckFrozenPids();
+    // collect sampled entropy and judge pids that write high entropy files and write or replace many files,
+    // judged pids are added to pidsToRemove. With score model sampled pids are only marked dirty to be scored
+    void CheckEntropy(std::vector<int>& pidsToRemove);
+    // count the new pid in its groups according to config
+    void AttachGroups(int pid, ProcInfo& procInfo);
+    // forget the pid in its groups, its alive events are subtracted
+    void DetachGroups(ProcInfo& procInfo);
+    // add event to counters of the pid groups, report groups that reached thresholds
+    void CountInGroups(ProcInfo& procInfo, int type);
+    // judge groups that reached thresholds, their members are added to pidsToRemove
+    void CheckSuspiciousGroups(std::vector<int>& pidsToRemove);
+    // ancestor can be killed with its members: it isn't a session leader, a child of init or the detector
+    bool IsKillableAncestor(int pid);
+    // thresholds of the cgroup according to overrides in config
+    Config::FileIOSuspect CgroupSuspect(const std::string& cgroup) const;
+    // kind is kept in the high byte, id is pid or hash of cgroup path
+    static constexpr uint64_t m_groupIdMask = (uint64_t(1) << 56) - 1;
+    static int64_t GroupKey(GroupKind kind, uint64_t id)
+    {
+        return (static_cast<int64_t>(kind) << 56) | static_cast<int64_t>(id & m_groupIdMask);
+    }
+    // pid has writes in the time window
+    bool IsWriter(int pid) const;
+    // evict the least recently active pids (benign ones first) if pid state is over memory budget
+    void CheckMemoryBudget();
+    void RemovePid(std::map<int, ProcInfo>::iterator it);
+    // estimated memory of one entry of m_pidEventMap
+    static size_t PidStateBytes(const ProcInfo& procInfo);
+    // trace percentiles of permission latency once in configured period
+    void ReportLatency();
+    // trace stage profile if it was requested by SIGUSR1
+    void DumpProfile();
+
+    // microbenchmarks of the private stages of the loop (src/bench/detector_bench.cpp)
+    friend class DetectorBench;
+    // checks of the detector state (src/test/detector_test.cpp)
+    friend class DetectorTest;
 public:
     EncryptorDetector(const char* mount, const Config& cfg);
+    /**
+     * @brief Create detector that handles events of the given source instead of fanotify
+     * (for example, synthetic events in benchmarks)
+     */
+    EncryptorDetector(std::unique_ptr<EventSource> source, const char* mount, const Config& cfg);
     void Launch();
-    ~EncryptorDetector() {}
+
+    /**
+     * @brief Cumulative latency of all permission events (main loop and backup worker)
+     */
+    LatencyHistogram::Snapshot PermissionLatency() const;
+
+    /**
+     * @brief Counters of all detector threads, safe to call from any thread
+     */
+    StatsSnapshot Stats() const;
+    // frozen pids are thawed on every exit, processes must not stay stopped without the detector
+    ~EncryptorDetector();
 };
 
 }
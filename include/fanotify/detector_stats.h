@@ -0,0 +1,111 @@
+#ifndef DETECTOR_STATS_HEADER
+#define DETECTOR_STATS_HEADER
+
+#include <fanotify/fanotify_helpers.h>
+#include <fanotify/latency_histogram.h>
+
+// c++ includes
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fn
+{
+
+/**
+ * @brief Stat Counter is a counter with a single writer (thread that owns it) and any amount of readers.
+ *
+ * Writer doesn't use read-modify-write instructions and doesn't take locks, so counting on the hot path
+ * costs as much as a plain increment. Counters of different threads are summed up by the reader.
+ */
+class StatCounter
+{
+    std::atomic<uint64_t> m_value;
+public:
+    StatCounter() : m_value(0) {}
+
+    StatCounter(const StatCounter&) = delete;
+    StatCounter& operator=(const StatCounter&) = delete;
+
+    // must be called only by the owner thread
+    void Add(uint64_t value = 1)
+    {
+        m_value.store(m_value.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    // must be called only by the owner thread, used for gauges
+    void Set(uint64_t value)
+    {
+        m_value.store(value, std::memory_order_relaxed);
+    }
+
+    uint64_t Get() const
+    {
+        return m_value.load(std::memory_order_relaxed);
+    }
+};
+
+/*
+    Stats Snapshot is a copy of detector counters of all threads at some moment
+*/
+struct StatsSnapshot
+{
+    // events of other processes by type
+    std::array<uint64_t, EVENT_COUNT> events{};
+    // the same events by watched mounts
+    struct MountEvents
+    {
+        std::string path;
+        std::array<uint64_t, EVENT_COUNT> events{};
+    };
+    std::vector<MountEvents> mounts;
+    // pids that have events in the time window now
+    uint64_t trackedPids = 0;
+    uint64_t overflows = 0;
+    uint64_t kills = 0;
+    // suspects stopped until the verdict and resumed after it
+    uint64_t freezes = 0;
+    uint64_t thaws = 0;
+    // suspects that exited or whose pid was reused by another process before the response
+    uint64_t staleSuspects = 0;
+    uint64_t whiteListHits = 0;
+    // memory of detector structures in bytes and budget of pid state (0 - no limit)
+    uint64_t evictedPids = 0;
+    uint64_t memoryBudget = 0;
+    uint64_t pidTableBytes = 0;
+    uint64_t eventQueueBytes = 0;
+    uint64_t recorderBytes = 0;
+    uint64_t backupQueueBytes = 0;
+    uint64_t entropyTableBytes = 0;
+    // written files sampled for entropy, with entropy above threshold, and not sampled because queue was full
+    uint64_t entropySamples = 0;
+    uint64_t highEntropySamples = 0;
+    uint64_t entropyDropped = 0;
+    // groups of processes (ancestors, process groups, sessions) with tracked members and their detections
+    uint64_t trackedGroups = 0;
+    uint64_t groupDetections = 0;
+    uint64_t groupTableBytes = 0;
+    // cache of /proc/<pid>/stat
+    uint64_t processCacheBytes = 0;
+    uint64_t processCacheHits = 0;
+    uint64_t processCacheMisses = 0;
+    // files ignored by the kernel because only white-listed programs hammer them
+    uint64_t ignoreMarks = 0;
+    uint64_t ignoreMarksInstalled = 0;
+    // placed canary files and their writes, renames and deletes by other processes
+    uint64_t canaries = 0;
+    uint64_t canaryHits = 0;
+    // snapshots taken by backup worker and their size
+    uint64_t backupFiles = 0;
+    uint64_t backupBytes = 0;
+    // duration of main loop iterations in nanoseconds
+    LatencyHistogram::Snapshot loopTime;
+    // latency of permission events in nanoseconds (see EncryptorDetector::PermissionLatency)
+    LatencyHistogram::Snapshot permissionLatency;
+};
+
+}
+
+#endif // #define DETECTOR_STATS_HEADER
@@ -0,0 +1,103 @@
+#ifndef ENTROPY_SAMPLER_HEADER
+#define ENTROPY_SAMPLER_HEADER
+
+#include <fanotify/event_source.h>
+#include <fanotify/detector_stats.h>
+
+// c++ includes
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace fn
+{
+
+/**
+ * @brief Shannon entropy of bytes in bits per byte (0 - constant data, 8 - uniformly random data)
+ *
+ * Byte histogram is built with 4 interleaved tables, so consecutive bytes with the same value don't
+ * make the loop wait for the previous increment, the compiler vectorizes merging of tables.
+ */
+double ShannonEntropy(const uint8_t* data, size_t size);
+
+/*
+    Result of sampling of one written file
+*/
+struct EntropySample
+{
+    int pid;
+    // maximal entropy of sampled pages, so partially encrypted file is noticed by its first page
+    double entropy;
+};
+
+/**
+ * @brief Entropy Sampler estimates entropy of written files in a pool of worker threads.
+ *
+ * Only a few pages spread over the file are read with pread() through the event fd, the file
+ * is never read fully. The queue is bounded: when workers can't keep up, events are not sampled,
+ * so the main loop never waits for file reads.
+ */
+class EntropySampler final
+{
+    static constexpr size_t m_pageSize = 4096;
+    // smaller files don't have enough bytes to tell text from random data
+    static constexpr size_t m_minFileSize = 512;
+
+    EventSource& m_source;
+    size_t m_pages;
+    size_t m_maxQueue;
+
+    std::queue<fanotify_event_metadata> m_tasks;
+    std::vector<EntropySample> m_results;
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    bool m_stop;
+    std::vector<std::thread> m_threads;
+
+    // written only by the main loop
+    StatCounter m_dropped;
+
+    void Run();
+    // @return false if the file can't be sampled (too small, not a regular file, no content)
+    bool Sample(const fanotify_event_metadata& event, std::vector<uint8_t>& buffer, double& entropy);
+public:
+    /**
+     * @brief Start worker threads
+     *
+     * @param source event source to read content of files and release events with
+     * @param threads amount of worker threads
+     * @param pages amount of pages to sample from every file
+     * @param maxQueue maximal amount of events waiting for sampling
+     */
+    EntropySampler(EventSource& source, size_t threads, size_t pages, size_t maxQueue);
+
+    EntropySampler(const EntropySampler&) = delete;
+    EntropySampler& operator=(const EntropySampler&) = delete;
+
+    /**
+     * @brief Queue written file for sampling. Event is released by the sampler, unless the queue is full.
+     *
+     * @param event FAN_CLOSE_WRITE event
+     * @return false if the queue is full, the caller keeps the event
+     */
+    bool Submit(const fanotify_event_metadata& event);
+
+    /**
+     * @brief Take results of sampled files since the previous call
+     */
+    std::vector<EntropySample> TakeResults();
+
+    /**
+     * @brief Amount of events that were not sampled because the queue was full
+     */
+    uint64_t Dropped() const { return m_dropped.Get(); }
+
+    ~EntropySampler();
+};
+
+}
+
+#endif // #define ENTROPY_SAMPLER_HEADER
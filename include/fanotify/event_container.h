@@ -0,0 +1,192 @@
+#ifndef EVENT_CONTAINER_HEADER
+#define EVENT_CONTAINER_HEADER
+
+// c includes
+#include <sys/fanotify.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// c++ includes
+#include <stdexcept>
+#include <iterator>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+namespace fn
+{
+
+constexpr size_t EVENTS_BUFFER_SIZE = 200;
+
+/**
+ * @brief Event Container incapsulates events on current bufferized read ans allows to iterate over them easily
+ * 
+ */
+class EventContainer
+{
+    fanotify_event_metadata m_buffer[EVENTS_BUFFER_SIZE];
+    ssize_t m_len;
+    bool m_isEmpty;
+public:
+    struct Iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using difference_type   = std::ptrdiff_t;
+        using value_type        = fanotify_event_metadata;
+        using pointer           = value_type*;
+        using reference         = value_type&;
+
+        Iterator(pointer bufferPtr, ssize_t len) :
+            m_bufferPtr(bufferPtr),
+            m_len(len) {}
+        
+        reference operator*() const 
+        { 
+            return *m_bufferPtr;
+        }
+        pointer operator->() 
+        { 
+            return m_bufferPtr;
+        }
+
+        // Prefix increment
+        Iterator& operator++() 
+        {
+            m_bufferPtr = FAN_EVENT_NEXT(m_bufferPtr, m_len);
+
+            if (!FAN_EVENT_OK(m_bufferPtr, m_len))
+            {
+                // invalidate iterator
+                m_bufferPtr = nullptr;
+                m_len = -1;
+            }
+
+            return *this;
+        }  
+
+        // Postfix increment
+        Iterator operator++(int) 
+        { 
+            Iterator tmp = *this; 
+            ++(*this); 
+            return tmp;
+        }
+
+        friend bool operator== (const Iterator& a, const Iterator& b) 
+        { 
+            return (a.m_bufferPtr == b.m_bufferPtr) && (a.m_len == b.m_len);
+        }
+
+        friend bool operator!= (const Iterator& a, const Iterator& b) 
+        { 
+            return !(a == b); 
+        }
+    private:
+        pointer m_bufferPtr;
+        ssize_t m_len;
+    };
+
+    EventContainer(int fd)
+    {
+        // Read events from given descriptor
+        m_len = read(fd, m_buffer, sizeof(m_buffer));
+        if (m_len == -1 && errno != EAGAIN)
+            throw std::runtime_error("Read error while reading events from fanotify notification group");
+        
+        m_isEmpty = (m_len <= 0);
+    }
+
+    // copy already prepared events (for sources that don't read them from fanotify descriptor)
+    EventContainer(const fanotify_event_metadata* events, size_t count)
+    {
+        count = std::min(count, EVENTS_BUFFER_SIZE);
+        if (count > 0)
+            std::memcpy(m_buffer, events, count * sizeof(fanotify_event_metadata));
+        m_len = count * sizeof(fanotify_event_metadata);
+        m_isEmpty = (m_len == 0);
+    }
+
+    Iterator begin()
+    {
+        return {m_buffer, m_len};
+    }
+
+    Iterator end()
+    {
+        return {nullptr, -1};
+    }
+
+    bool IsEmpty()
+    {
+        return m_isEmpty;
+    }
+};
+
+/*
+    Directory entry of the event reported with FAN_REPORT_DFID_NAME: handle of the parent directory and name in it
+*/
+struct DirEntryInfo
+{
+    __kernel_fsid_t fsid;
+    const file_handle* handle;
+    const char* name;
+};
+
+/**
+ * @brief Find directory entry record among variable-length info records that follow the metadata
+ *
+ * @param metadata event read from notification group with FAN_REPORT_DFID_NAME
+ * @param info pointers into the event buffer, they are valid while the container lives
+ * @return false if the event has no such record (overflow event) or records are malformed
+ */
+inline bool GetDirEntryInfo(const fanotify_event_metadata& metadata, DirEntryInfo& info) noexcept
+{
+    auto event = reinterpret_cast<const char*>(&metadata);
+    size_t offset = metadata.metadata_len;
+    while (offset + sizeof(fanotify_event_info_header) <= metadata.event_len)
+    {
+        auto header = reinterpret_cast<const fanotify_event_info_header*>(event + offset);
+        if (header->len < sizeof(fanotify_event_info_header) || offset + header->len > metadata.event_len)
+            return false;
+
+        if (header->info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+        {
+            auto fid = reinterpret_cast<const fanotify_event_info_fid*>(header);
+            info.fsid = fid->fsid;
+            info.handle = reinterpret_cast<const file_handle*>(fid->handle);
+            // name is null terminated and follows the handle
+            info.name = reinterpret_cast<const char*>(info.handle->f_handle) + info.handle->handle_bytes;
+            return true;
+        }
+
+        offset += header->len;
+    }
+
+    return false;
+}
+
+/**
+ * @brief Check the mask of the given fanotify metadata for the certain type of event
+ * 
+ * @param type event type
+ * @param metadata given metadata to check
+ */
+constexpr inline bool IsEvent(fanotify_event_metadata& metadata, size_t type) noexcept
+{
+    return metadata.mask & type;
+}
+/**
+ * @brief Check if the fanotify event metadata is empty
+ * 
+ * @param metadata fanotify metadata to check
+ */
+constexpr inline bool IsEmpty(fanotify_event_metadata& metadata) noexcept
+{
+    fanotify_event_metadata empty{};
+    return (std::memcmp(&metadata, &empty, sizeof(fanotify_event_metadata)) == 0);
+}
+
+}
+
+#endif // #define EVENT_CONTAINER_HEADER
@@ -0,0 +1,262 @@
+#ifndef EVENT_SOURCE_HEADER
+#define EVENT_SOURCE_HEADER
+
+#include <fanotify/event_container.h>
+#include <fanotify/fanotify_helpers.h>
+
+// c includes
+#include <signal.h>
+
+// c++ includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace fn
+{
+
+/*
+    Directory entry event (create, delete, move) of a file, its path is resolved by the source
+*/
+struct DirectoryEvent
+{
+    uint64_t mask;
+    int pid;
+    std::string path;
+};
+
+/*
+    Process group stopped with the suspect. The whole group is signaled at once, unless it has white-listed
+    members: they are spared then and the rest of members are signaled one by one.
+*/
+struct StoppedGroup
+{
+    int pgid; // 0 if only the process itself is signaled
+    std::vector<int> members; // members signaled one by one, empty if the whole group is signaled
+};
+
+/**
+ * @brief Event Source is an interface of everything that feeds fanotify events to the detector:
+ * real fanotify notification group, synthetic generator for benchmarks, recorded trace, etc.
+ * Events are fanotify_event_metadata structs, but their fd is meaningful only for the source
+ * itself, so the detector asks the source for the path of the event and to release it.
+ * Processes and time are taken from the source too, so recorded events can be replayed
+ * with their original timing and without touching real processes.
+ */
+class EventSource
+{
+public:
+    using clock = std::chrono::steady_clock;
+    using time_point = std::chrono::time_point<clock>;
+
+    /**
+     * @brief Start tracking given events on the filesystem object (see man fanotify_mark)
+     */
+    virtual void Mark(unsigned int flags, uint64_t mask, int dfd, const std::string& pathName) = 0;
+
+    /**
+     * @brief Block until new events are available or wait timeout expires
+     *
+     * @return true if there might be events to handle, false if the loop must be stopped
+     */
+    virtual bool WaitForEvent() = 0;
+
+    /**
+     * @brief Limit blocking of WaitForEvent(), so the loop can do periodic work without events
+     *
+     * @param timeoutMs maximum wait time in milliseconds, -1 - wait forever
+     */
+    virtual void SetWaitTimeout(int timeoutMs)
+    {
+        (void) timeoutMs; // sources that don't block have nothing to limit
+    }
+
+    /**
+     * @brief Get next portion of events
+     */
+    virtual EventContainer GetEvents() = 0;
+
+    /**
+     * @brief Start tracking directory entry events (see DIRECTORY_EVENTS) on the whole filesystem of the path
+     */
+    virtual void MarkDirectories(uint64_t mask, const std::string& pathName)
+    {
+        (void) mask; // sources without directory events ignore the mark
+        (void) pathName;
+    }
+
+    /**
+     * @brief Get directory entry events that arrived since the previous call
+     */
+    virtual std::vector<DirectoryEvent> GetDirectoryEvents()
+    {
+        return {};
+    }
+
+    /**
+     * @brief Answer permission event
+     */
+    virtual void ResponseAllow(const fanotify_event_metadata& metadata) const = 0;
+    virtual void ResponseDeny(const fanotify_event_metadata& metadata) const = 0;
+
+    /**
+     * @brief Get path to the file of the event
+     */
+    virtual std::string GetPath(const fanotify_event_metadata& metadata) = 0;
+
+    /**
+     * @brief Event is handled, free its resources (for example, close its file descriptor)
+     */
+    virtual void Release(const fanotify_event_metadata& metadata) = 0;
+
+    /**
+     * @brief Get file descriptor to read content of the file of the event, it stays valid until Release()
+     *
+     * @return file descriptor or -1 if the source has no real files (synthetic or recorded events)
+     */
+    virtual int GetContentFd(const fanotify_event_metadata& metadata)
+    {
+        (void) metadata;
+        return -1;
+    }
+
+    /**
+     * @brief Current time of the event stream
+     */
+    virtual time_point Now()
+    {
+        return clock::now();
+    }
+
+    /**
+     * @brief Get path to the executable of the process, throws std::runtime_error if process doesn't exist
+     */
+    virtual std::string GetExecutable(int pid)
+    {
+        return GetFilenameByPid(pid);
+    }
+
+    /**
+     * @brief Get parent, process group, session and start time of the process
+     *
+     * @return false if the process doesn't exist
+     */
+    virtual bool GetProcessStat(int pid, ProcessStat& stat)
+    {
+        return ReadProcessStat(pid, stat);
+    }
+
+    /**
+     * @brief Get cgroup path of the process
+     *
+     * @return false if the process doesn't exist
+     */
+    virtual bool GetCgroup(int pid, std::string& cgroup)
+    {
+        return ReadProcessCgroup(pid, cgroup);
+    }
+
+    /**
+     * @brief Pin the suspect process before responding to it: open its pidfd and check that the pid isn't reused
+     *
+     * @param seen time the process was surely alive at (time of its event), process started later has reused the pid
+     * @param pidfd handle to pass to Freeze(), Thaw() and Kill(), -1 if signals are sent by pid. It is closed by the caller.
+     * @return false if the process has exited or the pid belongs to another process now
+     */
+    virtual bool OpenProcess(int pid, time_point seen, int& pidfd)
+    {
+        return PinProcess(pid, seen, pidfd);
+    }
+
+    /**
+     * @brief Stop the suspect process until the verdict, it is thawed or killed afterwards. Its process group
+     * (children it has forked) is stopped too if it can be signaled (see GetSignalableGroup()), except members
+     * running white-listed executables.
+     *
+     * @param group process group that has been stopped with the process, its pgid is 0 if only the process is stopped
+     * @param whiteList executables that are never signaled
+     * @return false if the process doesn't exist
+     */
+    virtual bool Freeze(int pid, int pidfd, StoppedGroup& group, const std::vector<std::string>& whiteList)
+    {
+        group = {0, {}};
+        // the process is stopped first, so it can't leave the group or spawn new members into it
+        if (!SignalProcess(pid, pidfd, SIGSTOP))
+            return false;
+
+        int pgid = GetSignalableGroup(pid);
+        if (pgid == 0)
+            return true;
+
+        bool hasSpared = false;
+        std::vector<int> members;
+        for (auto member : GetGroupMembers(pgid))
+        {
+            if (member == pid)
+                continue ;
+
+            std::string executable;
+            try
+            {
+                executable = GetExecutable(member);
+            }
+            catch (const std::runtime_error&)
+            {
+                // member has exited or its executable can't be read, it is judged like the suspect
+            }
+
+            if (std::find(whiteList.begin(), whiteList.end(), executable) != whiteList.end())
+                hasSpared = true;
+            else
+                members.push_back(member);
+        }
+
+        if (!hasSpared)
+        {
+            if (SignalProcessGroup(pid, pidfd, pgid, SIGSTOP))
+                group.pgid = pgid;
+            return true;
+        }
+
+        // a process forked by a running member after the scan isn't stopped
+        SignalGroupMembers(pgid, members, SIGSTOP);
+        group = {pgid, std::move(members)};
+        return true;
+    }
+
+    /**
+     * @brief Resume the process and the group stopped by Freeze()
+     */
+    virtual void Thaw(int pid, int pidfd, const StoppedGroup& group)
+    {
+        if (!group.members.empty())
+            SignalGroupMembers(group.pgid, group.members, SIGCONT);
+        else if (group.pgid != 0 && SignalProcessGroup(pid, pidfd, group.pgid, SIGCONT))
+            return ;
+        SignalProcess(pid, pidfd, SIGCONT);
+    }
+
+    /**
+     * @brief Terminate the process that is found to be an encryptor
+     *
+     * @param group process group stopped with it by Freeze(), its pgid is 0 to kill only the process
+     */
+    virtual void Kill(int pid, int pidfd, const StoppedGroup& group)
+    {
+        // the process itself is killed even if the group can't be signaled
+        if (!group.members.empty())
+            SignalGroupMembers(group.pgid, group.members, SIGKILL);
+        else if (group.pgid != 0)
+            SignalProcessGroup(pid, pidfd, group.pgid, SIGKILL);
+        SignalProcess(pid, pidfd, SIGKILL);
+    }
+
+    virtual ~EventSource() {}
+};
+
+}
+
+#endif // #define EVENT_SOURCE_HEADER
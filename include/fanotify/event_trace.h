@@ -0,0 +1,114 @@
+#ifndef EVENT_TRACE_HEADER
+#define EVENT_TRACE_HEADER
+
+// c includes
+#include <sys/fanotify.h>
+#include <stdio.h>
+
+// c++ includes
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace fn
+{
+
+/*
+    Event trace is a compact binary recording of the event stream seen by detector:
+
+    header: "FNTR" | uint32 version | int64 wall clock time of the start (ns since epoch)
+    records, each starts with uint8 tag:
+        TRACE_PATH:  uint32 path id | uint32 length | path bytes
+        TRACE_PROC:  int32 pid | uint32 length | executable path bytes (empty if unknown)
+        TRACE_EVENT: uint64 time (ns since the start) | uint64 mask | int32 pid | uint32 path id
+
+    Paths and executables are written once, the first time they are seen, so every event takes 25 bytes.
+    Integers are written in host byte order, traces are meant to be replayed on the same architecture.
+*/
+
+constexpr char TRACE_MAGIC[4] = {'F', 'N', 'T', 'R'};
+constexpr uint32_t TRACE_VERSION = 1;
+
+enum TraceTag : uint8_t
+{
+    TRACE_PATH = 1,
+    TRACE_PROC = 2,
+    TRACE_EVENT = 3,
+};
+
+struct TraceEvent
+{
+    uint64_t timeNs;
+    uint64_t mask;
+    int32_t pid;
+    uint32_t pathId;
+};
+
+/**
+ * @brief Event Trace Writer appends events to the trace file. It is used only from the detector thread.
+ */
+class EventTraceWriter
+{
+    using clock = std::chrono::steady_clock;
+
+    FILE* m_file;
+    std::vector<char> m_buffer; // stdio buffer, so a record costs a memcpy and not a syscall
+    std::chrono::time_point<clock> m_start;
+    std::unordered_map<std::string, uint32_t> m_pathIds;
+    std::unordered_set<int32_t> m_knownPids;
+    // memory of path and pid tables
+    size_t m_tableBytes;
+
+    void Write(const void* data, size_t size);
+    template <typename T>
+    void Write(const T& value)
+    {
+        Write(&value, sizeof(value));
+    }
+public:
+    EventTraceWriter(const std::string& path);
+
+    EventTraceWriter(const EventTraceWriter&) = delete;
+    EventTraceWriter& operator=(const EventTraceWriter&) = delete;
+
+    /**
+     * @brief Record the event
+     *
+     * @param time time the event was handled at
+     * @param mask event mask
+     * @param pid pid of the process that caused the event
+     * @param path path to the file of the event
+     */
+    void Record(std::chrono::time_point<clock> time, uint64_t mask, int32_t pid, const std::string& path);
+
+    // push buffered records to the file, so they survive the crash of detector
+    void Flush();
+
+    // estimated memory of the buffer and tables of known paths and pids in bytes
+    size_t MemoryUsage() const { return m_buffer.size() + m_tableBytes; }
+
+    ~EventTraceWriter();
+};
+
+/**
+ * @brief Event Trace is a recording loaded into memory
+ */
+struct EventTrace
+{
+    int64_t startWallNs;
+    std::vector<TraceEvent> events;
+    std::vector<std::string> paths; // indexed by path id
+    std::unordered_map<int32_t, std::string> executables;
+};
+
+/**
+ * @brief Load the whole trace file, throws std::runtime_error if it is malformed
+ */
+EventTrace ReadEventTrace(const std::string& path);
+
+}
+
+#endif // #define EVENT_TRACE_HEADER
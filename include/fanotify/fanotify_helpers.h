@@ -7,7 +7,10 @@
 #include <limits.h>
 
 // c++ includes
+#include <chrono>
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace fn
 {
@@ -19,13 +22,100 @@ enum EventType
     EVENT_WRITE,
     EVENT_OPEN,
     EVENT_CLOSE,
+    // directory entry events, they are reported by the separate notification group (see MarkDirectories)
+    EVENT_CREATE,
+    EVENT_DELETE,
+    EVENT_RENAME,
     EVENT_COUNT
 };
 
+// Events that can be tracked only by notification group that reports directory handles and names
+constexpr uint64_t DIRECTORY_EVENTS = FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO;
+
 EventType FanotifyEventToIdx(size_t type);
 
 std::string GetFilenameByPid(int pid);
 
+// pid_max can't be greater than 2^22 (PID_MAX_LIMIT), so pids starting from here never exist in the system
+constexpr int FAKE_PID_BASE = (1 << 22) + 1;
+
+/*
+    Fields of /proc/<pid>/stat the detector needs
+*/
+struct ProcessStat
+{
+    int ppid;
+    int pgid;
+    int sid;
+    // time the process started after boot (in clock ticks), it tells a reused pid from the old process
+    uint64_t startTime;
+};
+
+/**
+ * @brief Read /proc/<pid>/stat
+ *
+ * @return false if the process doesn't exist
+ */
+bool ReadProcessStat(int pid, ProcessStat& stat);
+
+/**
+ * @brief Convert start time of the process (clock ticks after boot, see ProcessStat) to unix time in seconds
+ */
+int64_t StartTimeToUnix(uint64_t startTime);
+
+/**
+ * @brief Read cgroup path of the process from /proc/<pid>/cgroup, path of the unified hierarchy (cgroup v2)
+ * is preferred, path of the first v1 hierarchy where the process is not in the root is taken otherwise
+ *
+ * @return false if the process doesn't exist
+ */
+bool ReadProcessCgroup(int pid, std::string& cgroup);
+
+/**
+ * @brief Open pidfd of the process and check that the pid isn't reused: the process must have started before
+ * the given time. Signals sent through pidfd can't reach another process that gets the pid later.
+ *
+ * @param seen time (steady clock) the process was surely alive at
+ * @param pidfd pidfd of the process, -1 if pidfds aren't supported by the kernel
+ * @return false if the process has exited or the pid belongs to a process started after seen
+ */
+bool PinProcess(int pid, std::chrono::steady_clock::time_point seen, int& pidfd);
+
+/**
+ * @brief Send signal through pidfd, or by pid if pidfd is -1
+ *
+ * @return false if the process has exited
+ */
+bool SignalProcess(int pid, int pidfd, int sig);
+
+/**
+ * @brief Get process group that can be stopped and killed along with the process: children it has forked are
+ * in its group unless they have left it. Group of another session leader (login shell, sshd session), of init
+ * or of the detector itself is never signaled.
+ *
+ * @return process group id, 0 if only the process itself can be signaled
+ */
+int GetSignalableGroup(int pid);
+
+/**
+ * @brief Send signal to the process group of the pinned process, it must be alive and stay in the group:
+ * while it lives the group id can't be taken by another group
+ *
+ * @return false if the pinned process has exited, the group is not signaled then
+ */
+bool SignalProcessGroup(int pid, int pidfd, int pgid, int sig);
+
+/**
+ * @brief Find all processes of the process group
+ */
+std::vector<int> GetGroupMembers(int pgid);
+
+/**
+ * @brief Send signal to the given members of the process group one by one, a member that has left the group
+ * (or whose pid is taken by another process) is skipped
+ */
+void SignalGroupMembers(int pgid, const std::vector<int>& members, int sig);
+
 std::string StringizeEventType(size_t type);
 
 ssize_t StringToEventType(const std::string& str);
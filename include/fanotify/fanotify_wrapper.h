@@ -1,4 +1,4 @@
-#ifndef FANITIFY_WRAPPER
+#ifndef FANOTIFY_WRAPPER
 #define FANOTIFY_WRAPPER
 
 // c includes/defines
@@ -7,6 +7,7 @@
 #endif // #define _GNU_SOURCE
 
 #include <sys/fanotify.h>
+#include <sys/statfs.h>
 #include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
@@ -18,145 +19,50 @@
 #include <cstring>
 #include <vector>
 #include <iostream>
+#include <unordered_map>
 
-namespace fn
-{
+#include <fanotify/event_source.h>
 
-constexpr size_t EVENTS_BUFFER_SIZE = 200;
-
-class EventContainer
+namespace fn
 {
-    fanotify_event_metadata m_buffer[EVENTS_BUFFER_SIZE];
-    ssize_t m_len;
-    bool m_isEmpty;
-public:
-    struct Iterator
-    {
-        using iterator_category = std::forward_iterator_tag;
-        using difference_type   = std::ptrdiff_t;
-        using value_type        = fanotify_event_metadata;
-        using pointer           = value_type*;
-        using reference         = value_type&;
-
-        Iterator(pointer bufferPtr, ssize_t len) :
-            m_bufferPtr(bufferPtr),
-            m_len(len) {}
-        
-        reference operator*() const 
-        { 
-            return *m_bufferPtr;
-        }
-        pointer operator->() 
-        { 
-            return m_bufferPtr;
-        }
-
-        // Prefix increment
-        Iterator& operator++() 
-        {
-            m_bufferPtr = FAN_EVENT_NEXT(m_bufferPtr, m_len);
-
-            if (!FAN_EVENT_OK(m_bufferPtr, m_len))
-            {
-                // invalidate iterator
-                m_bufferPtr = nullptr;
-                m_len = -1;
-            }
-
-            return *this;
-        }  
-
-        // Postfix increment
-        Iterator operator++(int) 
-        { 
-            Iterator tmp = *this; 
-            ++(*this); 
-            return tmp;
-        }
-
-        friend bool operator== (const Iterator& a, const Iterator& b) 
-        { 
-            return (a.m_bufferPtr == b.m_bufferPtr) && (a.m_len == b.m_len);
-        }
-
-        friend bool operator!= (const Iterator& a, const Iterator& b) 
-        { 
-            return !(a == b); 
-        }
-    private:
-        pointer m_bufferPtr;
-        ssize_t m_len;
-    };
-
-    EventContainer(int fd)
-    {
-        // Read events from given descriptor
-        m_len = read(fd, m_buffer, sizeof(m_buffer));
-        if (m_len == -1 && errno != EAGAIN)
-            throw std::runtime_error("Read error while reading events from fanotify notification group");
-        
-        m_isEmpty = (m_len == 0);
-    }
-
-    Iterator begin()
-    {
-        return {m_buffer, m_len};
-    }
-
-    Iterator end()
-    {
-        return {nullptr, -1};
-    }
-
-    bool IsEmpty()
-    {
-        return m_isEmpty;
-    }
-};
 
 #ifndef DAEMON_FANOTIFY
-constexpr nfds_t NFDS = 2; // number of file descriptors for poll
-constexpr size_t STDIN_FD_IDX = 1;
+constexpr nfds_t NFDS = 3; // number of file descriptors for poll
+constexpr size_t STDIN_FD_IDX = 2;
 #else
-constexpr nfds_t NFDS = 1; // number of file descriptors for poll
+constexpr nfds_t NFDS = 2; // number of file descriptors for poll
 #endif
 constexpr size_t FANOTIFY_FD_IDX = 0;
-
-
-/**
- * @brief Event Container incapsulates events on current bufferized read ans allows to iterate over them easily
- * 
- */
-class EventContainer;
-
-/**
- * @brief Check the mask of the given fanotify metadata for the certain type of event
- * 
- * @param type event type
- * @param metadata given metadata to check
- */
-constexpr inline bool IsEvent(fanotify_event_metadata& metadata, size_t type) noexcept
-{
-    return metadata.mask & type;
-}
-/**
- * @brief Check if the fanotify event metadata is empty
- * 
- * @param metadata fanotify metadata to check
- */
-constexpr inline bool IsEmpty(fanotify_event_metadata& metadata) noexcept
-{
-    fanotify_event_metadata empty{};
-    return (std::memcmp(&metadata, &empty, sizeof(fanotify_event_metadata)) == 0);
-}
+constexpr size_t DIRECTORY_FD_IDX = 1; // -1 until directories are marked, poll skips it
 
 /**
  * @brief Fanotify Wrapper gives C++ API for C functions related to fanotify
  */
-class FanotifyWrapper final
+class FanotifyWrapper final : public EventSource
 {
     pollfd m_fds[NFDS]; // pollfd struct for futher polling between stdin and fanotify fd
     int m_notificationGroupFd; // file descriptor to access fanotify API
+    int m_waitTimeoutMs; // poll timeout, -1 - infinite
+    bool m_isReadable; // last poll reported events, so read won't block
+
+    // group with FAN_REPORT_DFID_NAME for directory entry events, it is created by the first MarkDirectories()
+    int m_directoryGroupFd;
+    bool m_isDirectoryReadable;
+    // directory of every marked filesystem (by fsid), handles are opened relative to it
+    std::unordered_map<uint64_t, int> m_mountFds;
+
+    struct CachedDirectory
+    {
+        std::string path;
+        time_point loaded;
+    };
+    // paths of directories by fsid and handle, renamed directory keeps its handle, so entries expire
+    std::unordered_map<std::string, CachedDirectory> m_directoryCache;
+    static constexpr size_t m_maxCachedDirectories = 4096;
+    static constexpr std::chrono::seconds m_directoryMaxAge{10};
+
+    // resolve path of the directory by its handle, empty if it is already deleted
+    std::string ResolveDirectory(const DirEntryInfo& info);
 
     /**
      * @brief Write given type of responce to fanotify notification group
@@ -176,7 +82,7 @@ public:
      * @param dfd the filesystem object to be marked - file descriptor
      * @param pathName the filesystem object to be marked - path name (see man fanotify_mark)
      */
-    void Mark(unsigned int flags, uint64_t mask, int dfd, const std::string& pathName);
+    void Mark(unsigned int flags, uint64_t mask, int dfd, const std::string& pathName) override;
 
    /**
     * @brief Wait for any event from notification group. In case of any error function will throw a corresponding exception. To exit the loop, press enter (send something to stdin).
@@ -195,9 +101,16 @@ public:
     *        // handle exception
     *    }
     * 
-    * @return return true if there is a valid event to handle, false if the loop was stopped.
+    * @return return true if there is a valid event to handle, wait timeout expired or it was interrupted by a signal, false if the loop was stopped.
     */
-    bool WaitForEvent();
+    bool WaitForEvent() override;
+
+    /**
+     * @brief Set poll timeout of WaitForEvent()
+     * 
+     * @param timeoutMs timeout in milliseconds, -1 - infinite
+     */
+    void SetWaitTimeout(int timeoutMs) override;
 
     /**
      * @brief Get the event container to iterate over
@@ -217,23 +130,58 @@ public:
      * 
      * @return event container
      */
-    EventContainer GetEvents();
+    EventContainer GetEvents() override;
+
+    /**
+     * @brief Mark the whole filesystem of the path in the directory group, directory entry events
+     * can't be tracked on a mount (it needs Linux 5.9 and a filesystem with file handles)
+     *
+     * @param mask directory entry events (see DIRECTORY_EVENTS)
+     * @param pathName any path on the filesystem
+     */
+    void MarkDirectories(uint64_t mask, const std::string& pathName) override;
+
+    /**
+     * @brief Read directory entry events, parent directories are resolved through the cache
+     */
+    std::vector<DirectoryEvent> GetDirectoryEvents() override;
 
     /**
      * @brief Allow fanotify event
      * 
      * @param metadata given event metadata
      */
-    void ResponseAllow(const fanotify_event_metadata& metadata) const;
+    void ResponseAllow(const fanotify_event_metadata& metadata) const override;
 
     /**
      * @brief Deny fanotify event
      * 
      * @param metadata given event metadata
      */
-    void ResponseDeny(const fanotify_event_metadata& metadata) const;
+    void ResponseDeny(const fanotify_event_metadata& metadata) const override;
+
+    /**
+     * @brief Get path to the file of the event by its file descriptor
+     * 
+     * @param metadata given event metadata
+     */
+    std::string GetPath(const fanotify_event_metadata& metadata) override;
+
+    /**
+     * @brief Get file descriptor of the event to read the file content
+     * 
+     * @param metadata given event metadata
+     */
+    int GetContentFd(const fanotify_event_metadata& metadata) override;
+
+    /**
+     * @brief Close file descriptor of the event
+     * 
+     * @param metadata given event metadata
+     */
+    void Release(const fanotify_event_metadata& metadata) override;
 
-    ~FanotifyWrapper() {}
+    ~FanotifyWrapper();
 };
 
 } // namespace fn
@@ -0,0 +1,137 @@
+#ifndef LATENCY_HISTOGRAM_HEADER
+#define LATENCY_HISTOGRAM_HEADER
+
+// c++ includes
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace fn
+{
+
+/**
+ * @brief Latency Histogram is a log-linear (HDR-like) histogram of nanosecond values.
+ *
+ * Every power of two is split into 2^m_subBits linear sub-buckets, so relative error of any
+ * percentile is below 1/2^m_subBits (6.25%) for the whole uint64_t range with fixed memory.
+ * Histogram has a single writer (thread that owns it) and any amount of readers: counters are
+ * atomics updated without read-modify-write instructions, readers take a Snapshot.
+ */
+class LatencyHistogram
+{
+public:
+    static constexpr unsigned m_subBits = 4;
+    static constexpr uint64_t m_subBuckets = 1ull << m_subBits;
+    static constexpr size_t m_buckets = (64 - m_subBits + 1) * m_subBuckets;
+
+    static constexpr size_t BucketIdx(uint64_t value)
+    {
+        if (value < m_subBuckets)
+            return value;
+
+        unsigned exponent = 63 - __builtin_clzll(value);
+        uint64_t sub = (value >> (exponent - m_subBits)) & (m_subBuckets - 1);
+        return (exponent - m_subBits + 1) * m_subBuckets + sub;
+    }
+
+    // the biggest value that falls into the bucket
+    static constexpr uint64_t BucketValue(size_t idx)
+    {
+        if (idx < m_subBuckets)
+            return idx;
+
+        unsigned exponent = idx / m_subBuckets + m_subBits - 1;
+        uint64_t sub = idx % m_subBuckets;
+        uint64_t low = (m_subBuckets + sub) << (exponent - m_subBits);
+        return low + ((1ull << (exponent - m_subBits)) - 1);
+    }
+
+    /*
+        Snapshot is a plain copy of counters, it can be merged with snapshots of other threads
+        and subtracted from the later one to get the histogram of the time window
+    */
+    struct Snapshot
+    {
+        std::array<uint64_t, m_buckets> counts{};
+
+        uint64_t Count() const
+        {
+            uint64_t count = 0;
+            for (auto& bucket : counts)
+                count += bucket;
+            return count;
+        }
+
+        // value below which the given share (0..1) of values lies
+        uint64_t Percentile(double share) const
+        {
+            uint64_t count = Count();
+            if (count == 0)
+                return 0;
+
+            uint64_t rank = share * count;
+            if (rank >= count)
+                rank = count - 1;
+
+            uint64_t seen = 0;
+            for (size_t i = 0; i < m_buckets; ++i)
+            {
+                seen += counts[i];
+                if (seen > rank)
+                    return BucketValue(i);
+            }
+            return 0; // unreachable code
+        }
+
+        uint64_t Max() const
+        {
+            for (size_t i = m_buckets; i > 0; --i)
+            {
+                if (counts[i - 1])
+                    return BucketValue(i - 1);
+            }
+            return 0;
+        }
+
+        Snapshot& operator+=(const Snapshot& other)
+        {
+            for (size_t i = 0; i < m_buckets; ++i)
+                counts[i] += other.counts[i];
+            return *this;
+        }
+
+        Snapshot& operator-=(const Snapshot& earlier)
+        {
+            for (size_t i = 0; i < m_buckets; ++i)
+                counts[i] -= earlier.counts[i];
+            return *this;
+        }
+    };
+
+    LatencyHistogram() : m_counts() {}
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // must be called only by the owner thread
+    void Record(uint64_t value)
+    {
+        auto& counter = m_counts[BucketIdx(value)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    Snapshot Take() const
+    {
+        Snapshot snapshot;
+        for (size_t i = 0; i < m_buckets; ++i)
+            snapshot.counts[i] = m_counts[i].load(std::memory_order_relaxed);
+        return snapshot;
+    }
+private:
+    std::array<std::atomic<uint64_t>, m_buckets> m_counts;
+};
+
+}
+
+#endif // #define LATENCY_HISTOGRAM_HEADER
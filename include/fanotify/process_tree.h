@@ -0,0 +1,84 @@
+#ifndef PROCESS_TREE_HEADER
+#define PROCESS_TREE_HEADER
+
+#include <fanotify/event_source.h>
+#include <fanotify/detector_stats.h>
+
+// c++ includes
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fn
+{
+
+/**
+ * @brief Process Tree is a lazily populated cache of /proc/<pid>/stat (parent, process group, session)
+ * and /proc/<pid>/cgroup.
+ *
+ * Processes are looked up only when they are seen for the first time in the time window, not on every event.
+ * Entries live for m_maxAge, so reused pids are read again. It is used only from the detector thread.
+ */
+class ProcessTree
+{
+    using time_point = EventSource::time_point;
+
+    static constexpr std::chrono::seconds m_maxAge{10};
+
+    struct Entry
+    {
+        ProcessStat stat;
+        bool isAlive;
+        time_point loaded;
+        // cgroup is read only if it is asked for, empty if the process doesn't exist
+        bool isCgroupLoaded;
+        std::string cgroup;
+    };
+
+    EventSource& m_source;
+    std::unordered_map<int, Entry> m_cache;
+    time_point m_lastSweep;
+    // bytes of cgroup paths out of entries
+    size_t m_cgroupBytes;
+    // lookups served from cache and from /proc, they are read by stats server thread
+    StatCounter m_hits;
+    StatCounter m_misses;
+
+    // find fresh entry of the process or read its stat again
+    Entry& Lookup(int pid);
+public:
+    explicit ProcessTree(EventSource& source);
+
+    /**
+     * @brief Get stat of the process from cache or /proc
+     *
+     * @return nullptr if the process doesn't exist
+     */
+    const ProcessStat* Get(int pid);
+
+    /**
+     * @brief Get cgroup path of the process from cache or /proc
+     *
+     * @return nullptr if the process doesn't exist
+     */
+    const std::string* Cgroup(int pid);
+
+    /**
+     * @brief Get ancestors of the process from the parent up, init (pid 1) and kernel threads are not included
+     *
+     * @param depth maximal amount of ancestors
+     */
+    std::vector<int> Ancestors(int pid, unsigned depth);
+
+    // remove outdated entries, it is cheap to call on every iteration
+    void Sweep();
+
+    size_t MemoryUsage() const;
+    uint64_t Hits() const { return m_hits.Get(); }
+    uint64_t Misses() const { return m_misses.Get(); }
+};
+
+}
+
+#endif // #define PROCESS_TREE_HEADER
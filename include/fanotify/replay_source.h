@@ -0,0 +1,91 @@
+#ifndef REPLAY_SOURCE_HEADER
+#define REPLAY_SOURCE_HEADER
+
+#include <fanotify/event_source.h>
+#include <fanotify/event_trace.h>
+
+// c++ includes
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace fn
+{
+
+/**
+ * @brief Replay Source feeds recorded event trace to the detector.
+ *
+ * Time of the stream is virtual - it is the recorded time of the current batch, so detection
+ * decisions are the same whether the trace is replayed at original pacing or as fast as possible.
+ * Recorded pids are mapped to pids that can't exist in the system (see SyntheticSource),
+ * executables are taken from the trace and kills are only recorded as decisions
+ * (the rest of events of the killed pid are dropped, as they would never happen).
+ */
+class ReplaySource final : public EventSource
+{
+    static constexpr int m_fdBase = 1;
+    // in fast mode batch never spans more recorded time than this, so events of the batch have almost the same age
+    static constexpr uint64_t m_maxBatchSpanNs = 1'000'000;
+
+    EventTrace m_trace;
+    bool m_isPaced;
+    std::vector<int32_t> m_originalPids; // indexed by replay pid - FAKE_PID_BASE
+    std::vector<size_t> m_firstEvents; // index of the first event of each replay pid
+    std::vector<size_t> m_eventCounts; // events of each replay pid delivered so far
+    std::vector<bool> m_isKilled;
+    std::vector<fanotify_event_metadata> m_batch;
+    // recorded directory entry events of the current batch, they come from their own group
+    std::vector<DirectoryEvent> m_directoryBatch;
+    size_t m_next;
+    size_t m_dropped; // events of killed pids
+    uint64_t m_nowNs;
+    time_point m_start;
+public:
+    /*
+        Detection decision - recorded pid that detector decided to kill
+    */
+    struct Decision
+    {
+        int32_t pid;
+        std::string executable;
+        // recorded time between the first event of the pid and the kill
+        uint64_t timeToDetectNs;
+        // events of the pid seen before the kill
+        size_t events;
+    };
+private:
+    std::vector<Decision> m_decisions;
+
+    int ReplayPid(int pid) const;
+public:
+    /**
+     * @param trace loaded event trace
+     * @param isPaced replay events with their original timing, otherwise as fast as possible
+     */
+    ReplaySource(EventTrace trace, bool isPaced);
+
+    void Mark(unsigned int flags, uint64_t mask, int dfd, const std::string& pathName) override;
+    bool WaitForEvent() override;
+    EventContainer GetEvents() override;
+    std::vector<DirectoryEvent> GetDirectoryEvents() override;
+    void ResponseAllow(const fanotify_event_metadata& metadata) const override;
+    void ResponseDeny(const fanotify_event_metadata& metadata) const override;
+    std::string GetPath(const fanotify_event_metadata& metadata) override;
+    void Release(const fanotify_event_metadata& metadata) override;
+    time_point Now() override;
+    std::string GetExecutable(int pid) override;
+    void Kill(int pid, int pidfd, const StoppedGroup& group) override;
+    // recorded processes don't exist, they can't be pinned or stopped, only the final verdict (Kill) is recorded
+    bool OpenProcess(int, time_point, int& pidfd) override { pidfd = -1; return true; }
+    bool Freeze(int, int, StoppedGroup& group, const std::vector<std::string>&) override { group = {0, {}}; return true; }
+    void Thaw(int, int, const StoppedGroup&) override {}
+
+    size_t Replayed() const { return m_next; }
+    size_t Dropped() const { return m_dropped; }
+    const std::vector<Decision>& Decisions() const { return m_decisions; }
+};
+
+}
+
+#endif // #define REPLAY_SOURCE_HEADER
@@ -0,0 +1,105 @@
+#ifndef SCORE_MODEL_HEADER
+#define SCORE_MODEL_HEADER
+
+// c++ includes
+#include <array>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace fn
+{
+
+// Features of a pid that score model is evaluated on, rates are events per second in the time window
+enum Feature
+{
+    FEATURE_READS,
+    FEATURE_WRITES,
+    FEATURE_OPENS,
+    FEATURE_CLOSES,
+    FEATURE_CREATES,
+    FEATURE_DELETES,
+    FEATURE_RENAMES,
+    // estimated amount of distinct files the pid has touched since it is tracked
+    FEATURE_UNIQUE_FILES,
+    // share of sampled written files with high entropy (0..1)
+    FEATURE_ENTROPY,
+    // renames that changed extension of the file since the pid is tracked
+    FEATURE_EXTENSION_CHANGES,
+    FEATURE_COUNT
+};
+
+/**
+ * @brief Get feature by its name in config ("reads", "unique_files", ...)
+ *
+ * @return false if there is no such feature
+ */
+bool FeatureByName(const std::string& name, Feature& feature);
+
+/**
+ * @brief Score Model combines features of pids into a score, pid with score >= threshold is suspicious.
+ *
+ * Linear model is a weighted sum of features, it is evaluated feature by feature over columns of all pids,
+ * so the loop is vectorized. Tree model is a small decision tree with scores in leaves.
+ */
+class ScoreModel
+{
+public:
+    /*
+        Node of decision tree: inner node goes to left child if the feature is below threshold, otherwise to right one.
+        Leaf (feature < 0) holds the score
+    */
+    struct Node
+    {
+        int feature;
+        float threshold;
+        size_t left;
+        size_t right;
+        float value;
+    };
+
+    // features of pids by columns, every column has the same amount of pids
+    using Columns = std::array<std::vector<float>, FEATURE_COUNT>;
+private:
+    enum Kind
+    {
+        MODEL_NONE,
+        MODEL_LINEAR,
+        MODEL_TREE,
+    };
+
+    Kind m_kind;
+    std::array<float, FEATURE_COUNT> m_weights;
+    float m_bias;
+    std::vector<Node> m_nodes;
+    float m_threshold;
+
+    float ScoreTree(const Columns& columns, size_t pid) const;
+public:
+    // model that is not set, rules of thresholds are used instead
+    ScoreModel();
+
+    static ScoreModel Linear(const std::array<float, FEATURE_COUNT>& weights, float bias, float threshold);
+
+    /**
+     * @param nodes nodes of the tree, the first one is the root, children must follow their parents
+     * @throw std::runtime_error if the tree is malformed
+     */
+    static ScoreModel Tree(std::vector<Node> nodes, float threshold);
+
+    bool IsEnabled() const { return m_kind != MODEL_NONE; }
+    float Threshold() const { return m_threshold; }
+
+    /**
+     * @brief Score pids
+     *
+     * @param columns features of pids
+     * @param count amount of pids
+     * @param scores scores of pids, it is resized to count
+     */
+    void Score(const Columns& columns, size_t count, std::vector<float>& scores) const;
+};
+
+}
+
+#endif // #define SCORE_MODEL_HEADER
@@ -0,0 +1,151 @@
+#ifndef STAGE_PROFILER_HEADER
+#define STAGE_PROFILER_HEADER
+
+#include <fanotify/latency_histogram.h>
+
+// c++ includes
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fn
+{
+
+// Stages of the main loop of detector
+enum ProfileStage
+{
+    STAGE_WAIT,         // waiting for events
+    STAGE_READ,         // reading events from the source
+    STAGE_CLASSIFY,     // getting path, answering and counting events
+    STAGE_EXPIRY,       // removing outdated events
+    STAGE_SUSPICION,    // checking counters of pids and white list
+    STAGE_KILL,         // killing suspicious pids
+    STAGE_TRACE,        // tracing, recording of events, latency reports
+    STAGE_COUNT
+};
+
+std::string StringizeProfileStage(size_t stage);
+
+/**
+ * @brief Stage Profiler accounts time the main loop spends in every stage.
+ *
+ * Stages can be nested (kill is done in the middle of suspicion check), time is accounted exclusively:
+ * when the inner stage is entered, the outer one is paused. Every switch of stages reads the clock once.
+ * Profiler is used only by the thread of the main loop. When it is disabled, Enter() and Leave() do nothing.
+ */
+class StageProfiler
+{
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t m_maxDepth = 8;
+
+    struct Frame
+    {
+        ProfileStage stage;
+        uint64_t elapsed; // exclusive time of this occurrence so far
+    };
+
+    bool m_isEnabled;
+    std::array<Frame, m_maxDepth> m_frames;
+    size_t m_depth;
+    // stages entered beyond m_maxDepth, their time is charged to the innermost frame
+    size_t m_overflow;
+    clock::time_point m_lastSwitch;
+
+    std::array<uint64_t, STAGE_COUNT> m_totals;
+    // exclusive time of every occurrence of the stage in nanoseconds
+    std::array<LatencyHistogram, STAGE_COUNT> m_histograms;
+    clock::time_point m_start;
+
+    // charge time since the last switch to the current stage
+    void Charge(clock::time_point now)
+    {
+        if (m_depth > 0)
+            m_frames[m_depth - 1].elapsed += std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_lastSwitch).count();
+        m_lastSwitch = now;
+    }
+public:
+    explicit StageProfiler(bool isEnabled) :
+        m_isEnabled(isEnabled),
+        m_frames(),
+        m_depth(0),
+        m_overflow(0),
+        m_lastSwitch(clock::now()),
+        m_totals(),
+        m_histograms(),
+        m_start(m_lastSwitch)
+    {}
+
+    bool IsEnabled() const { return m_isEnabled; }
+
+    void Enter(ProfileStage stage)
+    {
+        if (!m_isEnabled)
+            return ;
+
+        if (m_depth == m_maxDepth)
+        {
+            ++m_overflow;
+            return ;
+        }
+
+        Charge(clock::now());
+        m_frames[m_depth++] = {stage, 0};
+    }
+
+    void Leave()
+    {
+        if (!m_isEnabled)
+            return ;
+
+        // leave pairs with the last enter, which might not have pushed a frame
+        if (m_overflow > 0)
+        {
+            --m_overflow;
+            return ;
+        }
+
+        if (m_depth == 0)
+            return ;
+
+        Charge(clock::now());
+        auto& frame = m_frames[--m_depth];
+        m_totals[frame.stage] += frame.elapsed;
+        m_histograms[frame.stage].Record(frame.elapsed);
+    }
+
+    /**
+     * @brief Format accumulated profile: for every stage amount of occurrences, total time and its share
+     * of the profiled time, mean, p50, p99 and maximum of one occurrence
+     *
+     * @return one line per stage
+     */
+    std::vector<std::string> Dump() const;
+};
+
+/*
+    Stage Scope enters the stage for the lifetime of the object
+*/
+class StageScope
+{
+    StageProfiler& m_profiler;
+public:
+    StageScope(StageProfiler& profiler, ProfileStage stage) : m_profiler(profiler)
+    {
+        m_profiler.Enter(stage);
+    }
+
+    StageScope(const StageScope&) = delete;
+    StageScope& operator=(const StageScope&) = delete;
+
+    ~StageScope()
+    {
+        m_profiler.Leave();
+    }
+};
+
+}
+
+#endif // #define STAGE_PROFILER_HEADER
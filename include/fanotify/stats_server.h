@@ -0,0 +1,76 @@
+#ifndef STATS_SERVER_HEADER
+#define STATS_SERVER_HEADER
+
+#include <fanotify/detector_stats.h>
+
+// c++ includes
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+
+namespace fn
+{
+
+/**
+ * @brief Stats Server serves snapshot of detector counters over Unix domain socket in Prometheus text format.
+ *
+ * Server runs in its own thread with non-blocking sockets and epoll, so slow clients can't stall
+ * the detector. Every request (a line, for example "GET / HTTP/1.0" or just an empty line) is answered
+ * with the current snapshot and the connection is closed. HTTP requests get HTTP response, so the
+ * socket can be scraped by "curl --unix-socket <path> http://localhost/metrics".
+ */
+class StatsServer final
+{
+    using clock = std::chrono::steady_clock;
+
+    static constexpr size_t m_maxClients = 16;
+    static constexpr size_t m_maxRequestSize = 4096;
+
+    struct Client
+    {
+        std::string request;
+        std::string response;
+        size_t written = 0;
+    };
+
+    std::string m_path;
+    std::function<StatsSnapshot()> m_collect;
+    int m_listenFd;
+    int m_epollFd;
+    // written by destructor to stop the thread
+    int m_stopFd;
+    std::map<int, Client> m_clients;
+
+    // previous snapshot to calculate rates between two requests
+    StatsSnapshot m_previous;
+    clock::time_point m_previousTime;
+
+    std::thread m_thread;
+
+    void Run();
+    void Accept();
+    // @return false if the client must be closed
+    bool Read(int fd, Client& client);
+    bool Write(int fd, Client& client);
+    void Close(int fd);
+    std::string Format();
+public:
+    /**
+     * @brief Create socket and start serving
+     *
+     * @param path path of Unix domain socket, existing socket file is replaced
+     * @param collect function that returns current counters, it is called from server thread
+     */
+    StatsServer(const std::string& path, std::function<StatsSnapshot()> collect);
+
+    StatsServer(const StatsServer&) = delete;
+    StatsServer& operator=(const StatsServer&) = delete;
+
+    ~StatsServer();
+};
+
+}
+
+#endif // #define STATS_SERVER_HEADER
@@ -0,0 +1,94 @@
+#ifndef SYNTHETIC_SOURCE_HEADER
+#define SYNTHETIC_SOURCE_HEADER
+
+#include <fanotify/event_source.h>
+
+// c++ includes
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace fn
+{
+
+/*
+    Synthetic Options describe the stream of generated events
+*/
+struct SyntheticOptions
+{
+    // Total amount of events, the source stops after it
+    uint64_t totalEvents = 10'000'000;
+    // Events per second, 0 - as fast as detector takes them
+    uint64_t rate = 0;
+    // Amount of different pids and files in the stream
+    unsigned pids = 1000;
+    unsigned files = 10000;
+    // Events per GetEvents() call
+    size_t batchSize = EVENTS_BUFFER_SIZE;
+    // Share of events (0..1) that comes from the first hotPids pids, the rest is uniform over all pids
+    unsigned hotPids = 10;
+    double hotShare = 0.5;
+    // Event masks and their relative weights
+    std::vector<std::pair<uint64_t, unsigned>> typeWeights = {
+        {FAN_OPEN_PERM, 1},
+        {FAN_ACCESS_PERM, 4},
+        {FAN_MODIFY, 4},
+        {FAN_CLOSE_WRITE, 1},
+    };
+    uint64_t seed = 1;
+};
+
+/**
+ * @brief Synthetic Source generates fanotify_event_metadata-shaped events in memory,
+ * so detection loop can be driven without root and real mount (for benchmarks).
+ *
+ * Generated pids are greater than maximum possible pid of the system (see /proc/sys/kernel/pid_max),
+ * so detector never kills real processes. Event fd is an index of the file in the synthetic file list,
+ * responses and marks do nothing.
+ */
+class SyntheticSource final : public EventSource
+{
+    using clock = std::chrono::steady_clock;
+
+    static constexpr int m_fdBase = 1;
+
+    SyntheticOptions m_options;
+    std::vector<std::string> m_paths;
+    // cumulative weights of event types for sampling
+    std::vector<std::pair<uint64_t, uint64_t>> m_typeBounds;
+    uint64_t m_weightSum;
+    uint64_t m_hotBound; // hot pid is chosen if random value is below this bound
+
+    uint64_t m_state; // xorshift state
+    uint64_t m_generated;
+    uint64_t m_released;
+    clock::time_point m_start;
+    std::vector<fanotify_event_metadata> m_batch;
+
+    uint64_t Next();
+    fanotify_event_metadata Generate();
+public:
+    SyntheticSource(const SyntheticOptions& options);
+
+    void Mark(unsigned int flags, uint64_t mask, int dfd, const std::string& pathName) override;
+    /**
+     * @brief Wait until the next batch is due (if rate is limited)
+     *
+     * @return false when all events are generated
+     */
+    bool WaitForEvent() override;
+    EventContainer GetEvents() override;
+    void ResponseAllow(const fanotify_event_metadata& metadata) const override;
+    void ResponseDeny(const fanotify_event_metadata& metadata) const override;
+    std::string GetPath(const fanotify_event_metadata& metadata) override;
+    void Release(const fanotify_event_metadata& metadata) override;
+
+    uint64_t Generated() const { return m_generated; }
+    uint64_t Released() const { return m_released; }
+};
+
+}
+
+#endif // #define SYNTHETIC_SOURCE_HEADER
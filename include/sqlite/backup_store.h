@@ -0,0 +1,63 @@
+#ifndef BACKUP_STORE_HEADER
+#define BACKUP_STORE_HEADER
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+namespace sqlite
+{
+
+/*
+    Backup Store is a common interface for storages of file snapshots. Snapshots are taken before
+    the file is modified, so it can be restored after encryption. Every snapshot is described
+    by the path of the original file and the pid of the process that triggered it.
+*/
+class BackupStore
+{
+public:
+    virtual bool IsExists(const char* path) = 0;
+    // time the snapshot of the file was taken at (unix time in seconds), its size and pid, false if there is none
+    virtual bool GetSnapshot(const char* path, int64_t& timestamp, int64_t& size, int& pid) = 0;
+    virtual void DeleteFile(const char* path) = 0;
+
+    // take a snapshot of the file by its path
+    virtual void AddFile(const char* path, int pid) = 0;
+    // take a snapshot of the file that is already opened as fd (for example, fanotify event fd),
+    // path is used only as a key, file is not reopened
+    virtual void AddFile(int fd, const char* path, int pid) = 0;
+
+    virtual std::vector<std::string> GetFilesFromPid(int pid) = 0;
+    // get files that were backed up in [from, to] (unix time in seconds)
+    virtual std::vector<std::string> GetFilesFromTime(int64_t from, int64_t to) = 0;
+
+    // write backed up content of the file to the given descriptor (must be empty and writable)
+    virtual void RestoreFile(const char* path, int fd) = 0;
+
+    // total size of backed up files in bytes
+    virtual int64_t GetSize() = 0;
+    // remove backups made before the given unix time
+    virtual void EvictOlderThan(int64_t timestamp) = 0;
+    // remove backups made because of the pid after the given unix time (for example, when it is judged benign),
+    // backups of an older process with the same pid are made before it has started and stay
+    virtual void EvictPid(int pid, int64_t since) = 0;
+    // remove the oldest backups until total size fits into maxSize bytes
+    virtual void EvictToSize(int64_t maxSize) = 0;
+    // return up to given amount of free pages of the database to the filesystem, returns amount of free pages left
+    virtual int Vacuum(int pages) = 0;
+
+    virtual ~BackupStore() {}
+};
+
+/**
+ * @brief Open backup store of the right type
+ *
+ * @param dbPath path to the sqlite database
+ * @param storeDir directory for reflink snapshots, if empty content is stored in the database
+ */
+std::unique_ptr<BackupStore> OpenBackupStore(const std::string& dbPath, const std::string& storeDir);
+
+}
+
+#endif // #define BACKUP_STORE_HEADER
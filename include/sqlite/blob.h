@@ -0,0 +1,77 @@
+#ifndef BLOB_HEADER
+#define BLOB_HEADER
+
+#include "sqlite3.h"
+#include "error_handling.h"
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+#include <unistd.h>
+
+namespace sqlite
+{
+
+/*
+    Blob is a read-only handle for incremental I/O over one blob value (sqlite3_blob_open).
+    Unlike sqlite3_column_blob, the value is never loaded into memory as a whole - it is read
+    page by page, so big files are restored with constant memory usage.
+*/
+class Blob
+{
+    static constexpr size_t m_chunkSize = 64 * 1024;
+    sqlite3_blob* m_blob;
+public:
+    Blob(sqlite3* db, const char* table, const char* column, sqlite3_int64 row) : m_blob(nullptr)
+    {
+        CHECK_SQL(sqlite3_blob_open(db, "main", table, column, row, 0, &m_blob));
+    }
+
+    Blob(const Blob&) = delete;
+    Blob& operator=(const Blob&) = delete;
+
+    size_t Size() const
+    {
+        return sqlite3_blob_bytes(m_blob);
+    }
+
+    // read size bytes starting from offset into buffer
+    void Read(void* buffer, size_t size, size_t offset)
+    {
+        CHECK_SQL(sqlite3_blob_read(m_blob, buffer, size, offset));
+    }
+
+    // stream the whole blob to the file descriptor by chunks
+    void WriteTo(int fd)
+    {
+        std::array<unsigned char, m_chunkSize> buffer;
+        size_t size = Size();
+        for (size_t offset = 0; offset < size; )
+        {
+            size_t chunk = std::min(m_chunkSize, size - offset);
+            Read(buffer.data(), chunk, offset);
+
+            for (size_t written = 0; written < chunk; )
+            {
+                ssize_t writtenBytes = write(fd, buffer.data() + written, chunk - written);
+                if (writtenBytes < 0)
+                    throw std::runtime_error("Can't write blob to the file");
+
+                written += writtenBytes;
+            }
+
+            offset += chunk;
+        }
+    }
+
+    ~Blob()
+    {
+        if (m_blob)
+            sqlite3_blob_close(m_blob);
+    }
+};
+
+}
+
+#endif // #define BLOB_HEADER
@@ -9,12 +9,14 @@
 #include "sqlite3.h"
 #include "error_handling.h"
 #include "statement.h"
+#include "blob.h"
 
 namespace sqlite
 {
 
 class DataBase
 {
+    static constexpr int m_busyTimeoutMs = 5000;
 protected:
     sqlite3* m_db;
 public:
@@ -27,6 +29,9 @@ public:
             throw std::runtime_error(errorString + sqlite3_errmsg(m_db));
         }
 
+        // database might be used by detector and restore tool at the same time
+        sqlite3_busy_timeout(m_db, m_busyTimeoutMs);
+
         // restrict access to this database
         err = chmod(path, 0000);
         if (err < 0)
@@ -46,12 +51,93 @@ public:
         return Statement(stmt);
     }
 
+    // open blob value for incremental reading
+    Blob OpenBlob(const char* table, const char* column, sqlite3_int64 row)
+    {
+        return Blob(m_db, table, column, row);
+    }
+
+    // amount of unused pages in the database file
+    int GetFreePages()
+    {
+        auto stmt = PrepareV2("PRAGMA freelist_count;");
+        return (stmt.Step() == SQLITE_ROW) ? stmt.ColumnInt(0) : 0;
+    }
+
+    // return up to given amount of free pages to the filesystem (database must be in auto_vacuum = INCREMENTAL mode)
+    void IncrementalVacuum(int pages)
+    {
+        // pragmas can't have bound parameters
+        std::string sql = "PRAGMA incremental_vacuum(" + std::to_string(pages) + ");";
+        auto stmt = PrepareV2(sql.c_str());
+        while (stmt.Step() == SQLITE_ROW)
+            continue ;
+    }
+
+    // schema version stored in the database header
+    int GetUserVersion()
+    {
+        auto stmt = PrepareV2("PRAGMA user_version;");
+        return (stmt.Step() == SQLITE_ROW) ? stmt.ColumnInt(0) : 0;
+    }
+
+    bool IsTableExists(const char* table)
+    {
+        auto stmt = PrepareV2("SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = ?;");
+        stmt.Bind(1, table);
+        return (stmt.Step() == SQLITE_ROW);
+    }
+
+    bool IsColumnExists(const char* table, const char* column)
+    {
+        auto stmt = PrepareV2("SELECT 1 FROM pragma_table_info(?) WHERE name = ?;");
+        stmt.Bind(1, table);
+        stmt.Bind(2, column);
+        return (stmt.Step() == SQLITE_ROW);
+    }
+
     ~DataBase()
     {
         sqlite3_close(m_db);
     }
 };
 
+/*
+    Transaction is committed explicitly with Commit() and rolled back if it goes out of scope before that
+    (for example, because of exception). It is built on savepoints, so transactions can be nested.
+*/
+class Transaction
+{
+    DataBase& m_db;
+    bool m_isFinished;
+public:
+    Transaction(DataBase& db) : m_db(db), m_isFinished(false)
+    {
+        m_db.Exec("SAVEPOINT tx;");
+    }
+
+    void Commit()
+    {
+        m_db.Exec("RELEASE tx;");
+        m_isFinished = true;
+    }
+
+    ~Transaction()
+    {
+        if (m_isFinished)
+            return ;
+
+        try
+        {
+            m_db.Exec("ROLLBACK TO tx; RELEASE tx;");
+        }
+        catch (const std::exception&)
+        {
+            // nothing to do in destructor
+        }
+    }
+};
+
 }
 
 #endif // #define FILEDB_HEADER
@@ -18,6 +18,15 @@ do                                                                      \
 }                                                                       \
 while (0);                                                              \
 
+#define CHECK_SQL_DONE(stm)                                             \
+do                                                                      \
+{                                                                       \
+    decltype(stm) __tmp = stm;                                          \
+    if (__tmp != SQLITE_DONE)                                           \
+        throw sqlite::sql_error(__PRETTY_FUNCTION__, __LINE__, __tmp);  \
+}                                                                       \
+while (0);                                                              \
+
 #define CHECK_SQL_MSG(stm, errmsg)                                      \
 do                                                                      \
 {                                                                       \
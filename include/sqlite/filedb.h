@@ -6,36 +6,90 @@
 #include <vector>
 
 #include "database.h"
+#include "backup_store.h"
 
 namespace sqlite
 {
 
-class FileDB : public DataBase
+class FileDB : public DataBase, public BackupStore
 {
-    static constexpr const char* m_initDb = R"(
-        CREATE TABLE IF NOT EXISTS files(
-            path TEXT NOT NULL,
-            content TEXT NOT NULL,
-            pid INTEGER NOT NULL);
+    static constexpr int m_schemaVersion = 1;
+
+    /*
+        Metadata and contents are stored in separate tables, so scans over metadata (by pid, by time, sizes)
+        don't page in contents. Row of 'contents' has the same id as its row of 'files', and it is deleted
+        together with it by trigger. Total size of backups is maintained by triggers too, so it is not
+        computed by scanning the whole table.
+    */
+    static constexpr const char* m_createTables = R"(
+        CREATE TABLE files(
+            id INTEGER PRIMARY KEY,
+            path TEXT NOT NULL UNIQUE,
+            pid INTEGER NOT NULL,
+            timestamp INTEGER NOT NULL,
+            size INTEGER NOT NULL);
+        CREATE TABLE contents(
+            id INTEGER PRIMARY KEY,
+            content BLOB NOT NULL);
+        CREATE TABLE totals(
+            id INTEGER PRIMARY KEY CHECK (id = 0),
+            size INTEGER NOT NULL);
+        INSERT INTO totals VALUES(0, 0);
+        CREATE INDEX files_pid ON files(pid);
+        CREATE INDEX files_timestamp ON files(timestamp);
+        CREATE TRIGGER files_insert AFTER INSERT ON files
+        BEGIN
+            UPDATE totals SET size = size + NEW.size;
+        END;
+        CREATE TRIGGER files_delete AFTER DELETE ON files
+        BEGIN
+            DELETE FROM contents WHERE id = OLD.id;
+            UPDATE totals SET size = size - OLD.size;
+        END;
     )";
 
-    static constexpr const char* m_insertSql = "INSERT INTO files( path, content, pid ) VALUES(?, ?, ?);";
-    static constexpr const char* m_selectFileByPath = "SELECT * FROM files WHERE path = ?;";
-    static constexpr const char* m_ifExists = "SELECT * FROM files WHERE path = ?;";
+    static constexpr const char* m_insertSql = "INSERT INTO files( path, pid, timestamp, size ) VALUES(?, ?, ?, ?);";
+    static constexpr const char* m_insertContentSql = "INSERT INTO contents( id, content ) VALUES(last_insert_rowid(), ?);";
+    static constexpr const char* m_selectFileByPath = "SELECT content FROM contents WHERE id = (SELECT id FROM files WHERE path = ?);";
+    static constexpr const char* m_ifExists = "SELECT 1 FROM files WHERE path = ?;";
+    static constexpr const char* m_selectSnapshot = "SELECT timestamp, size, pid FROM files WHERE path = ?;";
+    static constexpr const char* m_selectIdByPath = "SELECT id FROM files WHERE path = ?;";
     static constexpr const char* m_delete = "DELETE FROM files WHERE path = ?;";
-    static constexpr const char* m_selectFilesByPid = "SELECT * FROM files WHERE pid = ?;";
+    static constexpr const char* m_selectFilesByPid = "SELECT path FROM files WHERE pid = ?;";
+    static constexpr const char* m_selectFilesByTime = "SELECT path FROM files WHERE timestamp BETWEEN ? AND ?;";
+    static constexpr const char* m_selectSize = "SELECT size FROM totals;";
+    static constexpr const char* m_deleteOlder = "DELETE FROM files WHERE timestamp < ?;";
+    static constexpr const char* m_deletePid = "DELETE FROM files WHERE pid = ? AND timestamp > ?;";
+    static constexpr const char* m_selectOldest = "SELECT id, size FROM files ORDER BY timestamp;";
+    static constexpr const char* m_deleteRow = "DELETE FROM files WHERE id = ?;";
+
+    // create tables or migrate them from the previous layout (single table 'files' with content inside)
+    void InitSchema();
+    void Insert(const char* path, std::vector<char>& buffer, int pid);
 public:
     FileDB(const char* path) : DataBase(path)
     {
-        Exec(m_initDb, nullptr, nullptr);
+        InitSchema();
     }
 
-    bool IsExists(const char* path);
-    void DeleteFile(const char* path);
-    void AddFile(const char* path, int pid);
+    bool IsExists(const char* path) override;
+    bool GetSnapshot(const char* path, int64_t& timestamp, int64_t& size, int& pid) override;
+    void DeleteFile(const char* path) override;
+    void AddFile(const char* path, int pid) override;
+    void AddFile(int fd, const char* path, int pid) override;
 
     std::basic_string<unsigned char> GetFileContent(const char* path);
-    std::vector<std::string> GetFilesFromPid(int pid);
+    std::vector<std::string> GetFilesFromPid(int pid) override;
+    std::vector<std::string> GetFilesFromTime(int64_t from, int64_t to) override;
+
+    // content is streamed from the database by chunks, it is never loaded into memory as a whole
+    void RestoreFile(const char* path, int fd) override;
+
+    int64_t GetSize() override;
+    void EvictOlderThan(int64_t timestamp) override;
+    void EvictPid(int pid, int64_t since) override;
+    void EvictToSize(int64_t maxSize) override;
+    int Vacuum(int pages) override;
 };
 
 }
@@ -0,0 +1,116 @@
+#ifndef REFLINK_STORE_HEADER
+#define REFLINK_STORE_HEADER
+
+#include <string>
+#include <vector>
+
+#include "database.h"
+#include "backup_store.h"
+
+namespace sqlite
+{
+
+/*
+    Reflink Store keeps snapshots as separate files in the store directory, while sqlite database
+    keeps only the index of them (original path, pid, timestamp and stored location).
+
+    Snapshot is taken with ioctl(FICLONE), so on copy-on-write filesystems (btrfs, XFS) it shares
+    extents with the original file and takes constant time. If reflinks are not supported,
+    copy_file_range() is used to copy data inside the kernel, and plain read/write is the last resort.
+    Store directory must be on the same filesystem as protected files to benefit from reflinks.
+*/
+class ReflinkStore : public DataBase, public BackupStore
+{
+    static constexpr int m_schemaVersion = 1;
+
+    static constexpr const char* m_createTables = R"(
+        CREATE TABLE IF NOT EXISTS snapshots(
+            path TEXT NOT NULL,
+            location TEXT NOT NULL,
+            pid INTEGER NOT NULL,
+            timestamp INTEGER NOT NULL,
+            size INTEGER NOT NULL);
+        CREATE UNIQUE INDEX IF NOT EXISTS snapshots_path ON snapshots(path);
+        CREATE INDEX IF NOT EXISTS snapshots_pid ON snapshots(pid);
+        CREATE INDEX IF NOT EXISTS snapshots_timestamp ON snapshots(timestamp);
+    )";
+
+    static constexpr const char* m_insertSql = "INSERT INTO snapshots( path, location, pid, timestamp, size ) VALUES(?, ?, ?, ?, ?);";
+    static constexpr const char* m_ifExists = "SELECT 1 FROM snapshots WHERE path = ?;";
+    static constexpr const char* m_selectSnapshot = "SELECT timestamp, size, pid FROM snapshots WHERE path = ?;";
+    static constexpr const char* m_selectLocation = "SELECT location FROM snapshots WHERE path = ?;";
+    static constexpr const char* m_delete = "DELETE FROM snapshots WHERE path = ?;";
+    static constexpr const char* m_selectFilesByPid = "SELECT path FROM snapshots WHERE pid = ?;";
+    static constexpr const char* m_selectFilesByTime = "SELECT path FROM snapshots WHERE timestamp BETWEEN ? AND ?;";
+    static constexpr const char* m_selectSize = "SELECT COALESCE(SUM(size), 0) FROM snapshots;";
+    static constexpr const char* m_selectOlder = "SELECT rowid, location FROM snapshots WHERE timestamp < ?;";
+    static constexpr const char* m_selectPid = "SELECT rowid, location FROM snapshots WHERE pid = ? AND timestamp > ?;";
+    static constexpr const char* m_selectOldest = "SELECT rowid, location, size FROM snapshots ORDER BY timestamp;";
+    static constexpr const char* m_deleteRow = "DELETE FROM snapshots WHERE rowid = ?;";
+    static constexpr const char* m_selectLocations = "SELECT rowid, location FROM snapshots;";
+    static constexpr const char* m_updateSize = "UPDATE snapshots SET size = ? WHERE rowid = ?;";
+
+    std::string m_storeDir;
+    int m_storeDirFd;
+    // suffix to make location of snapshots unique
+    unsigned m_counter;
+
+    // create tables or migrate them from the first layout (snapshots without size, no incremental vacuum)
+    void InitSchema();
+
+    /**
+     * @brief Copy the whole content of srcFd to dstFd using the cheapest available way
+     *
+     * @param srcFd source file descriptor (must be readable)
+     * @param dstFd destination file descriptor (must be writable and empty)
+     */
+    static void CloneFile(int srcFd, int dstFd);
+
+    /**
+     * @brief Create new empty snapshot file in the store directory
+     *
+     * @param location name of the created file relative to the store directory
+     * @return file descriptor of the created file
+     */
+    int CreateSnapshotFile(std::string& location);
+
+    /**
+     * @brief Remove snapshots selected by the query together with their files
+     *
+     * @param select query that returns rowid and location of snapshots to remove
+     */
+    void EvictSelected(Statement& select);
+    void DeleteRows(const std::vector<sqlite3_int64>& rows);
+public:
+    /**
+     * @brief Open (or create) the reflink store
+     *
+     * @param dbPath path to the sqlite database with the index of snapshots
+     * @param storeDir directory for snapshot files, it is created if it doesn't exist
+     */
+    ReflinkStore(const char* dbPath, const char* storeDir);
+
+    bool IsExists(const char* path) override;
+    bool GetSnapshot(const char* path, int64_t& timestamp, int64_t& size, int& pid) override;
+    void DeleteFile(const char* path) override;
+    void AddFile(const char* path, int pid) override;
+    void AddFile(int fd, const char* path, int pid) override;
+
+    std::vector<std::string> GetFilesFromPid(int pid) override;
+    std::vector<std::string> GetFilesFromTime(int64_t from, int64_t to) override;
+
+    // snapshot is cloned back, so restore is as cheap as backup
+    void RestoreFile(const char* path, int fd) override;
+
+    int64_t GetSize() override;
+    void EvictOlderThan(int64_t timestamp) override;
+    void EvictPid(int pid, int64_t since) override;
+    void EvictToSize(int64_t maxSize) override;
+    int Vacuum(int pages) override;
+
+    ~ReflinkStore();
+};
+
+}
+
+#endif // #define REFLINK_STORE_HEADER
@@ -4,9 +4,31 @@
 #include "sqlite3.h"
 #include "error_handling.h"
 
+#include <cstddef>
+#include <string_view>
+
 namespace sqlite
 {
 
+/*
+    Blob View is a non-owning view over bytes of the blob column (like std::span).
+    It is valid only until the next Step() or destruction of the statement.
+*/
+class BlobView
+{
+    const unsigned char* m_data;
+    size_t m_size;
+public:
+    BlobView(const unsigned char* data, size_t size) : m_data(data), m_size(size) {}
+
+    const unsigned char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+
+    const unsigned char* begin() const { return m_data; }
+    const unsigned char* end() const { return m_data + m_size; }
+};
+
 class Statement
 {
     sqlite3_stmt* m_stmt;
@@ -24,6 +46,11 @@ public:
         CHECK_SQL(sqlite3_bind_int(m_stmt, n, data));
     }
 
+    void Bind(int n, sqlite3_int64 data)
+    {
+        CHECK_SQL(sqlite3_bind_int64(m_stmt, n, data));
+    }
+
     // bind blob as container of bytes
     // binds container.data() of container.size() bytes, DOESN'T CHECK FOR SIZE OF UNDERLYING ELEMENT
     template <typename Container>
@@ -43,11 +70,36 @@ public:
         return sqlite3_column_text(m_stmt, i);
     }
 
+    // view over the text column that doesn't stop at zero bytes
+    std::string_view ColumnString(int i)
+    {
+        // sqlite3_column_bytes must be called after sqlite3_column_text, see sqlite docs
+        auto text = (const char*) sqlite3_column_text(m_stmt, i);
+        return std::string_view(text ? text : "", sqlite3_column_bytes(m_stmt, i));
+    }
+
+    // view over the blob column, no data is copied
+    BlobView ColumnBlob(int i)
+    {
+        auto data = (const unsigned char*) sqlite3_column_blob(m_stmt, i);
+        return {data, (size_t) sqlite3_column_bytes(m_stmt, i)};
+    }
+
+    int ColumnBytes(int i)
+    {
+        return sqlite3_column_bytes(m_stmt, i);
+    }
+
     int ColumnInt(int i)
     {
         return sqlite3_column_int(m_stmt, i);
     }
 
+    sqlite3_int64 ColumnInt64(int i)
+    {
+        return sqlite3_column_int64(m_stmt, i);
+    }
+
     ~Statement()
     {
         if (m_stmt)
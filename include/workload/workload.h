@@ -0,0 +1,85 @@
+#ifndef WORKLOAD_HEADER
+#define WORKLOAD_HEADER
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace fn
+{
+
+/*
+    Legitimate file access patterns that are heavy enough to look like an encryptor
+*/
+enum class WorkloadType
+{
+    Compiler,       // many reads of sources and headers, few writes of objects
+    GitCheckout,    // reads from pack, rewrites a lot of small files in the work tree
+    TarExtract,     // sequential read of one archive, many new files
+    DbCheckpoint,   // appends to WAL, then random page writes to the database file and fsync
+    LogRotation,    // many small appends, rename of generations, compression of the rotated log
+};
+
+/*
+    Amount of work done by one run
+*/
+struct WorkloadStats
+{
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t files;
+    uint64_t bytes;
+    double seconds;
+};
+
+/*
+    Benign Workload prepares the data for the workload and runs it in the given directory
+*/
+class BenignWorkload final
+{
+    std::string m_dir;
+    unsigned m_scale;
+    WorkloadStats m_stats;
+
+    void ReadFile(const std::string& path, std::vector<char>& buffer);
+    void WriteFile(const std::string& path, size_t size, std::vector<char>& buffer, int flags = 0);
+
+    void PrepareCompiler();
+    void RunCompiler();
+    void PrepareGitCheckout();
+    void RunGitCheckout();
+    void PrepareTarExtract();
+    void RunTarExtract();
+    void PrepareDbCheckpoint();
+    void RunDbCheckpoint();
+    void PrepareLogRotation();
+    void RunLogRotation();
+public:
+    /*
+        @param dir working directory, it is created if it doesn't exist
+        @param scale multiplier of amount of files and operations
+    */
+    BenignWorkload(const std::string& dir, unsigned scale);
+
+    /*
+        Create files the workload needs, it is not measured
+    */
+    void Prepare(WorkloadType type);
+
+    /*
+        Run the workload
+        @return amount of work and time it took
+    */
+    WorkloadStats Run(WorkloadType type);
+};
+
+std::string StringizeWorkload(WorkloadType type);
+
+/*
+    @return false if there is no such workload
+*/
+bool StringToWorkload(const std::string& str, WorkloadType& type);
+
+}
+
+#endif // #define WORKLOAD_HEADER
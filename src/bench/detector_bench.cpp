@@ -0,0 +1,456 @@
+#include <fanotify/detector.h>
+#include <nlohmann/json.hpp>
+
+// c includes
+#include <fcntl.h>
+#include <unistd.h>
+
+// c++ includes
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+    Microbenchmarks of detector hot paths. Every benchmark is run for the given amount of repetitions,
+    each repetition lasts at least min-time, result is nanoseconds per operation (median and minimum
+    over repetitions). Output is JSON with sorted keys and fixed order of benchmarks, so results of
+    different commits can be diffed directly.
+*/
+
+using json = nlohmann::json;
+using clock_type = std::chrono::steady_clock;
+
+// keep the value alive without affecting the generated code of the benchmark
+template <typename T>
+static inline void DoNotOptimize(const T& value)
+{
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+namespace fn
+{
+
+/*
+    Prepared Source returns the same batch of events on every GetEvents() call
+*/
+class PreparedSource final : public EventSource
+{
+    std::vector<fanotify_event_metadata> m_batch;
+    std::string m_path;
+public:
+    PreparedSource() : m_path("/bench/dir/file") {}
+
+    void SetBatch(std::vector<fanotify_event_metadata> batch) { m_batch = std::move(batch); }
+
+    void Mark(unsigned int, uint64_t, int, const std::string&) override {}
+    bool WaitForEvent() override { return false; }
+    EventContainer GetEvents() override { return EventContainer(m_batch.data(), m_batch.size()); }
+    void ResponseAllow(const fanotify_event_metadata&) const override {}
+    void ResponseDeny(const fanotify_event_metadata&) const override {}
+    std::string GetPath(const fanotify_event_metadata&) override { return m_path; }
+    void Release(const fanotify_event_metadata&) override {}
+};
+
+/*
+    Detector Bench gives access to private stages of the detector loop
+*/
+class DetectorBench
+{
+public:
+    static void ProcessEvents(EncryptorDetector& detector)
+    {
+        detector.ProcessEvents();
+    }
+
+    static void CheckForOutdatedEvents(EncryptorDetector& detector)
+    {
+        detector.CheckForOutdatedEvents();
+    }
+
+    static void CheckForSuspiciousPids(EncryptorDetector& detector)
+    {
+        detector.CheckForSuspiciousPids();
+    }
+
+    static size_t TrackedEvents(EncryptorDetector& detector)
+    {
+        size_t events = 0;
+        for (auto& pair : detector.m_pidEventMap)
+            events += pair.second.eventsQueue.size();
+        return events;
+    }
+
+    // replace tracked state with pids that have the given amount of reads and writes born at the given time
+    static void Fill(EncryptorDetector& detector, unsigned pids, unsigned events, EventSource::time_point birth)
+    {
+        detector.m_pidEventMap.clear();
+        for (unsigned i = 0; i < pids; ++i)
+        {
+            auto& procInfo = detector.m_pidEventMap[FAKE_PID_BASE + i];
+            for (unsigned j = 0; j < events; ++j)
+            {
+                int idx = (j % 2) ? EVENT_WRITE : EVENT_READ;
+                procInfo.eventsCount[idx]++;
+                procInfo.eventsQueue.push({idx, 0, birth});
+            }
+        }
+        MarkAllDirty(detector);
+    }
+
+    // pretend every tracked pid has got an event since the last check
+    static void MarkAllDirty(EncryptorDetector& detector)
+    {
+        detector.m_dirtyPids.clear();
+        for (auto& [pid, procInfo] : detector.m_pidEventMap)
+        {
+            procInfo.isDirty = true;
+            detector.m_dirtyPids.push_back(pid);
+        }
+    }
+
+    // pretend every tracked pid has done the given amount of reads and writes
+    static void SetCounts(EncryptorDetector& detector, size_t reads, size_t writes)
+    {
+        for (auto& pair : detector.m_pidEventMap)
+        {
+            pair.second.eventsCount[EVENT_READ] = reads;
+            pair.second.eventsCount[EVENT_WRITE] = writes;
+        }
+    }
+};
+
+}
+
+using namespace fn;
+
+struct BenchOptions
+{
+    std::vector<unsigned> pids = {16, 1024, 65536};
+    std::vector<unsigned> batches = {1, 32, EVENTS_BUFFER_SIZE};
+    double minTime = 0.2;
+    unsigned repetitions = 5;
+    std::string filter;
+    std::string outPath;
+};
+
+static void PrintUsage()
+{
+    std::cerr << "Usage: ./detector_bench [--pids n,n,...] [--batch n,n,...] [--min-time <s>] [--repetitions <n>]"
+        " [--filter <substring>] [--out <file.json>]" << std::endl;
+}
+
+static std::vector<unsigned> ParseList(const char* value)
+{
+    std::vector<unsigned> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        list.push_back(std::stoul(item));
+    return list;
+}
+
+static bool ParseOptions(int argc, char* argv[], BenchOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+        try
+        {
+            if (option == "--pids")
+                options.pids = ParseList(value);
+            else if (option == "--batch")
+                options.batches = ParseList(value);
+        }
+        catch (const std::logic_error&)
+        {
+            return false; // not a number
+        }
+
+        if (option == "--pids" || option == "--batch")
+            continue ;
+        else if (option == "--min-time")
+            options.minTime = std::strtod(value, nullptr);
+        else if (option == "--repetitions")
+            options.repetitions = std::max(1ul, std::strtoul(value, nullptr, 10));
+        else if (option == "--filter")
+            options.filter = value;
+        else if (option == "--out")
+            options.outPath = value;
+        else
+            return false;
+    }
+
+    // batch can't be bigger than event container
+    for (auto& batch : options.batches)
+        batch = std::clamp<unsigned>(batch, 1, EVENTS_BUFFER_SIZE);
+
+    return true;
+}
+
+class Runner
+{
+    const BenchOptions& m_options;
+    json m_results;
+public:
+    Runner(const BenchOptions& options) : m_options(options), m_results(json::array()) {}
+
+    /**
+     * @brief Run benchmark, only body is timed
+     *
+     * @param name name of the benchmark
+     * @param params parameters of the benchmark
+     * @param opsPerIteration amount of operations one call of body does
+     * @param setup untimed preparation before each call of body
+     * @param body measured code
+     */
+    void Run(const std::string& name, json params, size_t opsPerIteration,
+        const std::function<void()>& setup, const std::function<void()>& body)
+    {
+        if (!m_options.filter.empty() && name.find(m_options.filter) == std::string::npos)
+            return;
+
+        auto minTime = std::chrono::duration<double>(m_options.minTime);
+        std::vector<double> nsPerOp;
+        size_t totalOps = 0;
+        for (unsigned repetition = 0; repetition < m_options.repetitions; ++repetition)
+        {
+            clock_type::duration measured{};
+            size_t ops = 0;
+            auto start = clock_type::now();
+            while (clock_type::now() - start < minTime)
+            {
+                setup();
+                auto iterationStart = clock_type::now();
+                body();
+                measured += clock_type::now() - iterationStart;
+                ops += opsPerIteration;
+            }
+
+            nsPerOp.push_back(std::chrono::duration<double, std::nano>(measured).count() / ops);
+            totalOps += ops;
+        }
+
+        std::sort(nsPerOp.begin(), nsPerOp.end());
+        json result = {
+            {"name", name},
+            {"params", std::move(params)},
+            {"ns_per_op_median", nsPerOp[nsPerOp.size() / 2]},
+            {"ns_per_op_min", nsPerOp.front()},
+            {"ops", totalOps},
+        };
+
+        std::cerr << result.dump() << std::endl;
+        m_results.push_back(std::move(result));
+    }
+
+    json Results() const
+    {
+        return m_results;
+    }
+};
+
+static Config BenchConfig()
+{
+    Config cfg{};
+    cfg.markFlags = {
+        FAN_ACCESS,
+        FAN_ACCESS_PERM,
+        FAN_MODIFY,
+        FAN_OPEN,
+        FAN_OPEN_PERM,
+        FAN_CLOSE,
+        FAN_CLOSE_NOWRITE,
+        FAN_CLOSE_WRITE,
+    };
+    cfg.fileIOSuspect = {.reads = 100, .writes = 100};
+    cfg.fileIOMaxAge = 150;
+    cfg.logPath = "/dev/null";
+    return cfg;
+}
+
+// events of the batch are spread round-robin over pids with the mix of reads, writes, opens and closes
+static std::vector<fanotify_event_metadata> MakeBatch(unsigned pids, unsigned batch)
+{
+    static constexpr uint64_t masks[] = {FAN_ACCESS_PERM, FAN_MODIFY, FAN_OPEN_PERM, FAN_MODIFY, FAN_ACCESS, FAN_CLOSE_WRITE};
+
+    std::vector<fanotify_event_metadata> events(batch);
+    for (unsigned i = 0; i < batch; ++i)
+    {
+        auto& event = events[i];
+        event.event_len = FAN_EVENT_METADATA_LEN;
+        event.vers = FANOTIFY_METADATA_VERSION;
+        event.metadata_len = FAN_EVENT_METADATA_LEN;
+        event.mask = masks[i % std::size(masks)];
+        event.fd = 1; // prepared source never reads it
+        event.pid = FAKE_PID_BASE + (i % pids);
+    }
+    return events;
+}
+
+static void BenchHelpers(Runner& runner)
+{
+    static constexpr size_t masksCount = 1024;
+    static constexpr size_t maskTypes[] = {FAN_ACCESS, FAN_ACCESS_PERM, FAN_MODIFY, FAN_OPEN, FAN_OPEN_PERM,
+        FAN_OPEN_EXEC, FAN_CLOSE, FAN_CLOSE_NOWRITE, FAN_CLOSE_WRITE};
+
+    std::vector<size_t> masks(masksCount);
+    for (size_t i = 0; i < masksCount; ++i)
+        masks[i] = maskTypes[(i * 7) % std::size(maskTypes)];
+
+    runner.Run("FanotifyEventToIdx", json::object(), masksCount, [] {}, [&]
+    {
+        for (auto& mask : masks)
+            DoNotOptimize(FanotifyEventToIdx(mask));
+    });
+
+    char filePath[] = "/tmp/detector_bench.XXXXXX";
+    int fd = mkstemp(filePath);
+    if (fd < 0)
+        throw std::runtime_error("Can't create temporary file");
+
+    runner.Run("GetFilenameByFd", json::object(), 1, [] {}, [&]
+    {
+        DoNotOptimize(GetFilenameByFd(fd));
+    });
+
+    close(fd);
+    unlink(filePath);
+}
+
+static void BenchEventContainer(Runner& runner, const BenchOptions& options)
+{
+    for (auto& batch : options.batches)
+    {
+        auto events = MakeBatch(1, batch);
+        EventContainer container(events.data(), events.size());
+
+        runner.Run("EventContainer/iterate", {{"batch", batch}}, batch, [] {}, [&]
+        {
+            for (auto& event : container)
+                DoNotOptimize(event.pid);
+        });
+    }
+}
+
+static void BenchDetector(Runner& runner, const BenchOptions& options)
+{
+    // tracked events are reset after this amount to keep memory (and cache behaviour) bounded
+    static constexpr size_t maxTrackedEvents = 1 << 20;
+
+    auto source = std::make_unique<PreparedSource>();
+    auto& sourceRef = *source;
+    EncryptorDetector detector(std::move(source), "/", BenchConfig());
+
+    auto now = EventSource::clock::now();
+    auto old = now - std::chrono::hours(1);
+
+    for (auto& pids : options.pids)
+    {
+        for (auto& batch : options.batches)
+        {
+            sourceRef.SetBatch(MakeBatch(pids, batch));
+            DetectorBench::Fill(detector, 0, 0, now);
+            runner.Run("ProcessEvent", {{"pids", pids}, {"batch", batch}}, batch, [&]
+            {
+                if (DetectorBench::TrackedEvents(detector) > maxTrackedEvents)
+                    DetectorBench::Fill(detector, 0, 0, now);
+            }, [&]
+            {
+                DetectorBench::ProcessEvents(detector);
+            });
+        }
+
+        // every loop iteration walks over all tracked pids even if nothing is outdated
+        DetectorBench::Fill(detector, pids, 8, EventSource::clock::now() + std::chrono::hours(1));
+        runner.Run("CheckForOutdatedEvents/scan", {{"pids", pids}}, 1, [] {}, [&]
+        {
+            DetectorBench::CheckForOutdatedEvents(detector);
+        });
+
+        // cost per removed event
+        runner.Run("CheckForOutdatedEvents/expire", {{"pids", pids}}, pids * 8, [&]
+        {
+            DetectorBench::Fill(detector, pids, 8, old);
+        }, [&]
+        {
+            DetectorBench::CheckForOutdatedEvents(detector);
+        });
+
+        // nobody is above thresholds, but every pid has new events
+        DetectorBench::Fill(detector, pids, 8, now);
+        runner.Run("CheckForSuspiciousPids/scan", {{"pids", pids}}, 1, [&]
+        {
+            DetectorBench::MarkAllDirty(detector);
+        }, [&]
+        {
+            DetectorBench::CheckForSuspiciousPids(detector);
+        });
+
+        // everybody is above thresholds, cost per suspicious pid (executable lookup and removal)
+        runner.Run("CheckForSuspiciousPids/suspect", {{"pids", pids}}, pids, [&]
+        {
+            DetectorBench::Fill(detector, pids, 2, now);
+            DetectorBench::SetCounts(detector, 1000, 1000);
+        }, [&]
+        {
+            DetectorBench::CheckForSuspiciousPids(detector);
+        });
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    BenchOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    json output;
+    try
+    {
+        Runner runner(options);
+        BenchHelpers(runner);
+        BenchEventContainer(runner, options);
+        BenchDetector(runner, options);
+
+        output = {
+            {"version", 1},
+            {"min_time_s", options.minTime},
+            {"repetitions", options.repetitions},
+            {"benchmarks", runner.Results()},
+        };
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception from benchmark: " << e.what() << std::endl;
+        return -1;
+    }
+
+    if (options.outPath.empty())
+        std::cout << output.dump(2) << std::endl;
+    else
+    {
+        std::ofstream outStream(options.outPath);
+        outStream << output.dump(2) << std::endl;
+        if (!outStream)
+        {
+            std::cerr << "Can't write results to " << options.outPath << std::endl;
+            return -1;
+        }
+    }
+
+    return 0;
+}
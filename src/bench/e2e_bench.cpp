@@ -0,0 +1,447 @@
+#include <fanotify/detector.h>
+#include <nlohmann/json.hpp>
+
+// c includes
+#include <sys/mount.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+
+// c++ includes
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/*
+    End-to-end benchmark: detector runs in the child process against a tmpfs mount (or the given mount point),
+    encrypt tool is launched over the generated corpus as an attacker. For every pair of thresholds and corpus
+    shape the benchmark reports time to kill, amount of files and bytes encrypted before the kill and detector
+    CPU time and maximum RSS.
+
+    Fanotify permission events need CAP_SYS_ADMIN, so the benchmark must be run as root.
+*/
+
+using namespace fn;
+using json = nlohmann::json;
+using clock_type = std::chrono::steady_clock;
+
+constexpr size_t g_filesPerDir = 100;
+constexpr size_t g_chunkSize = 64 * 1024;
+
+struct Corpus
+{
+    std::string name;
+    size_t files;
+    size_t fileSize;
+};
+
+struct Thresholds
+{
+    unsigned reads;
+    unsigned writes;
+};
+
+struct E2EOptions
+{
+    std::string encryptPath;
+    std::vector<std::string> encryptArgs; // attacker behaviour, see ./encrypt usage
+    std::string mountPath; // empty - create tmpfs mount
+    std::vector<Thresholds> thresholds = {{50, 50}, {100, 100}, {300, 300}};
+    std::vector<Corpus> corpora = {{"small", 2000, 4 * 1024}, {"large", 8, 16 * 1024 * 1024}};
+    int64_t lifetimeMs = 150;
+    std::string outPath;
+};
+
+static void PrintUsage()
+{
+    std::cerr << "Usage: sudo ./e2e_bench [--encrypt <path>] [--encrypt-args \"<options>\"] [--mount <existing mount point>] [--thresholds r:w,r:w,...]"
+        " [--corpus name=<files>x<size>[k|m],...] [--lifetime-ms <ms>] [--out <file.json>]" << std::endl;
+}
+
+static size_t ParseSize(const std::string& str)
+{
+    size_t pos;
+    size_t size = std::stoull(str, &pos);
+    if (pos < str.size())
+    {
+        switch (str[pos])
+        {
+            case 'k': case 'K': return size * 1024;
+            case 'm': case 'M': return size * 1024 * 1024;
+            case 'g': case 'G': return size * 1024 * 1024 * 1024;
+            default: throw std::invalid_argument("unknown size suffix");
+        }
+    }
+    return size;
+}
+
+static std::vector<std::string> Split(const std::string& str, char delimiter)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(str);
+    std::string item;
+    while (std::getline(stream, item, delimiter))
+        items.push_back(item);
+    return items;
+}
+
+static bool ParseOptions(int argc, char* argv[], E2EOptions& options)
+{
+    // encrypt is built next to this binary
+    options.encryptPath = (std::filesystem::path(argv[0]).parent_path() / "encrypt").string();
+
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (i + 1 >= argc)
+                return false;
+
+            std::string value = argv[++i];
+            if (option == "--encrypt")
+                options.encryptPath = value;
+            else if (option == "--encrypt-args")
+            {
+                for (auto& arg : Split(value, ' '))
+                {
+                    if (!arg.empty())
+                        options.encryptArgs.push_back(arg);
+                }
+            }
+            else if (option == "--mount")
+                options.mountPath = value;
+            else if (option == "--lifetime-ms")
+                options.lifetimeMs = std::stoll(value);
+            else if (option == "--out")
+                options.outPath = value;
+            else if (option == "--thresholds")
+            {
+                options.thresholds.clear();
+                for (auto& item : Split(value, ','))
+                {
+                    auto pair = Split(item, ':');
+                    if (pair.size() != 2)
+                        return false;
+                    options.thresholds.push_back({(unsigned) std::stoul(pair[0]), (unsigned) std::stoul(pair[1])});
+                }
+            }
+            else if (option == "--corpus")
+            {
+                options.corpora.clear();
+                for (auto& item : Split(value, ','))
+                {
+                    auto nameShape = Split(item, '=');
+                    auto shape = nameShape.size() == 2 ? Split(nameShape[1], 'x') : std::vector<std::string>{};
+                    if (shape.size() != 2)
+                        return false;
+                    options.corpora.push_back({nameShape[0], std::stoull(shape[0]), ParseSize(shape[1])});
+                }
+            }
+            else
+                return false;
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        return false; // not a number
+    }
+
+    return !options.thresholds.empty() && !options.corpora.empty();
+}
+
+// content of the corpus is a known pattern, so encrypted bytes can be counted afterwards
+static inline unsigned char PatternByte(size_t file, size_t offset)
+{
+    return (file * 31 + offset * 7) & 0xff;
+}
+
+static std::string CorpusFile(const std::string& dir, size_t file)
+{
+    return dir + "/d" + std::to_string(file / g_filesPerDir) + "/f" + std::to_string(file);
+}
+
+static void GenerateCorpus(const std::string& dir, const Corpus& corpus)
+{
+    std::filesystem::remove_all(dir);
+    std::vector<unsigned char> chunk(g_chunkSize);
+    for (size_t file = 0; file < corpus.files; ++file)
+    {
+        if (file % g_filesPerDir == 0)
+            std::filesystem::create_directories(dir + "/d" + std::to_string(file / g_filesPerDir));
+
+        int fd = open(CorpusFile(dir, file).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Can't create corpus file");
+
+        for (size_t offset = 0; offset < corpus.fileSize; offset += chunk.size())
+        {
+            size_t size = std::min(chunk.size(), corpus.fileSize - offset);
+            for (size_t i = 0; i < size; ++i)
+                chunk[i] = PatternByte(file, offset + i);
+
+            if (write(fd, chunk.data(), size) != (ssize_t) size)
+                throw std::runtime_error("Can't write corpus file");
+        }
+        close(fd);
+    }
+}
+
+// count files and bytes that differ from the generated pattern
+static std::pair<size_t, size_t> CountEncrypted(const std::string& dir, const Corpus& corpus)
+{
+    size_t files = 0, bytes = 0;
+    std::vector<unsigned char> chunk(g_chunkSize);
+    for (size_t file = 0; file < corpus.files; ++file)
+    {
+        int fd = open(CorpusFile(dir, file).c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            files++; // removed or renamed by attacker
+            bytes += corpus.fileSize;
+            continue ;
+        }
+
+        size_t changed = 0, offset = 0;
+        ssize_t readBytes;
+        while ((readBytes = read(fd, chunk.data(), chunk.size())) > 0)
+        {
+            for (ssize_t i = 0; i < readBytes; ++i)
+                changed += (chunk[i] != PatternByte(file, offset + i));
+            offset += readBytes;
+        }
+        close(fd);
+
+        if (changed > 0)
+        {
+            files++;
+            bytes += changed;
+        }
+    }
+
+    return {files, bytes};
+}
+
+/*
+    Detector runs in the child process, it reports readiness (all marks are placed) through the pipe
+    and stops when newline is written to its stdin
+*/
+struct DetectorProcess
+{
+    pid_t pid;
+    int stdinFd;
+};
+
+static DetectorProcess StartDetector(const std::string& mount, const Thresholds& thresholds, int64_t lifetimeMs)
+{
+    int stdinPipe[2], readyPipe[2];
+    if (pipe(stdinPipe) < 0 || pipe(readyPipe) < 0)
+        throw std::runtime_error("Can't create pipe");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Can't fork detector");
+
+    if (pid == 0)
+    {
+        dup2(stdinPipe[0], STDIN_FILENO);
+        close(stdinPipe[0]);
+        close(stdinPipe[1]);
+        close(readyPipe[0]);
+
+        char status = 'E';
+        try
+        {
+            Config cfg = GetConfig();
+            cfg.logPath = "/dev/null";
+            cfg.backupPaths.clear();
+            cfg.recordPath.clear();
+            cfg.fileIOSuspect.reads = thresholds.reads;
+            cfg.fileIOSuspect.writes = thresholds.writes;
+            cfg.fileIOMaxAge = lifetimeMs;
+
+            EncryptorDetector detector(mount.c_str(), cfg);
+            status = 'R';
+            if (write(readyPipe[1], &status, 1) != 1)
+                _exit(1);
+
+            detector.Launch();
+            _exit(0);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Caught exception from EncryptorDetector: " << e.what() << std::endl;
+            if (status == 'E')
+                (void) !write(readyPipe[1], &status, 1);
+            _exit(1);
+        }
+    }
+
+    close(stdinPipe[0]);
+    close(readyPipe[1]);
+
+    char status = 0;
+    bool isReady = (read(readyPipe[0], &status, 1) == 1 && status == 'R');
+    close(readyPipe[0]);
+    if (!isReady)
+    {
+        close(stdinPipe[1]);
+        waitpid(pid, nullptr, 0);
+        throw std::runtime_error("Detector failed to start");
+    }
+
+    return {pid, stdinPipe[1]};
+}
+
+static rusage StopDetector(const DetectorProcess& detector)
+{
+    rusage usage{};
+    (void) !write(detector.stdinFd, "\n", 1);
+    close(detector.stdinFd);
+
+    int status;
+    if (wait4(detector.pid, &status, 0, &usage) < 0)
+        throw std::runtime_error("Can't wait for detector");
+
+    return usage;
+}
+
+static json RunOne(const E2EOptions& options, const std::string& mount, const Thresholds& thresholds, const Corpus& corpus)
+{
+    std::string dir = mount + "/e2e_corpus";
+    GenerateCorpus(dir, corpus);
+
+    auto detector = StartDetector(mount, thresholds, options.lifetimeMs);
+
+    auto start = clock_type::now();
+    pid_t attacker = fork();
+    if (attacker < 0)
+        throw std::runtime_error("Can't fork attacker");
+
+    if (attacker == 0)
+    {
+        std::vector<char*> args;
+        args.push_back((char*) options.encryptPath.c_str());
+        for (auto& arg : options.encryptArgs)
+            args.push_back((char*) arg.c_str());
+        args.push_back(dir.data());
+        args.push_back(nullptr);
+
+        // keep the output of benchmark clean
+        int nullFd = open("/dev/null", O_WRONLY);
+        dup2(nullFd, STDOUT_FILENO);
+        execv(options.encryptPath.c_str(), args.data());
+        _exit(127);
+    }
+
+    int status;
+    waitpid(attacker, &status, 0);
+    double attackerMs = std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+    bool isKilled = WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL;
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+        throw std::runtime_error("Can't launch encrypt tool: " + options.encryptPath);
+
+    auto usage = StopDetector(detector);
+    auto [files, bytes] = CountEncrypted(dir, corpus);
+    std::filesystem::remove_all(dir);
+
+    double cpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1e3 +
+        (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e3;
+
+    std::string encryptArgs;
+    for (auto& arg : options.encryptArgs)
+        encryptArgs += (encryptArgs.empty() ? "" : " ") + arg;
+
+    json result = {
+        {"attacker_args", encryptArgs},
+        {"corpus", {{"name", corpus.name}, {"files", corpus.files}, {"file_size", corpus.fileSize}}},
+        {"thresholds", {{"reads", thresholds.reads}, {"writes", thresholds.writes}, {"lifetime_ms", options.lifetimeMs}}},
+        {"killed", isKilled},
+        {"time_to_kill_ms", isKilled ? json(attackerMs) : json(nullptr)},
+        {"attacker_runtime_ms", attackerMs},
+        {"files_touched", files},
+        {"bytes_encrypted", bytes},
+        {"detector_cpu_ms", cpuMs},
+        {"detector_max_rss_kb", usage.ru_maxrss},
+    };
+
+    std::cerr << std::setw(8) << corpus.name << std::setw(6) << thresholds.reads << ":" << std::left << std::setw(6)
+        << thresholds.writes << std::right << std::setw(8) << (isKilled ? "killed" : "missed") << std::fixed
+        << std::setprecision(1) << std::setw(10) << attackerMs << " ms" << std::setw(8) << files << " files"
+        << std::setw(12) << bytes << " bytes" << std::setw(8) << cpuMs << " ms cpu" << std::setw(8)
+        << usage.ru_maxrss << " KiB rss" << std::endl;
+
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    E2EOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    if (geteuid() != 0)
+    {
+        std::cerr << "Fanotify permission events need CAP_SYS_ADMIN, run the benchmark as root" << std::endl;
+        return -1;
+    }
+
+    std::string mount = options.mountPath;
+    bool isMounted = false;
+    json results = json::array();
+    try
+    {
+        if (mount.empty())
+        {
+            char mountTemplate[] = "/tmp/e2e_bench.XXXXXX";
+            if (!mkdtemp(mountTemplate))
+                throw std::runtime_error("Can't create mount point");
+
+            mount = mountTemplate;
+            if (::mount("tmpfs", mount.c_str(), "tmpfs", 0, nullptr) < 0)
+                throw std::runtime_error(std::string("Can't mount tmpfs: ") + strerror(errno));
+            isMounted = true;
+        }
+
+        for (auto& corpus : options.corpora)
+        {
+            for (auto& thresholds : options.thresholds)
+                results.push_back(RunOne(options, mount, thresholds, corpus));
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception from benchmark: " << e.what() << std::endl;
+        results = nullptr;
+    }
+
+    if (isMounted)
+    {
+        umount(mount.c_str());
+        rmdir(mount.c_str());
+    }
+
+    if (results.is_null())
+        return -1;
+
+    json output = {{"version", 1}, {"runs", results}};
+    if (options.outPath.empty())
+        std::cout << output.dump(2) << std::endl;
+    else
+        std::ofstream(options.outPath) << output.dump(2) << std::endl;
+
+    return 0;
+}
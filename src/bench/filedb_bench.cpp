@@ -0,0 +1,123 @@
+#include <sqlite/filedb.h>
+
+// c includes
+#include <fcntl.h>
+#include <unistd.h>
+
+// c++ includes
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/*
+    Benchmark of FileDB queries on databases of different size.
+    Each database is filled with small files (content size doesn't matter for metadata queries),
+    every pid owns g_filesPerPid files. Then each query is run g_queries times with random keys.
+*/
+
+constexpr size_t g_contentSize = 256;
+constexpr size_t g_filesPerPid = 10;
+constexpr size_t g_queries = 1000;
+
+using clock_type = std::chrono::steady_clock;
+
+static std::string FilePath(size_t i)
+{
+    return "/bench/dir" + std::to_string(i % 1000) + "/file" + std::to_string(i);
+}
+
+// Run query g_queries times with random row index and print average time of one query
+static void Measure(const char* name, size_t rows, std::mt19937& rng, const std::function<void(size_t)>& query)
+{
+    std::uniform_int_distribution<size_t> distribution(0, rows - 1);
+
+    auto start = clock_type::now();
+    for (size_t i = 0; i < g_queries; ++i)
+        query(distribution(rng));
+    double us = std::chrono::duration<double, std::micro>(clock_type::now() - start).count();
+
+    std::cout << std::setw(10) << rows << std::setw(20) << name << std::setw(14) << std::fixed
+        << std::setprecision(2) << us / g_queries << " us/op" << std::endl;
+}
+
+static void Bench(size_t rows, int contentFd)
+{
+    std::string dbPath = "/tmp/filedb_bench_" + std::to_string(rows) + ".db";
+    unlink(dbPath.c_str());
+
+    sqlite::FileDB db(dbPath.c_str());
+
+    auto start = clock_type::now();
+    {
+        sqlite::Transaction transaction(db);
+        for (size_t i = 0; i < rows; ++i)
+            db.AddFile(contentFd, FilePath(i).c_str(), i / g_filesPerPid);
+        transaction.Commit();
+    }
+    double fillSeconds = std::chrono::duration<double>(clock_type::now() - start).count();
+    std::cout << std::setw(10) << rows << std::setw(20) << "fill" << std::setw(14) << std::fixed
+        << std::setprecision(2) << fillSeconds << " s" << std::endl;
+
+    std::mt19937 rng(rows);
+    Measure("IsExists", rows, rng, [&](size_t i) { db.IsExists(FilePath(i).c_str()); });
+    Measure("GetFileContent", rows, rng, [&](size_t i) { db.GetFileContent(FilePath(i).c_str()); });
+    Measure("GetFilesFromPid", rows, rng, [&](size_t i) { db.GetFilesFromPid(i / g_filesPerPid); });
+    Measure("GetSize", rows, rng, [&](size_t) { db.GetSize(); });
+    Measure("DeleteFile+AddFile", rows, rng, [&](size_t i)
+    {
+        db.DeleteFile(FilePath(i).c_str());
+        db.AddFile(contentFd, FilePath(i).c_str(), i / g_filesPerPid);
+    });
+
+    unlink(dbPath.c_str());
+}
+
+int main(int argc, char* argv[])
+{
+    std::vector<size_t> rowCounts = {10000, 100000, 1000000};
+    if (argc > 1)
+    {
+        rowCounts.clear();
+        for (int i = 1; i < argc; ++i)
+            rowCounts.push_back(std::strtoull(argv[i], nullptr, 10));
+    }
+
+    // content of every backed up file
+    char contentPath[] = "/tmp/filedb_bench_content.XXXXXX";
+    int contentFd = mkstemp(contentPath);
+    if (contentFd < 0)
+    {
+        std::cerr << "Can't create content file" << std::endl;
+        return -1;
+    }
+    unlink(contentPath);
+
+    std::vector<char> content(g_contentSize, 'x');
+    if (write(contentFd, content.data(), content.size()) != (ssize_t) content.size())
+    {
+        std::cerr << "Can't write content file" << std::endl;
+        return -1;
+    }
+
+    try
+    {
+        for (auto& rows : rowCounts)
+        {
+            if (rows > 0)
+                Bench(rows, contentFd);
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception from FileDB: " << e.what() << std::endl;
+        return -1;
+    }
+
+    close(contentFd);
+    return 0;
+}
@@ -0,0 +1,105 @@
+#include <fanotify/detector.h>
+#include <fanotify/synthetic_source.h>
+
+// c++ includes
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+/*
+    Benchmark of the whole detection loop (outdated events, processing, suspicious pids check)
+    driven by synthetic events, so it doesn't need root and real mount.
+    Synthetic pids don't exist, so suspicious ones are dropped by detector without killing anything.
+*/
+
+using namespace fn;
+
+using clock_type = std::chrono::steady_clock;
+
+static void Usage()
+{
+    std::cerr << "Usage: ./synthetic_bench [--events N] [--rate EVENTS_PER_SEC] [--pids N] [--files N]"
+        " [--hot-pids N] [--hot-share 0..1] [--batch N] [--seed N]" << std::endl;
+}
+
+static Config BenchConfig()
+{
+    Config cfg{};
+    cfg.markFlags = {
+        FAN_ACCESS,
+        FAN_ACCESS_PERM,
+        FAN_MODIFY,
+        FAN_OPEN,
+        FAN_OPEN_PERM,
+        FAN_CLOSE,
+        FAN_CLOSE_NOWRITE,
+        FAN_CLOSE_WRITE,
+    };
+    cfg.fileIOSuspect = {.reads = 100, .writes = 100};
+    cfg.fileIOMaxAge = 150;
+    cfg.logPath = "/dev/null";
+    return cfg;
+}
+
+int main(int argc, char* argv[])
+{
+    SyntheticOptions options;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (i + 1 >= argc)
+        {
+            Usage();
+            return -1;
+        }
+
+        const char* value = argv[++i];
+        if (!std::strcmp(argv[i - 1], "--events"))
+            options.totalEvents = std::strtoull(value, nullptr, 10);
+        else if (!std::strcmp(argv[i - 1], "--rate"))
+            options.rate = std::strtoull(value, nullptr, 10);
+        else if (!std::strcmp(argv[i - 1], "--pids"))
+            options.pids = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(argv[i - 1], "--files"))
+            options.files = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(argv[i - 1], "--hot-pids"))
+            options.hotPids = std::strtoul(value, nullptr, 10);
+        else if (!std::strcmp(argv[i - 1], "--hot-share"))
+            options.hotShare = std::strtod(value, nullptr);
+        else if (!std::strcmp(argv[i - 1], "--batch"))
+            options.batchSize = std::strtoull(value, nullptr, 10);
+        else if (!std::strcmp(argv[i - 1], "--seed"))
+            options.seed = std::strtoull(value, nullptr, 10);
+        else
+        {
+            Usage();
+            return -1;
+        }
+    }
+
+    try
+    {
+        auto source = std::make_unique<SyntheticSource>(options);
+        auto& sourceRef = *source;
+        EncryptorDetector detector(std::move(source), "/", BenchConfig());
+
+        auto start = clock_type::now();
+        detector.Launch();
+        double seconds = std::chrono::duration<double>(clock_type::now() - start).count();
+
+        std::cout << "events:    " << sourceRef.Generated() << std::endl;
+        std::cout << "released:  " << sourceRef.Released() << std::endl;
+        std::cout << "time:      " << std::fixed << std::setprecision(3) << seconds << " s" << std::endl;
+        std::cout << "rate:      " << std::fixed << std::setprecision(0)
+            << sourceRef.Generated() / seconds << " events/s" << std::endl;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception from EncryptorDetector: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
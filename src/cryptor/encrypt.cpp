@@ -3,62 +3,210 @@
 // c includes
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <unistd.h>
 
 // c++ includes
-#include <array>
-#include <vector>
+#include <algorithm>
 #include <filesystem>
 #include <stdexcept>
+#include <thread>
 
 using namespace fn;
 
-void Encryptor::EncryptFile(const std::string& fileName)
+constexpr const char* g_encryptedSuffix = ".encrypted";
+
+Encryptor::Encryptor(uint32_t key, const EncryptOptions& options) :
+    m_key(key),
+    m_options(options),
+    m_files(0),
+    m_failedFiles(0),
+    m_bytes(0),
+    m_start(clock::now())
 {
-    /*
-        Write & read operations on the same file are quite tricky in C++. WE write this program for linux, so
-        to carefully encrypt file, use low-level C operations instead of file streams in C++
-    */
-    std::array<char, m_blockSize> buffer;
+    if (m_options.blockSize == 0)
+        throw std::runtime_error("Block size must be positive");
 
-    int inputFd = open(fileName.c_str(), O_RDONLY);
-    if (inputFd < 0)
-        throw std::runtime_error("Can't open requested file");
-    
-    int outputFd = open(fileName.c_str(), O_WRONLY);
-    if (outputFd < 0)
-        throw std::runtime_error("Can't open requested file");
+    if (m_options.threads == 0)
+        m_options.threads = 1;
+}
+
+void Encryptor::Throttle(uint64_t bytes)
+{
+    uint64_t totalBytes = (m_bytes += bytes);
+    if (m_options.rate <= 0)
+        return;
+
+    // all threads share one budget: totalBytes must not be encrypted earlier than totalBytes / rate
+    std::this_thread::sleep_until(m_start + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(totalBytes / m_options.rate)));
+}
+
+// write the whole buffer
+static void WriteAll(int fd, const char* data, size_t size)
+{
+    for (size_t written = 0; written < size; )
+    {
+        ssize_t writtenBytes = write(fd, data + written, size - written);
+        if (writtenBytes < 0)
+            throw std::runtime_error("Error while encrypting - can't write to the file");
+        written += writtenBytes;
+    }
+}
+
+uint64_t Encryptor::EncryptStream(int inputFd, int outputFd, std::vector<char>& buffer, bool copyTail)
+{
+    uint64_t limit = m_options.partialBytes ? m_options.partialBytes : UINT64_MAX;
+    uint64_t encrypted = 0;
 
     // read by block
     ssize_t readBytes = 0;
-    while ((readBytes = read(inputFd, buffer.data(), m_blockSize)) > 0)
+    while (encrypted < limit &&
+        (readBytes = read(inputFd, buffer.data(), std::min<uint64_t>(buffer.size(), limit - encrypted))) > 0)
     {
         // encrypt
         for (ssize_t i = 0; i < readBytes; ++i)
             buffer[i] ^= m_key;
-        
-        ssize_t writtenBytes = write(outputFd, buffer.data(), readBytes);
-        if (writtenBytes < 0)
-            throw std::runtime_error("Error while encrypting - can't write to the file");
+
+        WriteAll(outputFd, buffer.data(), readBytes);
+        encrypted += readBytes;
+        Throttle(readBytes);
     }
 
+    while (copyTail && readBytes > 0 && (readBytes = read(inputFd, buffer.data(), buffer.size())) > 0)
+        WriteAll(outputFd, buffer.data(), readBytes);
+
     if (readBytes < 0)
         throw std::runtime_error("Error while encrypting - can't read from the file");
 
-    close(inputFd);
-    close(outputFd);
+    return encrypted;
 }
 
-void Encryptor::EncryptDirectory(const std::string& dirName)
+uint64_t Encryptor::EncryptMapped(const std::string& fileName)
+{
+    int fd = open(fileName.c_str(), O_RDWR);
+    if (fd < 0)
+        throw std::runtime_error("Can't open requested file");
+
+    struct stat st = {};
+    if (fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = st.st_size;
+    if (m_options.partialBytes)
+        size = std::min(size, m_options.partialBytes);
+
+    auto data = (char*) mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        throw std::runtime_error("Can't map requested file");
+
+    // encrypt by blocks, so throttling works the same way as with read/write
+    for (size_t offset = 0; offset < size; offset += m_options.blockSize)
+    {
+        size_t blockSize = std::min(m_options.blockSize, size - offset);
+        for (size_t i = offset; i < offset + blockSize; ++i)
+            data[i] ^= m_key;
+
+        Throttle(blockSize);
+    }
+
+    msync(data, size, MS_SYNC);
+    munmap(data, size);
+    return size;
+}
+
+void Encryptor::EncryptFile(const std::string& fileName, std::vector<char>& buffer)
+{
+    /*
+        Write & read operations on the same file are quite tricky in C++. WE write this program for linux, so
+        to carefully encrypt file, use low-level C operations instead of file streams in C++
+    */
+    std::string encryptedName = fileName + g_encryptedSuffix;
+    switch (m_options.mode)
+    {
+        case EncryptMode::InPlace:
+        case EncryptMode::Rename:
+        {
+            int inputFd = open(fileName.c_str(), O_RDONLY);
+            if (inputFd < 0)
+                throw std::runtime_error("Can't open requested file");
+
+            int outputFd = open(fileName.c_str(), O_WRONLY);
+            if (outputFd < 0)
+            {
+                close(inputFd);
+                throw std::runtime_error("Can't open requested file");
+            }
+
+            try
+            {
+                EncryptStream(inputFd, outputFd, buffer, false);
+            }
+            catch (const std::runtime_error&)
+            {
+                close(inputFd);
+                close(outputFd);
+                throw;
+            }
+
+            close(inputFd);
+            close(outputFd);
+
+            if (m_options.mode == EncryptMode::Rename && rename(fileName.c_str(), encryptedName.c_str()) < 0)
+                throw std::runtime_error("Can't rename encrypted file");
+            break;
+        }
+        case EncryptMode::NewFile:
+        {
+            int inputFd = open(fileName.c_str(), O_RDONLY);
+            if (inputFd < 0)
+                throw std::runtime_error("Can't open requested file");
+
+            int outputFd = open(encryptedName.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (outputFd < 0)
+            {
+                close(inputFd);
+                throw std::runtime_error("Can't create encrypted file");
+            }
+
+            try
+            {
+                EncryptStream(inputFd, outputFd, buffer, true);
+            }
+            catch (const std::runtime_error&)
+            {
+                close(inputFd);
+                close(outputFd);
+                throw;
+            }
+
+            close(inputFd);
+            close(outputFd);
+
+            if (unlink(fileName.c_str()) < 0)
+                throw std::runtime_error("Can't remove original file");
+            break;
+        }
+        case EncryptMode::Mmap:
+            EncryptMapped(fileName);
+            break;
+    }
+}
+
+void Encryptor::CollectFiles(const std::string& dirName, std::vector<std::string>& files)
 {
     using directory_iterator = std::filesystem::directory_iterator;
     for (auto& directoryEntry : directory_iterator(dirName))
     {
         if (directoryEntry.is_directory())
-            EncryptDirectory(directoryEntry.path());
+            CollectFiles(directoryEntry.path(), files);
         else if (directoryEntry.is_regular_file())
-            EncryptFile(directoryEntry.path());
+            files.push_back(directoryEntry.path());
     }
 }
 
@@ -72,13 +220,14 @@ void Encryptor::Encrypt(const std::string& name)
         throw std::runtime_error(errorText);
     }
 
+    std::vector<std::string> files;
     if (std::filesystem::is_directory(name))
     {
-        EncryptDirectory(name);
-    }    
+        CollectFiles(name, files);
+    }
     else if (std::filesystem::is_regular_file(name))
     {
-        EncryptFile(name);
+        files.push_back(name);
     }
     else
     {
@@ -86,4 +235,47 @@ void Encryptor::Encrypt(const std::string& name)
         errorText += name;
         throw std::runtime_error(errorText);
     }
+
+    m_files = 0;
+    m_failedFiles = 0;
+    m_bytes = 0;
+    m_start = clock::now();
+
+    // every thread takes the next file from the common list
+    std::atomic<size_t> nextFile = 0;
+    auto worker = [&]()
+    {
+        std::vector<char> buffer(m_options.blockSize);
+        for (size_t i = nextFile++; i < files.size(); i = nextFile++)
+        {
+            try
+            {
+                EncryptFile(files[i], buffer);
+                m_files++;
+            }
+            catch (const std::runtime_error&)
+            {
+                // file might be removed or locked, go on with others
+                m_failedFiles++;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < m_options.threads; ++i)
+        threads.emplace_back(worker);
+
+    worker();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+EncryptStats Encryptor::Stats() const
+{
+    return {
+        .files = m_files,
+        .failedFiles = m_failedFiles,
+        .bytes = m_bytes,
+        .seconds = std::chrono::duration<double>(clock::now() - m_start).count(),
+    };
 }
@@ -1,21 +1,115 @@
 #include <cryptor/encrypt.h>
 
+#include <iomanip>
 #include <iostream>
 #include <sstream>
 #include <string_view>
 
 constexpr uint32_t g_encryptKey = 0xdeadbeef;
 
+static void PrintUsage()
+{
+    std::cerr << "Usage: ./encrypt [--mode inplace|rename|newfile|mmap] [--threads <n>] [--block-size <size>]"
+        " [--partial <size>] [--rate <MB/s>] <path>" << std::endl;
+    std::cerr << "Sizes can have k or m suffix" << std::endl;
+}
+
+static size_t ParseSize(const std::string& str)
+{
+    size_t pos;
+    size_t size = std::stoull(str, &pos);
+    if (pos < str.size())
+    {
+        switch (str[pos])
+        {
+            case 'k': case 'K': return size * 1024;
+            case 'm': case 'M': return size * 1024 * 1024;
+            default: throw std::invalid_argument("unknown size suffix");
+        }
+    }
+    return size;
+}
+
+static bool ParseMode(std::string_view str, fn::EncryptMode& mode)
+{
+    if (str == "inplace")
+        mode = fn::EncryptMode::InPlace;
+    else if (str == "rename")
+        mode = fn::EncryptMode::Rename;
+    else if (str == "newfile")
+        mode = fn::EncryptMode::NewFile;
+    else if (str == "mmap")
+        mode = fn::EncryptMode::Mmap;
+    else
+        return false;
+
+    return true;
+}
+
+static bool ParseOptions(int argc, char* argv[], fn::EncryptOptions& options, std::string& path)
+{
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (i == argc - 1)
+            {
+                path = option;
+                break;
+            }
+
+            std::string value = argv[++i];
+            if (option == "--mode")
+            {
+                if (!ParseMode(value, options.mode))
+                    return false;
+            }
+            else if (option == "--threads")
+                options.threads = std::stoul(value);
+            else if (option == "--block-size")
+                options.blockSize = ParseSize(value);
+            else if (option == "--partial")
+                options.partialBytes = ParseSize(value);
+            else if (option == "--rate")
+                options.rate = std::stod(value) * 1024 * 1024;
+            else
+                return false;
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        return false; // not a number
+    }
+
+    return !path.empty() && options.blockSize > 0;
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    fn::EncryptOptions options;
+    std::string path;
+    if (!ParseOptions(argc, argv, options, path))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    try
+    {
+        fn::Encryptor encryptor(g_encryptKey, options);
+        encryptor.Encrypt(path);
+
+        auto stats = encryptor.Stats();
+        std::cout << "encrypted " << stats.files << " files (" << stats.failedFiles << " failed), "
+            << stats.bytes << " bytes in " << std::fixed << std::setprecision(3) << stats.seconds << " s, "
+            << std::setprecision(2) << stats.bytes / (1024.0 * 1024.0) / stats.seconds << " MB/s" << std::endl;
+    }
+    catch (const std::exception& e)
     {
-        std::cerr << "Usage: ./encryptor <path>" << std::endl;
+        std::cerr << "Caught exception from Encryptor: " << e.what() << std::endl;
         return -1;
     }
 
-    fn::Encryptor encryptor(g_encryptKey);
-    encryptor.Encrypt(argv[1]);
-    
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,274 @@
+#include <fanotify/backup_worker.h>
+
+// c includes
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/ioprio.h>
+#include <unistd.h>
+
+// c++ includes
+#include <algorithm>
+#include <cstdint>
+#include <ctime>
+
+using namespace fn;
+
+BackupWorker::BackupWorker(const Config& cfg, EventSource& source) :
+    m_source(source),
+    m_store(sqlite::OpenBackupStore(cfg.backupDbPath, cfg.backupDir)),
+    m_backupPaths(cfg.backupPaths),
+    m_maintenanceStore(sqlite::OpenBackupStore(cfg.backupDbPath, cfg.backupDir)),
+    m_maxSize(cfg.backupMaxSize),
+    m_maxAge(cfg.backupMaxAge),
+    m_tasks(),
+    m_queuedBytes(0),
+    m_benignPids(),
+    m_suspects(),
+    m_mutex(),
+    m_condition(),
+    m_maintenanceCondition(),
+    m_stop(false),
+    m_thread(&BackupWorker::Run, this),
+    m_maintenanceThread(&BackupWorker::Maintain, this)
+{}
+
+// Make the calling thread use CPU and disk only when nobody else needs them
+static void LowerThreadPriority()
+{
+    // on linux nice value is per thread
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+    // 0 means the calling thread
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0));
+}
+
+bool BackupWorker::IsProtected(const std::string& path) const
+{
+    for (auto& prefix : m_backupPaths)
+    {
+        if (path.compare(0, prefix.size(), prefix) != 0)
+            continue ;
+
+        // "/home" protects "/home/user", but not "/homework"
+        if (path.size() == prefix.size() || prefix.back() == '/' || path[prefix.size()] == '/')
+            return true;
+    }
+
+    return false;
+}
+
+void BackupWorker::Submit(const fanotify_event_metadata& event, std::string path, EventSource::time_point received)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_queuedBytes += sizeof(Task) + path.size();
+        m_tasks.push({event, std::move(path), received});
+    }
+
+    m_condition.notify_one();
+}
+
+void BackupWorker::MarkBenign(int pid, int64_t started)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    // white-listed pid is met on every check, it is evicted once per maintenance
+    for (auto& benign : m_benignPids)
+    {
+        if (benign.pid == pid && benign.started == started)
+            return ;
+    }
+
+    m_benignPids.push_back({pid, started});
+}
+
+void BackupWorker::MarkSuspect(int pid, int64_t started)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& suspect : m_suspects)
+    {
+        if (suspect.process.pid == pid && suspect.killed == 0)
+            return ; // frozen already
+    }
+
+    if (m_suspects.size() >= m_maxSuspects)
+    {
+        // frozen suspects are bounded by the detector, killed ones are forgotten from the oldest
+        auto oldest = std::min_element(m_suspects.begin(), m_suspects.end(), [](auto& left, auto& right)
+        {
+            return (left.killed != 0 ? left.killed : INT64_MAX) < (right.killed != 0 ? right.killed : INT64_MAX);
+        });
+        if (oldest != m_suspects.end() && oldest->killed != 0)
+            m_suspects.erase(oldest);
+    }
+
+    m_suspects.push_back({{pid, started}, 0});
+}
+
+void BackupWorker::ReleaseSuspect(int pid, bool isKilled)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto it = m_suspects.begin(); it != m_suspects.end(); ++it)
+    {
+        if (it->process.pid != pid || it->killed != 0)
+            continue ;
+
+        if (isKilled)
+            it->killed = time(nullptr);
+        else
+            m_suspects.erase(it);
+        return ;
+    }
+}
+
+void BackupWorker::Maintain()
+{
+    LowerThreadPriority();
+
+    while (MaintenanceSleep(m_maintenancePeriod))
+    {
+        std::vector<ProcessId> benignPids;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            benignPids.swap(m_benignPids);
+
+            // snapshots of killed suspects are evicted by age, there is nothing left to protect
+            if (m_maxAge > 0)
+            {
+                auto expired = time(nullptr) - m_maxAge;
+                m_suspects.erase(std::remove_if(m_suspects.begin(), m_suspects.end(), [expired](auto& suspect)
+                {
+                    return suspect.killed != 0 && suspect.killed < expired;
+                }), m_suspects.end());
+            }
+        }
+
+        try
+        {
+            for (auto& benign : benignPids)
+                m_maintenanceStore->EvictPid(benign.pid, benign.started);
+
+            if (m_maxAge > 0)
+                m_maintenanceStore->EvictOlderThan(time(nullptr) - m_maxAge);
+
+            if (m_maxSize > 0)
+                m_maintenanceStore->EvictToSize(m_maxSize);
+
+            // vacuum by small steps with pauses not to occupy disk
+            while (m_maintenanceStore->Vacuum(m_vacuumPages) > 0)
+            {
+                if (!MaintenanceSleep(m_vacuumPause))
+                    return ;
+            }
+        }
+        catch (const std::exception&)
+        {
+            // try again on the next iteration
+        }
+    }
+}
+
+void BackupWorker::Backup(const Task& task)
+{
+    // only regular files are backed up (directories generate open events too)
+    struct stat st = {};
+    if (fstat(task.event.fd, &st) < 0 || !S_ISREG(st.st_mode))
+        return ;
+
+    try
+    {
+        // the latest version of the file is kept, unless it could have been modified by an encryptor since
+        if (IsSnapshotOutdated(task.path, st))
+        {
+            m_store->AddFile(task.event.fd, task.path.c_str(), task.event.pid);
+            m_backupFiles.Add();
+            m_backupBytes.Add(st.st_size);
+        }
+    }
+    catch (const std::exception&)
+    {
+        // backup is the best effort, the event must be allowed anyway
+    }
+}
+
+bool BackupWorker::IsSnapshotOutdated(const std::string& path, const struct stat& st)
+{
+    int64_t timestamp = 0;
+    int64_t size = 0;
+    int pid = 0;
+    if (!m_store->GetSnapshot(path.c_str(), timestamp, size, pid))
+        return true;
+
+    // modification in the same second as the snapshot might be after it
+    if (st.st_mtime < timestamp && st.st_size == size)
+        return false;
+
+    if (time(nullptr) - timestamp < m_refreshAge)
+        return false;
+
+    // snapshot of a suspect is taken between its start and its kill, a pid reused later isn't protected
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return std::none_of(m_suspects.begin(), m_suspects.end(), [pid, timestamp](auto& suspect)
+    {
+        return suspect.process.pid == pid && timestamp >= suspect.process.started &&
+            (suspect.killed == 0 || timestamp <= suspect.killed);
+    });
+}
+
+void BackupWorker::AddStats(StatsSnapshot& stats) const
+{
+    stats.backupFiles += m_backupFiles.Get();
+    stats.backupBytes += m_backupBytes.Get();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    stats.backupQueueBytes += m_queuedBytes;
+}
+
+void BackupWorker::Run()
+{
+    while (true)
+    {
+        Task task;
+        bool isStopped = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]{ return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return ;
+
+            task = std::move(m_tasks.front());
+            m_tasks.pop();
+            m_queuedBytes -= sizeof(Task) + task.path.size();
+            isStopped = m_stop;
+        }
+
+        // on shutdown pending events are just allowed
+        if (!isStopped)
+            Backup(task);
+
+        try
+        {
+            m_source.ResponseAllow(task.event);
+            m_latency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                EventSource::clock::now() - task.received).count());
+        }
+        catch (const std::exception&)
+        {
+            // process might be already dead, nothing to answer
+        }
+
+        m_source.Release(task.event);
+    }
+}
+
+BackupWorker::~BackupWorker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_condition.notify_one();
+    m_maintenanceCondition.notify_one();
+    m_thread.join();
+    m_maintenanceThread.join();
+}
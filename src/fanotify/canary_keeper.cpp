@@ -0,0 +1,176 @@
+#include <fanotify/canary_keeper.h>
+
+// c includes
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// c++ includes
+#include <cerrno>
+#include <cstring>
+
+namespace fn
+{
+
+// decoy document, it is large enough for encryptors that skip small files
+static const std::string& CanaryContent()
+{
+    static const std::string content = []
+    {
+        std::string text = "Quarterly report\n\n";
+        for (int i = 0; text.size() < 16 * 1024; ++i)
+            text += "Account " + std::to_string(100000 + i * 7919 % 900000) + ": balance reconciled, see attachment.\n";
+        return text;
+    }();
+    return content;
+}
+
+static int64_t MtimeNs(const struct stat& st)
+{
+    return static_cast<int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+}
+
+// file of the previous run has the same content, it can be taken over
+static bool IsCanaryContent(int fd, const struct stat& st)
+{
+    auto& content = CanaryContent();
+    if (!S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) != content.size())
+        return false;
+
+    char head[64];
+    return pread(fd, head, sizeof(head), 0) == sizeof(head) && memcmp(head, content.data(), sizeof(head)) == 0;
+}
+
+CanaryKeeper::CanaryKeeper(const std::vector<std::string>& dirs, const std::vector<std::string>& names,
+    std::chrono::seconds refreshPeriod) :
+    m_paths(),
+    m_refreshPeriod(refreshPeriod),
+    m_canaries(),
+    m_ids(),
+    m_publishedPaths(),
+    m_generation(0),
+    m_mutex(),
+    m_condition(),
+    m_stop(false),
+    m_thread()
+{
+    for (auto& dir : dirs)
+    {
+        for (auto& name : names)
+            m_paths.push_back(dir + (!dir.empty() && dir.back() == '/' ? "" : "/") + name);
+    }
+
+    // canaries are in place before the first event
+    Refresh();
+    m_thread = std::thread(&CanaryKeeper::Run, this);
+}
+
+bool CanaryKeeper::Place(const std::string& path, Canary& canary)
+{
+    auto& content = CanaryContent();
+    // links are not followed, otherwise anybody could make the detector overwrite any file
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+    bool isCreated = fd >= 0;
+    if (fd < 0 && errno == EEXIST)
+        fd = open(path.c_str(), O_RDWR | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+
+    struct stat st = {};
+    bool isPlaced = fstat(fd, &st) == 0;
+    // existing file is ours if it is the canary that has been modified or it is a canary of the previous run
+    bool isOwn = isPlaced && (isCreated || canary.id == FileId{st.st_dev, st.st_ino} || IsCanaryContent(fd, st));
+    if (isOwn && (isCreated || MtimeNs(st) != canary.mtimeNs))
+    {
+        isPlaced = ftruncate(fd, 0) == 0 &&
+            pwrite(fd, content.data(), content.size(), 0) == static_cast<ssize_t>(content.size()) && fstat(fd, &st) == 0;
+    }
+    close(fd);
+
+    if (!isOwn || !isPlaced)
+        return false;
+
+    canary = {{st.st_dev, st.st_ino}, MtimeNs(st)};
+    return true;
+}
+
+bool CanaryKeeper::Refresh()
+{
+    bool isChanged = false;
+    for (auto& path : m_paths)
+    {
+        auto it = m_canaries.find(path);
+        struct stat st = {};
+        // canary is in place and nobody has touched it
+        if (it != m_canaries.end() && lstat(path.c_str(), &st) == 0 &&
+            it->second.id == FileId{st.st_dev, st.st_ino} && MtimeNs(st) == it->second.mtimeNs)
+            continue ;
+
+        Canary canary = it != m_canaries.end() ? it->second : Canary{};
+        if (Place(path, canary))
+        {
+            m_canaries[path] = canary;
+            isChanged = true;
+        }
+        else if (it != m_canaries.end())
+        {
+            m_canaries.erase(it);
+            isChanged = true;
+        }
+    }
+
+    if (!isChanged)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_ids.clear();
+    m_publishedPaths.clear();
+    for (auto& [path, canary] : m_canaries)
+    {
+        m_ids.insert(canary.id);
+        m_publishedPaths.insert(path);
+    }
+    m_generation++;
+    return true;
+}
+
+bool CanaryKeeper::Update(std::unordered_set<FileId, FileIdHash>& ids, std::unordered_set<std::string>& paths,
+    uint64_t& generation)
+{
+    if (m_generation.load() == generation)
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    ids = m_ids;
+    paths = m_publishedPaths;
+    generation = m_generation.load();
+    return true;
+}
+
+void CanaryKeeper::Run()
+{
+    while (true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_condition.wait_for(lock, m_refreshPeriod, [this]{ return m_stop; }))
+                return ;
+        }
+
+        Refresh();
+    }
+}
+
+CanaryKeeper::~CanaryKeeper()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_condition.notify_all();
+    if (m_thread.joinable())
+        m_thread.join();
+}
+
+}
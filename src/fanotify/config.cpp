@@ -5,6 +5,15 @@
 using json = nlohmann::json;
 
 constexpr const char* g_configPath = "/etc/synthmoza/fanotify_config.json";
+constexpr const char* g_backupDbPath = "/etc/synthmoza/fanotify_backup.db";
+constexpr int64_t g_pidStateMaxSize = 64 * 1024 * 1024;
+// name of canary file, it looks like a document and goes first in sorted listings
+constexpr const char* g_canaryName = "0000_budget.docx";
+#ifndef DAEMON_FANOTIFY
+constexpr const char* g_statsSocketPath = "";
+#else
+constexpr const char* g_statsSocketPath = "/run/fanotify_daemon.sock";
+#endif
 
 namespace fn
 {
@@ -26,20 +35,341 @@ static Config GetDefaultConfig()
             FAN_CLOSE_NOWRITE,
             FAN_CLOSE_WRITE,
         },
+        .directoryMarkFlags = {},
         .fileIOSuspect = {
             .reads = 100,
             .writes = 100,
         },
+        .replaceSuspect = 0,
         .fileIOMaxAge = 150,
     #ifndef DAEMON_FANOTIFY
         .logPath = "/etc/synthmoza/fanotify_trace.log",
     #else
         .logPath = "/var/log/syslog",
     #endif
-        .whiteList = {}
+        .whiteList = {},
+        .backupPaths = {},
+        .backupDbPath = g_backupDbPath,
+        .backupDir = "",
+        .backupMaxSize = 0,
+        .backupMaxAge = 0,
+        .pidStateMaxSize = g_pidStateMaxSize,
+        .entropyThreads = 0,
+        .entropySamplePages = 4,
+        .entropyThreshold = 7.5,
+        .entropyMinFiles = 16,
+        .entropyRatio = 0.8,
+        .aggregateAncestors = 0,
+        .aggregateProcessGroup = false,
+        .aggregateSession = false,
+        .aggregateSuspect = {
+            .reads = 400,
+            .writes = 400,
+        },
+        .aggregateKillAncestor = false,
+        .aggregateCgroup = false,
+        .cgroupSuspect = {},
+        .mounts = {},
+        .freezeTimeout = 0,
+        .ignoreHotEvents = 0,
+        .ignoreMaxMarks = 1024,
+        .ignoreMarkTtl = 60,
+        .canaryDirs = {},
+        .canaryNames = {g_canaryName},
+        .canaryRefresh = 60,
+        .scoreModel = ScoreModel(),
+        .latencyReportPeriod = 10,
+        .recordPath = "",
+        .statsSocketPath = g_statsSocketPath,
+        .profileStages = false
     };
 }
 
+// Parse optional backup fields, backup is disabled when there is no "backup_paths"
+static void GetBackupConfig(json& data, Config& cfg)
+{
+    cfg.backupDbPath = g_backupDbPath;
+    if (data.contains("backup_db_path"))
+        cfg.backupDbPath = data["backup_db_path"];
+
+    if (data.contains("backup_dir"))
+        cfg.backupDir = data["backup_dir"];
+
+    if (data.contains("backup_max_size_mb"))
+        cfg.backupMaxSize = data["backup_max_size_mb"].get<int64_t>() * 1024 * 1024;
+
+    if (data.contains("backup_max_age_s"))
+        cfg.backupMaxAge = data["backup_max_age_s"];
+
+    if (data.contains("backup_paths"))
+    {
+        for (auto& path : data["backup_paths"])
+            cfg.backupPaths.push_back(path);
+    }
+}
+
+// Parse optional path of the event trace, recording is disabled when there is no "record_path"
+static void GetRecordConfig(json& data, Config& cfg)
+{
+    if (data.contains("record_path"))
+        cfg.recordPath = data["record_path"];
+}
+
+// Parse optional memory budget of pid state
+static void GetMemoryConfig(json& data, Config& cfg)
+{
+    cfg.pidStateMaxSize = g_pidStateMaxSize;
+    if (data.contains("pid_state_max_mb"))
+        cfg.pidStateMaxSize = data["pid_state_max_mb"].get<int64_t>() * 1024 * 1024;
+}
+
+// Parse optional entropy check, it is disabled when there is no "entropy_threads"
+static void GetEntropyConfig(json& data, Config& cfg)
+{
+    cfg.entropyThreads = 0;
+    cfg.entropySamplePages = 4;
+    cfg.entropyThreshold = 7.5;
+    cfg.entropyMinFiles = 16;
+    cfg.entropyRatio = 0.8;
+
+    if (data.contains("entropy_threads"))
+        cfg.entropyThreads = data["entropy_threads"];
+
+    if (data.contains("entropy_sample_pages"))
+        cfg.entropySamplePages = data["entropy_sample_pages"];
+
+    if (data.contains("entropy_threshold"))
+        cfg.entropyThreshold = data["entropy_threshold"];
+
+    if (data.contains("entropy_min_files"))
+        cfg.entropyMinFiles = data["entropy_min_files"];
+
+    if (data.contains("entropy_ratio"))
+        cfg.entropyRatio = data["entropy_ratio"];
+}
+
+// Parse optional aggregation of counters by process tree, it is disabled by default
+static void GetAggregateConfig(json& data, Config& cfg)
+{
+    cfg.aggregateAncestors = 0;
+    cfg.aggregateProcessGroup = false;
+    cfg.aggregateSession = false;
+    cfg.aggregateSuspect = {.reads = 400, .writes = 400};
+    cfg.aggregateKillAncestor = false;
+
+    if (data.contains("aggregate_ancestors"))
+        cfg.aggregateAncestors = data["aggregate_ancestors"];
+
+    if (data.contains("aggregate_process_group"))
+        cfg.aggregateProcessGroup = data["aggregate_process_group"];
+
+    if (data.contains("aggregate_session"))
+        cfg.aggregateSession = data["aggregate_session"];
+
+    if (data.contains("aggregate_read_suspect"))
+        cfg.aggregateSuspect.reads = data["aggregate_read_suspect"];
+
+    if (data.contains("aggregate_write_suspect"))
+        cfg.aggregateSuspect.writes = data["aggregate_write_suspect"];
+
+    if (data.contains("aggregate_kill_ancestor"))
+        cfg.aggregateKillAncestor = data["aggregate_kill_ancestor"];
+
+    cfg.aggregateCgroup = false;
+    cfg.cgroupSuspect.clear();
+    if (data.contains("aggregate_cgroup"))
+        cfg.aggregateCgroup = data["aggregate_cgroup"];
+
+    if (!data.contains("cgroup_suspect"))
+        return ;
+
+    for (auto& item : data["cgroup_suspect"])
+    {
+        if (!item.contains("cgroup") || !item.contains("read_suspect") || !item.contains("write_suspect"))
+            throw std::runtime_error("Each cgroup_suspect item must contain cgroup, read_suspect and write_suspect");
+
+        cfg.cgroupSuspect.push_back({
+            .prefix = item["cgroup"].get<std::string>(),
+            .suspect = {.reads = item["read_suspect"].get<unsigned>(), .writes = item["write_suspect"].get<unsigned>()},
+        });
+    }
+}
+
+// Parse optional extra mounts, thresholds of a mount are event_read_suspect and event_write_suspect by default
+static void GetMountsConfig(json& data, Config& cfg)
+{
+    cfg.mounts.clear();
+    if (!data.contains("mounts"))
+        return ;
+
+    for (auto& item : data["mounts"])
+    {
+        if (!item.contains("path"))
+            throw std::runtime_error("Each mounts item must contain path");
+
+        Config::WatchedMount mount = {
+            .path = item["path"].get<std::string>(),
+            .isFilesystem = item.contains("filesystem") && item["filesystem"].get<bool>(),
+            .suspect = cfg.fileIOSuspect,
+        };
+        if (item.contains("read_suspect"))
+            mount.suspect.reads = item["read_suspect"];
+        if (item.contains("write_suspect"))
+            mount.suspect.writes = item["write_suspect"];
+
+        cfg.mounts.push_back(std::move(mount));
+    }
+}
+
+// Parse optional freezing of suspects, they are killed immediately by default. Entropy config must be parsed before
+static void GetFreezeConfig(json& data, Config& cfg)
+{
+    cfg.freezeTimeout = 0;
+    if (data.contains("freeze_timeout_ms"))
+        cfg.freezeTimeout = data["freeze_timeout_ms"];
+
+    if (cfg.freezeTimeout < 0)
+        throw std::runtime_error("freeze_timeout_ms can't be negative");
+
+    // without the sampler nothing acquits a frozen pid, freezing would be a delayed kill
+    if (cfg.freezeTimeout > 0 && cfg.entropyThreads == 0)
+        throw std::runtime_error("freeze_timeout_ms requires entropy_threads");
+}
+
+// Parse optional ignore marks of hot files of white-listed programs, they are disabled by default
+static void GetIgnoreConfig(json& data, Config& cfg)
+{
+    cfg.ignoreHotEvents = 0;
+    cfg.ignoreMaxMarks = 1024;
+    cfg.ignoreMarkTtl = 60;
+
+    if (data.contains("ignore_hot_events"))
+        cfg.ignoreHotEvents = data["ignore_hot_events"];
+
+    if (data.contains("ignore_max_marks"))
+        cfg.ignoreMaxMarks = data["ignore_max_marks"];
+
+    if (data.contains("ignore_mark_ttl_s"))
+        cfg.ignoreMarkTtl = data["ignore_mark_ttl_s"];
+
+    if (cfg.ignoreMarkTtl <= 0)
+        throw std::runtime_error("ignore_mark_ttl_s must be positive");
+}
+
+// Parse optional canary files, there are no canaries by default
+static void GetCanaryConfig(json& data, Config& cfg)
+{
+    cfg.canaryDirs.clear();
+    cfg.canaryNames = {g_canaryName};
+    cfg.canaryRefresh = 60;
+
+    if (data.contains("canary_dirs"))
+        cfg.canaryDirs = data["canary_dirs"].get<std::vector<std::string>>();
+
+    if (data.contains("canary_names"))
+        cfg.canaryNames = data["canary_names"].get<std::vector<std::string>>();
+
+    if (data.contains("canary_refresh_s"))
+        cfg.canaryRefresh = data["canary_refresh_s"];
+
+    if (cfg.canaryRefresh <= 0)
+        throw std::runtime_error("canary_refresh_s must be positive");
+
+    for (auto& name : cfg.canaryNames)
+    {
+        if (name.empty() || name.find('/') != std::string::npos)
+            throw std::runtime_error("canary_names must be file names");
+    }
+}
+
+static Feature GetFeature(json& data)
+{
+    Feature feature;
+    if (!FeatureByName(data.get<std::string>(), feature))
+        throw std::runtime_error("Unknown feature in score_model: " + data.get<std::string>());
+
+    return feature;
+}
+
+// Parse optional score model, read/write thresholds are used by default
+static void GetScoreConfig(json& data, Config& cfg)
+{
+    cfg.scoreModel = ScoreModel();
+    if (!data.contains("score_model"))
+        return ;
+
+    auto& model = data["score_model"];
+    if (!model.contains("type") || !model.contains("threshold"))
+        throw std::runtime_error("score_model must contain type and threshold");
+
+    auto type = model["type"].get<std::string>();
+    auto threshold = model["threshold"].get<float>();
+    if (type == "linear")
+    {
+        std::array<float, FEATURE_COUNT> weights{};
+        if (model.contains("weights"))
+        {
+            for (auto& [name, weight] : model["weights"].items())
+            {
+                json feature = name;
+                weights[GetFeature(feature)] = weight.get<float>();
+            }
+        }
+
+        cfg.scoreModel = ScoreModel::Linear(weights, model.contains("bias") ? model["bias"].get<float>() : 0, threshold);
+    }
+    else if (type == "tree")
+    {
+        if (!model.contains("nodes"))
+            throw std::runtime_error("Tree score_model must contain nodes");
+
+        std::vector<ScoreModel::Node> nodes;
+        for (auto& item : model["nodes"])
+        {
+            // leaf has only a value
+            if (!item.contains("feature"))
+            {
+                nodes.push_back({-1, 0, 0, 0, item.value("value", 0.0f)});
+                continue ;
+            }
+
+            if (!item.contains("threshold") || !item.contains("left") || !item.contains("right"))
+                throw std::runtime_error("Each score_model node must contain feature, threshold, left and right or only value");
+
+            nodes.push_back({GetFeature(item["feature"]), item["threshold"].get<float>(), item["left"].get<size_t>(),
+                item["right"].get<size_t>(), 0});
+        }
+
+        cfg.scoreModel = ScoreModel::Tree(std::move(nodes), threshold);
+    }
+    else
+        throw std::runtime_error("score_model type must be linear or tree");
+}
+
+// Parse optional period of latency reports
+static void GetLatencyConfig(json& data, Config& cfg)
+{
+    cfg.latencyReportPeriod = 10;
+    if (data.contains("latency_report_s"))
+        cfg.latencyReportPeriod = data["latency_report_s"];
+}
+
+// Parse optional path of stats socket, daemon serves stats by default
+static void GetStatsConfig(json& data, Config& cfg)
+{
+    cfg.statsSocketPath = g_statsSocketPath;
+    if (data.contains("stats_socket_path"))
+        cfg.statsSocketPath = data["stats_socket_path"];
+}
+
+// Parse optional switch of stage profiling
+static void GetProfileConfig(json& data, Config& cfg)
+{
+    cfg.profileStages = false;
+    if (data.contains("profile_stages"))
+        cfg.profileStages = data["profile_stages"];
+}
+
 // Parse config that lies in g_configPath and return struct
 Config GetConfig()
 {
@@ -99,15 +429,37 @@ Config GetConfig()
         ssize_t currentFlag = StringToMarkFlag(flag);
         if (currentFlag < 0)
             throw std::runtime_error("Can't recognize flags in event_track");
-        cfg.markFlags.push_back(currentFlag);
+
+        if (currentFlag & DIRECTORY_EVENTS)
+            cfg.directoryMarkFlags.push_back(currentFlag);
+        else
+            cfg.markFlags.push_back(currentFlag);
     }
 
+    cfg.replaceSuspect = 0;
+    if (data.contains("event_replace_suspect"))
+        cfg.replaceSuspect = data["event_replace_suspect"];
+
     if (!data.contains("white_list"))
         throw std::runtime_error("Can't find necessary field in config: white_list");
 
     for (auto& path : data["white_list"])
         cfg.whiteList.push_back(path);
 
+    GetBackupConfig(data, cfg);
+    GetRecordConfig(data, cfg);
+    GetLatencyConfig(data, cfg);
+    GetStatsConfig(data, cfg);
+    GetProfileConfig(data, cfg);
+    GetMemoryConfig(data, cfg);
+    GetEntropyConfig(data, cfg);
+    GetAggregateConfig(data, cfg);
+    GetMountsConfig(data, cfg);
+    GetFreezeConfig(data, cfg);
+    GetIgnoreConfig(data, cfg);
+    GetCanaryConfig(data, cfg);
+    GetScoreConfig(data, cfg);
+
     return cfg;
 }
 
@@ -168,15 +520,37 @@ Config GetDaemonConfig()
         ssize_t currentFlag = StringToMarkFlag(flag);
         if (currentFlag < 0)
             throw std::runtime_error("Can't recognize flags in event_track");
-        cfg.markFlags.push_back(currentFlag);
+
+        if (currentFlag & DIRECTORY_EVENTS)
+            cfg.directoryMarkFlags.push_back(currentFlag);
+        else
+            cfg.markFlags.push_back(currentFlag);
     }
 
+    cfg.replaceSuspect = 0;
+    if (data.contains("event_replace_suspect"))
+        cfg.replaceSuspect = data["event_replace_suspect"];
+
     if (!data.contains("white_list"))
         throw std::runtime_error("Can't find necessary field in config: white_list");
 
     for (auto& path : data["white_list"])
         cfg.whiteList.push_back(path);
 
+    GetBackupConfig(data, cfg);
+    GetRecordConfig(data, cfg);
+    GetLatencyConfig(data, cfg);
+    GetStatsConfig(data, cfg);
+    GetProfileConfig(data, cfg);
+    GetMemoryConfig(data, cfg);
+    GetEntropyConfig(data, cfg);
+    GetAggregateConfig(data, cfg);
+    GetMountsConfig(data, cfg);
+    GetFreezeConfig(data, cfg);
+    GetIgnoreConfig(data, cfg);
+    GetCanaryConfig(data, cfg);
+    GetScoreConfig(data, cfg);
+
     return cfg;
 }
 
@@ -1,13 +1,67 @@
 #include <fanotify/detector.h>
 
+// c includes
+#include <fcntl.h>
+#include <sys/stat.h>
+
+// c++ includes
+#include <algorithm>
+#include <cmath>
+#include <tuple>
+
 using namespace fn;
 
+// libstdc++ std::deque (under std::queue) allocates 512 byte chunks and the map of pointers to them,
+// an empty queue already holds one chunk
+constexpr size_t g_queueChunkBytes = 512;
+constexpr size_t g_queueMapBytes = 8 * sizeof(void*);
+// red-black tree node header: color, parent, left and right
+constexpr size_t g_treeNodeBytes = 4 * sizeof(void*);
+
+// set by SIGUSR1 handler, the profile is dumped by the main loop
+static volatile sig_atomic_t g_isProfileRequested = 0;
+
+static void RequestProfile(int)
+{
+    g_isProfileRequested = 1;
+}
+
 EncryptorDetector::EncryptorDetector(const char* mount, const Config& cfg) :
+    EncryptorDetector(std::make_unique<FanotifyWrapper>(cfg.fanotifyFlags, cfg.fanotifyEventFlags), mount, cfg)
+{}
+
+EncryptorDetector::EncryptorDetector(std::unique_ptr<EventSource> source, const char* mount, const Config& cfg) :
     m_tracer(cfg.logPath),
     m_config(cfg),
-    m_fanotify(cfg.fanotifyFlags, cfg.fanotifyEventFlags),
+    m_source(std::move(source)),
     m_mount(mount),
-    m_pidEventMap()
+    m_mounts(1 + cfg.mounts.size()),
+    m_bucketSuspects(),
+    m_backup(cfg.backupPaths.empty() ? nullptr : std::make_unique<BackupWorker>(cfg, *m_source)),
+    m_recorder(cfg.recordPath.empty() ? nullptr : std::make_unique<EventTraceWriter>(cfg.recordPath)),
+    m_entropy(cfg.entropyThreads == 0 ? nullptr :
+        std::make_unique<EntropySampler>(*m_source, cfg.entropyThreads, cfg.entropySamplePages, m_entropyMaxQueue)),
+    m_canaryKeeper(cfg.canaryDirs.empty() ? nullptr :
+        std::make_unique<CanaryKeeper>(cfg.canaryDirs, cfg.canaryNames, std::chrono::seconds(cfg.canaryRefresh))),
+    m_canaryIds(),
+    m_canaryPaths(),
+    m_canaryGeneration(0),
+    m_pidEventMap(),
+    m_entropyMap(),
+    m_lastEntropySweep(),
+    m_groupMap(),
+    m_suspectGroups(),
+    m_processTree(*m_source),
+    m_hotFiles(),
+    m_hotWindowStart(m_source->Now()),
+    m_ignoreMarks(),
+    m_markMask(0),
+    m_suspects(),
+    m_frozenPids(),
+    m_pidStateBytes(0),
+    m_lastLatencyReport(clock::now()),
+    m_profiler(cfg.profileStages),
+    m_statsServer()
 {
     // trace and create trace file if it doesnt exist
     TRACE(m_tracer, "Initializing detector");
@@ -16,16 +70,119 @@ EncryptorDetector::EncryptorDetector(const char* mount, const Config& cfg) :
     uint64_t markMask = 0;
     for (auto& flag : cfg.markFlags)
         markMask |= flag;
+    m_markMask = markMask;
     
-    m_fanotify.Mark(m_markFlags, markMask, AT_FDCWD, m_mount.data());
+    // directory entry events come from their own group, they are reported for the whole filesystem
+    uint64_t directoryMask = 0;
+    for (auto& flag : cfg.directoryMarkFlags)
+        directoryMask |= flag;
+
+    MarkMounts(markMask, directoryMask);
     // ignore log file
-    m_fanotify.Mark(FAN_MARK_ADD | FAN_MARK_IGNORED_MASK | FAN_MARK_IGNORED_SURV_MODIFY,
+    m_source->Mark(FAN_MARK_ADD | FAN_MARK_IGNORED_MASK | FAN_MARK_IGNORED_SURV_MODIFY,
         FAN_OPEN_PERM | FAN_CLOSE_WRITE, AT_FDCWD, cfg.logPath);
+    // ignore event trace, otherwise every flush of the trace is an event
+    if (m_recorder)
+        m_source->Mark(FAN_MARK_ADD | FAN_MARK_IGNORED_MASK | FAN_MARK_IGNORED_SURV_MODIFY,
+            FAN_OPEN_PERM | FAN_CLOSE_WRITE | FAN_MODIFY, AT_FDCWD, cfg.recordPath);
     
+    // wake up without events to report latency and to judge frozen pids in time (they make no events)
+    int64_t waitTimeout = cfg.latencyReportPeriod > 0 ? cfg.latencyReportPeriod * 1000 : -1;
+    if (cfg.freezeTimeout > 0)
+    {
+        auto freezeWait = std::min<int64_t>(cfg.freezeTimeout, m_freezeCheckPeriodMs);
+        waitTimeout = waitTimeout < 0 ? freezeWait : std::min(waitTimeout, freezeWait);
+    }
+    if (waitTimeout >= 0)
+        m_source->SetWaitTimeout(static_cast<int>(waitTimeout));
+
+    // without SA_RESTART signal interrupts waiting for events, so the profile is dumped at once
+    if (cfg.profileStages)
+    {
+        struct sigaction action = {};
+        action.sa_handler = RequestProfile;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGUSR1, &action, nullptr) < 0)
+            throw std::runtime_error("Can't set SIGUSR1 handler");
+    }
+
+    // stats are served only when everything they read is set up (mounts are filled by MarkMounts)
+    if (!cfg.statsSocketPath.empty())
+        m_statsServer = std::make_unique<StatsServer>(cfg.statsSocketPath, [this] { return Stats(); });
+
     TRACE(m_tracer, "Initialization completed");
 }
 
-void EncryptorDetector::ProcessEvent(fanotify_event_metadata& event)
+// path must end on a path component: "/data1" isn't under "/data"
+static bool IsUnderPath(const std::string& path, const std::string& prefix)
+{
+    return path.compare(0, prefix.size(), prefix) == 0 && (path.size() == prefix.size() ||
+        path[prefix.size()] == '/' || (!prefix.empty() && prefix.back() == '/'));
+}
+
+void EncryptorDetector::MarkMounts(uint64_t markMask, uint64_t directoryMask)
+{
+    std::vector<Config::WatchedMount> mounts = {{std::string(m_mount), false, m_config.fileIOSuspect}};
+    mounts.insert(mounts.end(), m_config.mounts.begin(), m_config.mounts.end());
+
+    for (size_t i = 0; i < mounts.size(); ++i)
+    {
+        auto& mount = m_mounts[i];
+        mount.path = mounts[i].path;
+        while (mount.path.size() > 1 && mount.path.back() == '/')
+            mount.path.pop_back();
+        mount.isFilesystem = mounts[i].isFilesystem;
+
+        // device is unknown for sources without real files, events are attributed only by paths then
+        struct stat st = {};
+        mount.dev = stat(mount.path.c_str(), &st) == 0 ? st.st_dev : 0;
+
+        auto& suspect = mounts[i].suspect;
+        auto bucket = std::find_if(m_bucketSuspects.begin(), m_bucketSuspects.end(), [&suspect](auto& other)
+            { return other.reads == suspect.reads && other.writes == suspect.writes; });
+        mount.bucket = bucket - m_bucketSuspects.begin();
+        if (bucket == m_bucketSuspects.end())
+            m_bucketSuspects.push_back(suspect);
+
+        m_source->Mark(mount.isFilesystem ? FAN_MARK_ADD | FAN_MARK_FILESYSTEM : m_markFlags, markMask,
+            AT_FDCWD, mount.path);
+        if (directoryMask)
+            m_source->MarkDirectories(directoryMask, mount.path);
+    }
+}
+
+size_t EncryptorDetector::MountOf(const std::string& path, int fd) const
+{
+    if (m_mounts.size() == 1)
+        return 0;
+
+    struct stat st = {};
+    bool isDevKnown = fd >= 0 && fstat(fd, &st) == 0;
+    size_t match = 0;
+    bool isMatched = false;
+    // the first mount is never a filesystem one, so 0 means there is no such mount
+    size_t filesystem = 0;
+    for (size_t i = 0; i < m_mounts.size(); ++i)
+    {
+        auto& mount = m_mounts[i];
+        if (isDevKnown && mount.dev != 0 && mount.dev != st.st_dev)
+            continue ;
+
+        if (IsUnderPath(path, mount.path))
+        {
+            if (!isMatched || mount.path.size() > m_mounts[match].path.size())
+                match = i;
+            isMatched = true;
+        }
+        // file of the marked filesystem is reached through another mount of it (bind mount)
+        else if (filesystem == 0 && isDevKnown && mount.isFilesystem)
+            filesystem = i;
+    }
+
+    return isMatched ? match : filesystem;
+}
+
+void EncryptorDetector::ProcessEvent(fanotify_event_metadata& event, time_point received)
 {
     // trace caught events only in debug
 #ifdef DEBUG
@@ -33,8 +190,28 @@ void EncryptorDetector::ProcessEvent(fanotify_event_metadata& event)
     stream << "Event caught! info: ";
 #endif
 
-    auto fileName = GetFilenameByFd(event.fd);
+    auto fileName = m_source->GetPath(event);
     auto isItself = (getpid() == event.pid);
+    auto now = m_source->Now();
+    auto mount = isItself ? 0 : MountOf(fileName, m_source->GetContentFd(event));
+    auto fileHash = m_config.scoreModel.IsEnabled() ? std::hash<std::string>{}(fileName) | 1 : 0;
+
+    // nobody has a reason to write a canary, it is a verdict by itself
+    if (!isItself && !m_canaryIds.empty() && (event.mask & (FAN_MODIFY | FAN_CLOSE_WRITE)) &&
+        IsCanary(fileName, m_source->GetContentFd(event)))
+        HandleCanary(event.pid, fileName);
+
+    if (m_recorder && !isItself)
+    {
+        StageScope stage(m_profiler, STAGE_TRACE);
+        m_recorder->Record(now, event.mask, event.pid, fileName);
+    }
+
+    // protected file is opened, answer will be given by backup worker after the snapshot
+    bool isDeferred = !isItself && m_backup && IsEvent(event, FAN_OPEN_PERM) && m_backup->IsProtected(fileName);
+    // types the event is counted as, one event might match several flags (FAN_CLOSE and FAN_CLOSE_WRITE)
+    unsigned eventTypes = 0;
+
     for (auto& id : m_config.markFlags)
     {
     #ifdef DEBUG
@@ -42,8 +219,11 @@ void EncryptorDetector::ProcessEvent(fanotify_event_metadata& event)
     #endif
         if (IsEvent(event, id))
         {
-            if (id == FAN_OPEN_PERM || id == FAN_ACCESS_PERM)
-                m_fanotify.ResponseAllow(event);
+            if ((id == FAN_OPEN_PERM && !isDeferred) || id == FAN_ACCESS_PERM)
+            {
+                m_source->ResponseAllow(event);
+                m_permLatency.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - received).count());
+            }
 
             // allowed event, no more interesting for itself
             if (isItself)
@@ -51,33 +231,103 @@ void EncryptorDetector::ProcessEvent(fanotify_event_metadata& event)
 
         #ifdef DEBUG
             stream << "type = " << StringizeEventType(id) << ", ";
-            stream << "file = " << GetFilenameByFd(event.fd) << ", PID = " << event.pid;
+            stream << "file = " << fileName << ", PID = " << event.pid;
             if (!isItself) // do not generate infinite amount of logs
                 TRACE(m_tracer, stream.str().c_str());
         #endif
 
-            // log this event into map (only reads and writes)
+            // log this event into map (reads and writes, opens and closes are counted below)
             auto idx = FanotifyEventToIdx(id);
+            if (idx < EVENT_COUNT)
+                eventTypes |= 1u << idx;
+
             if (idx == EVENT_READ || idx == EVENT_WRITE)
-            {
-                auto& procInfo = m_pidEventMap[event.pid];
-                procInfo.eventsCount[idx]++;
-                procInfo.eventsQueue.push({idx, clock::now()});
-            }
+                CountEvent(event.pid, idx, mount, now, fileHash);
         }
     }
 
-    close(event.fd);
+    for (size_t idx = 0; idx < EVENT_COUNT; ++idx)
+    {
+        if (eventTypes & (1u << idx))
+        {
+            m_eventCounters[idx].Add();
+            m_mounts[mount].events[idx].Add();
+        }
+    }
+
+    // opens and closes are features of the score model only, thresholds are checked against reads and writes
+    if (m_config.scoreModel.IsEnabled())
+    {
+        for (auto idx : {EVENT_OPEN, EVENT_CLOSE})
+        {
+            if (eventTypes & (1u << idx))
+                CountEvent(event.pid, idx, mount, now, fileHash);
+        }
+    }
+
+    // hot files are learned by the event descriptor, so before the sampler takes it
+    if (!isItself && !isDeferred && m_config.ignoreHotEvents > 0)
+        LearnHotFile(fileName, m_source->GetContentFd(event), event.pid, event.mask & m_markMask);
+
+    // written file of the pid that writes in the time window is sampled, sampler owns event fd from now on
+    bool isSampled = !isItself && !isDeferred && m_entropy && IsEvent(event, FAN_CLOSE_WRITE) &&
+        IsWriter(event.pid) && m_entropy->Submit(event);
+
+    // worker owns event fd from now on
+    if (isDeferred)
+        m_backup->Submit(event, std::move(fileName), received);
+    else if (!isSampled)
+        m_source->Release(event);
+}
+
+void EncryptorDetector::MarkDirty(int pid, ProcInfo& procInfo)
+{
+    if (procInfo.isDirty)
+        return ;
+
+    procInfo.isDirty = true;
+    m_dirtyPids.push_back(pid);
+}
+
+void EncryptorDetector::CountEvent(int pid, int type, size_t mount, time_point now, size_t fileHash)
+{
+    auto [it, isNewPid] = m_pidEventMap.try_emplace(pid);
+    auto& procInfo = it->second;
+    if (isNewPid)
+    {
+        AttachGroups(pid, procInfo);
+        if (m_bucketSuspects.size() > 1)
+            procInfo.bucketCounts.resize(m_bucketSuspects.size());
+    }
+
+    auto bucket = m_mounts[mount].bucket;
+    procInfo.eventsCount[type]++;
+    if (!procInfo.bucketCounts.empty() && (type == EVENT_READ || type == EVENT_WRITE))
+        procInfo.bucketCounts[bucket][type]++;
+    procInfo.eventsQueue.push({type, static_cast<uint32_t>(bucket), now});
+    procInfo.lastActive = now;
+    m_pidStateBytes += isNewPid ? PidStateBytes(procInfo) : sizeof(ProcEvent);
+    MarkDirty(pid, procInfo);
+    if (fileHash)
+        procInfo.files[(fileHash >> 6) % procInfo.files.size()] |= 1ull << (fileHash & 63);
+
+    if (!procInfo.groups.empty())
+        CountInGroups(procInfo, type);
 }
 
 void EncryptorDetector::CheckForOutdatedEvents()
 {
-    for (auto& pair : m_pidEventMap)
+    StageScope stage(m_profiler, STAGE_EXPIRY);
+    auto now = m_source->Now();
+    // memory is recalculated precisely on every pass, ProcessEvent only estimates growth
+    m_pidStateBytes = 0;
+    for (auto it = m_pidEventMap.begin(); it != m_pidEventMap.end();)
     {
+        auto& pair = *it;
         auto& currentQueue = pair.second.eventsQueue;
         while (currentQueue.size() > 0)
         {
-            auto frontTimeAlive = std::chrono::duration_cast<ms>(clock::now() - currentQueue.front().birth).count();
+            auto frontTimeAlive = std::chrono::duration_cast<ms>(now - currentQueue.front().birth).count();
             if (frontTimeAlive < m_config.fileIOMaxAge)
                 break;
             else
@@ -87,19 +337,269 @@ void EncryptorDetector::CheckForOutdatedEvents()
                 ss << "Remove outdated event from proccess with pid = " << pair.first;
                 TRACE(m_tracer, std::move(ss.str()));
             #endif
-                pair.second.eventsCount[currentQueue.front().type]--;
+                MarkDirty(pair.first, pair.second);
+                auto& front = currentQueue.front();
+                pair.second.eventsCount[front.type]--;
+                if (!pair.second.bucketCounts.empty() && (front.type == EVENT_READ || front.type == EVENT_WRITE))
+                    pair.second.bucketCounts[front.bucket][front.type]--;
+                for (auto group : pair.second.groups)
+                    group->eventsCount[currentQueue.front().type]--;
                 currentQueue.pop();
             }
         }
+
+        // pid without events in the time window is the same as unknown one, short-lived processes must not pile up
+        if (currentQueue.empty())
+        {
+            DetachGroups(pair.second);
+            it = m_pidEventMap.erase(it);
+            continue ;
+        }
+
+        m_pidStateBytes += PidStateBytes(pair.second);
+        ++it;
+    }
+}
+
+bool EncryptorDetector::IsWriter(int pid) const
+{
+    auto it = m_pidEventMap.find(pid);
+    return it != m_pidEventMap.end() && it->second.eventsCount[EVENT_WRITE] > 0;
+}
+
+size_t EncryptorDetector::PidStateBytes(const ProcInfo& procInfo)
+{
+    size_t eventsPerChunk = g_queueChunkBytes / sizeof(ProcEvent);
+    size_t chunks = procInfo.eventsQueue.size() / eventsPerChunk + 1;
+    return g_treeNodeBytes + sizeof(std::pair<const int, ProcInfo>) + g_queueMapBytes + chunks * g_queueChunkBytes +
+        procInfo.bucketCounts.size() * sizeof(procInfo.bucketCounts[0]);
+}
+
+void EncryptorDetector::RemovePid(std::map<int, ProcInfo>::iterator it)
+{
+    auto bytes = PidStateBytes(it->second);
+    m_pidStateBytes = m_pidStateBytes > bytes ? m_pidStateBytes - bytes : 0;
+    DetachGroups(it->second);
+    m_pidEventMap.erase(it);
+}
+
+void EncryptorDetector::AttachGroups(int pid, ProcInfo& procInfo)
+{
+    if (m_config.aggregateAncestors == 0 && !m_config.aggregateProcessGroup && !m_config.aggregateSession &&
+        !m_config.aggregateCgroup)
+        return ;
+
+    // @return true if the group has been created
+    auto attach = [this, &procInfo](int64_t key)
+    {
+        auto [it, isNewGroup] = m_groupMap.try_emplace(key);
+        auto& group = it->second;
+        if (isNewGroup)
+        {
+            group.key = key;
+            group.suspect = m_config.aggregateSuspect;
+            group.created = m_source->Now();
+        }
+
+        group.pids++;
+        procInfo.groups.push_back(&group);
+        return isNewGroup;
+    };
+
+    for (auto ancestor : m_processTree.Ancestors(pid, m_config.aggregateAncestors))
+        attach(GroupKey(GROUP_ANCESTOR, ancestor));
+
+    // nullptr if the process has already exited
+    auto stat = m_processTree.Get(pid);
+    if (stat && m_config.aggregateProcessGroup)
+        attach(GroupKey(GROUP_PROCESS_GROUP, stat->pgid));
+    if (stat && m_config.aggregateSession)
+        attach(GroupKey(GROUP_SESSION, stat->sid));
+
+    if (!m_config.aggregateCgroup)
+        return ;
+
+    // processes of the root cgroup have nothing in common
+    auto cgroup = m_processTree.Cgroup(pid);
+    if (cgroup && *cgroup != "/" && attach(GroupKey(GROUP_CGROUP, std::hash<std::string>{}(*cgroup))))
+    {
+        auto group = procInfo.groups.back();
+        group->name = *cgroup;
+        group->suspect = CgroupSuspect(*cgroup);
     }
 }
 
+bool EncryptorDetector::IsKillableAncestor(int pid)
+{
+    if (pid == getpid())
+        return false;
+
+    // login shells, sshd sessions, tmux, systemd --user and service managers start sessions or are started by init
+    auto stat = m_processTree.Get(pid);
+    return stat && stat->sid != pid && stat->ppid > 2;
+}
+
+Config::FileIOSuspect EncryptorDetector::CgroupSuspect(const std::string& cgroup) const
+{
+    const Config::CgroupSuspect* match = nullptr;
+    for (auto& item : m_config.cgroupSuspect)
+    {
+        // "/pod1" doesn't match "/pod10"
+        if (IsUnderPath(cgroup, item.prefix) && (!match || item.prefix.size() > match->prefix.size()))
+            match = &item;
+    }
+
+    return match ? match->suspect : m_config.aggregateSuspect;
+}
+
+void EncryptorDetector::DetachGroups(ProcInfo& procInfo)
+{
+    for (auto group : procInfo.groups)
+    {
+        for (size_t type = 0; type < EVENT_COUNT; ++type)
+            group->eventsCount[type] -= procInfo.eventsCount[type];
+
+        if (--group->pids == 0)
+            m_groupMap.erase(group->key);
+    }
+
+    procInfo.groups.clear();
+}
+
+void EncryptorDetector::CountInGroups(ProcInfo& procInfo, int type)
+{
+    for (auto group : procInfo.groups)
+    {
+        group->eventsCount[type]++;
+        if (!group->isReported && group->eventsCount[EVENT_READ] >= group->suspect.reads &&
+            group->eventsCount[EVENT_WRITE] >= group->suspect.writes)
+        {
+            group->isReported = true;
+            m_suspectGroups.push_back(group->key);
+        }
+    }
+}
+
+void EncryptorDetector::CheckSuspiciousGroups(std::vector<int>& pidsToRemove)
+{
+    static const char* kindNames[] = {"ancestor", "process group", "session", "cgroup"};
+
+    for (auto key : m_suspectGroups)
+    {
+        auto it = m_groupMap.find(key);
+        if (it == m_groupMap.end())
+            continue ; // all members are gone
+
+        auto& group = it->second;
+        group.isReported = false;
+        if (group.eventsCount[EVENT_READ] < group.suspect.reads || group.eventsCount[EVENT_WRITE] < group.suspect.writes)
+            continue ;
+
+        auto kind = static_cast<GroupKind>(key >> 56);
+        auto id = static_cast<int>(key & m_groupIdMask);
+
+        std::stringstream ss;
+        ss << "Suspicious " << kindNames[kind] << " = ";
+        if (kind == GROUP_CGROUP)
+            ss << group.name;
+        else
+            ss << id;
+        ss << " has been found: reads = " << group.eventsCount[EVENT_READ]
+            << ", writes = " << group.eventsCount[EVENT_WRITE] << ", pids = " << group.pids;
+        TRACE(m_tracer, std::move(ss.str()));
+        m_groupDetections.Add();
+
+        // only tracked members that did the I/O are judged, white-listed ones survive
+        std::vector<std::pair<int, time_point>> members;
+        for (auto& [pid, procInfo] : m_pidEventMap)
+        {
+            if (std::find(procInfo.groups.begin(), procInfo.groups.end(), &group) != procInfo.groups.end())
+                members.emplace_back(pid, procInfo.lastActive);
+        }
+
+        // ancestor spawns the members, it would just start new ones, but it is killed only on demand
+        if (kind == GROUP_ANCESTOR && m_config.aggregateKillAncestor && IsKillableAncestor(id))
+            members.emplace_back(id, group.created);
+
+        for (auto [pid, seen] : members)
+        {
+            if (std::find(pidsToRemove.begin(), pidsToRemove.end(), pid) != pidsToRemove.end())
+                continue ; // already judged on this iteration
+
+            HandleSuspect(pid, seen);
+            pidsToRemove.push_back(pid);
+        }
+    }
+
+    m_suspectGroups.clear();
+}
+
+void EncryptorDetector::CheckMemoryBudget()
+{
+    StageScope stage(m_profiler, STAGE_EXPIRY);
+
+    auto maxSize = static_cast<size_t>(m_config.pidStateMaxSize);
+    if (m_config.pidStateMaxSize > 0 && m_pidStateBytes > maxSize)
+    {
+        // pids far from thresholds go first, then the least recently active ones
+        std::vector<std::tuple<bool, time_point, int>> candidates;
+        candidates.reserve(m_pidEventMap.size());
+        for (auto& [pid, procInfo] : m_pidEventMap)
+        {
+            bool isBenign = procInfo.eventsCount[EVENT_READ] < m_config.fileIOSuspect.reads / 2 &&
+                procInfo.eventsCount[EVENT_WRITE] < m_config.fileIOSuspect.writes / 2;
+            candidates.emplace_back(!isBenign, procInfo.lastActive, pid);
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        // evict a bit more than needed not to evict on every iteration
+        size_t target = maxSize / 10 * 9;
+        size_t evicted = 0;
+        for (auto& candidate : candidates)
+        {
+            if (m_pidStateBytes <= target)
+                break;
+            RemovePid(m_pidEventMap.find(std::get<2>(candidate)));
+            evicted++;
+        }
+        m_evictedPids.Add(evicted);
+
+        std::stringstream ss;
+        ss << "Pid state is over memory budget, " << evicted << " pids are evicted";
+        TRACE(m_tracer, std::move(ss.str()));
+    }
+
+    size_t pidTableBytes = m_pidEventMap.size() * (g_treeNodeBytes + sizeof(std::pair<const int, ProcInfo>));
+    m_pidTableBytes.Set(pidTableBytes);
+    m_eventQueueBytes.Set(m_pidStateBytes > pidTableBytes ? m_pidStateBytes - pidTableBytes : 0);
+    if (m_recorder)
+        m_recorderBytes.Set(m_recorder->MemoryUsage());
+    // node of unordered_map: next pointer, cached hash and a bucket
+    m_entropyTableBytes.Set(m_entropyMap.size() * (sizeof(std::pair<const int, EntropyInfo>) + 3 * sizeof(void*)));
+    m_groupTableBytes.Set(m_groupMap.size() * (sizeof(std::pair<const int64_t, GroupInfo>) + 3 * sizeof(void*)));
+
+    m_processTree.Sweep();
+    m_processCacheBytes.Set(m_processTree.MemoryUsage());
+}
+
 void EncryptorDetector::ProcessEvents()
 {
-    auto events = m_fanotify.GetEvents();
+    if (m_canaryKeeper && m_canaryKeeper->Update(m_canaryIds, m_canaryPaths, m_canaryGeneration))
+        m_canaryCount.Set(m_canaryIds.size());
+
+    m_profiler.Enter(STAGE_READ);
+    auto events = m_source->GetEvents();
+    m_profiler.Leave();
+
+    ProcessDirectoryEvents();
     if (events.IsEmpty())
         return ; // all events for this iteration are processed
 
+    StageScope stage(m_profiler, STAGE_CLASSIFY);
+
+    // latency is measured in real time even if the source has its own clock
+    auto received = clock::now();
+
     for (auto& event : events)
     {
         if (event.vers != FANOTIFY_METADATA_VERSION)
@@ -108,60 +608,766 @@ void EncryptorDetector::ProcessEvents()
             throw std::runtime_error("mismatch of fanotify metadata version");
         }
         
-        if (event.fd == 0)
+        // events are lost, but the rest of them are still valid, there is no fd to answer or close
+        if (event.mask & FAN_Q_OVERFLOW)
         {
             TRACE(m_tracer, "Overflow detected!");
-            throw std::overflow_error("Event queue overflow!");
+            m_overflows.Add();
+            continue ;
         }
 
-        ProcessEvent(event);
+        ProcessEvent(event, received);
     }
 }
 
-void EncryptorDetector::CheckForSuspiciousPids()
+void EncryptorDetector::ProcessDirectoryEvents()
 {
-    // check for suspicious pids
-    std::vector<int> pidsToRemove;
-    pidsToRemove.reserve(m_pidEventMap.size());
-    for (auto& [pid, procInfo] : m_pidEventMap)
+    m_profiler.Enter(STAGE_READ);
+    auto events = m_source->GetDirectoryEvents();
+    m_profiler.Leave();
+    if (events.empty())
+        return ;
+
+    StageScope stage(m_profiler, STAGE_CLASSIFY);
+    auto now = m_source->Now();
+    auto self = getpid();
+
+    for (auto& event : events)
+    {
+        if (event.mask & FAN_Q_OVERFLOW)
+        {
+            TRACE(m_tracer, "Overflow of directory events detected!");
+            m_overflows.Add();
+            continue ;
+        }
+
+        if (event.pid == self)
+            continue ;
+
+        // file written to a temporary one and renamed over the canary replaces it as well
+        if ((event.mask & (FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO)) && m_canaryPaths.count(event.path))
+            HandleCanary(event.pid, event.path);
+
+        if (m_recorder)
+        {
+            StageScope traceStage(m_profiler, STAGE_TRACE);
+            m_recorder->Record(now, event.mask, event.pid, event.path);
+        }
+
+        auto mount = MountOf(event.path, -1);
+        auto fileHash = m_config.scoreModel.IsEnabled() ? std::hash<std::string>{}(event.path) | 1 : 0;
+        // rename is reported as a pair of events: the source is a rename, the target is a created name
+        for (auto flag : {FAN_CREATE, FAN_MOVED_TO, FAN_DELETE, FAN_MOVED_FROM})
+        {
+            if (!(event.mask & flag))
+                continue ;
+
+            auto idx = FanotifyEventToIdx(flag);
+            m_eventCounters[idx].Add();
+            m_mounts[mount].events[idx].Add();
+            CountEvent(event.pid, idx, mount, now, fileHash);
+        }
+
+        if (fileHash && (event.mask & (FAN_MOVED_FROM | FAN_MOVED_TO)))
+            CountExtensionChange(event.pid, event.mask, event.path);
+    }
+}
+
+void EncryptorDetector::HandleSuspect(int pid, time_point seen, bool isProven)
+{
+    for (auto& suspect : m_suspects)
     {
-        if (procInfo.eventsCount[EVENT_READ] >= m_config.fileIOSuspect.reads &&
-            procInfo.eventsCount[EVENT_WRITE] >= m_config.fileIOSuspect.writes)
+        if (suspect.pid == pid)
         {
-            // check whitelist here to save some resources
-            auto execName = GetFilenameByPid(pid);
-            bool isWhiteListed = false;
-            for (auto& path : m_config.whiteList)
+            suspect.isProven |= isProven;
+            return ;
+        }
+    }
+
+    m_suspects.push_back({pid, seen, isProven});
+}
+
+bool EncryptorDetector::IsWhiteListed(int pid)
+{
+    // check whitelist here to save some resources
+    std::string execName;
+    try
+    {
+        execName = m_source->GetExecutable(pid);
+    }
+    catch (const std::runtime_error&)
+    {
+        // process has already exited
+        return true;
+    }
+
+    if (IsWhiteListedExecutable(execName))
+    {
+        // do nothing with white-listed binaries
+        m_whiteListHits.Add();
+        // backups of an exited process can't be told from the ones of a process that reuses its pid
+        int64_t started = m_backup ? GetStartTime(pid) : 0;
+        if (started != 0)
+            m_backup->MarkBenign(pid, started);
+        return true;
+    }
+
+    return false;
+}
+
+int64_t EncryptorDetector::GetStartTime(int pid)
+{
+    ProcessStat stat;
+    return m_source->GetProcessStat(pid, stat) ? StartTimeToUnix(stat.startTime) : 0;
+}
+
+bool EncryptorDetector::IsWhiteListedExecutable(const std::string& executable) const
+{
+    return std::find(m_config.whiteList.begin(), m_config.whiteList.end(), executable) != m_config.whiteList.end();
+}
+
+// path that resolves to the file of the descriptor, fanotify_mark() doesn't take O_PATH descriptors without a path
+static std::string DescriptorPath(int fd)
+{
+    return "/proc/self/fd/" + std::to_string(fd);
+}
+
+void EncryptorDetector::LearnHotFile(const std::string& path, int fd, int pid, uint64_t mask)
+{
+    struct stat st = {};
+    if (fd < 0 || fstat(fd, &st) < 0)
+        return ;
+
+    FileId id = {st.st_dev, st.st_ino};
+    auto it = m_hotFiles.find(id);
+    if (it == m_hotFiles.end())
+    {
+        if (m_hotFiles.size() >= m_maxHotFiles)
+            return ;
+        it = m_hotFiles.try_emplace(id).first;
+    }
+
+    auto& file = it->second;
+    if (file.isJudged)
+        return ;
+
+    file.mask |= mask;
+    auto pidsEnd = file.pids.begin() + file.pidCount;
+    if (std::find(file.pids.begin(), pidsEnd, pid) == pidsEnd)
+    {
+        // file shared by many processes is not a data file of one program
+        if (file.pidCount == file.pids.size())
+        {
+            file.isJudged = true;
+            return ;
+        }
+        file.pids[file.pidCount++] = pid;
+    }
+
+    if (++file.events < m_config.ignoreHotEvents)
+        return ;
+    file.isJudged = true;
+
+    // permission events of protected files must reach backup worker, canaries must never be ignored
+    if ((m_backup && m_backup->IsProtected(path)) || m_canaryIds.count(id) || m_canaryPaths.count(path))
+        return ;
+
+    for (size_t i = 0; i < file.pidCount; ++i)
+    {
+        // unlike responding to suspects, exited process proves nothing
+        try
+        {
+            if (!IsWhiteListedExecutable(m_source->GetExecutable(file.pids[i])))
+                return ;
+        }
+        catch (const std::runtime_error&)
+        {
+            return ;
+        }
+    }
+
+    auto mark = m_ignoreMarks.find(id);
+    if (mark == m_ignoreMarks.end() && m_ignoreMarks.size() >= m_config.ignoreMaxMarks)
+        return ;
+
+    // events still come if the mark has been cleared by a write, then it is installed again on the pinned inode
+    int pathFd = mark != m_ignoreMarks.end() ? mark->second.fd : open(DescriptorPath(fd).c_str(), O_PATH | O_CLOEXEC);
+    if (pathFd < 0)
+        return ;
+
+    // without IGNORED_SURV_MODIFY the first write to the file clears the mark, it is enough for files that are only read
+    unsigned flags = FAN_MARK_ADD | FAN_MARK_IGNORED_MASK;
+    if (file.mask & (FAN_MODIFY | FAN_CLOSE_WRITE))
+        flags |= FAN_MARK_IGNORED_SURV_MODIFY;
+
+    try
+    {
+        m_source->Mark(flags, file.mask, AT_FDCWD, DescriptorPath(pathFd));
+    }
+    catch (const std::runtime_error&)
+    {
+        if (mark == m_ignoreMarks.end())
+            close(pathFd);
+        return ;
+    }
+
+    auto expires = m_source->Now() + std::chrono::seconds(m_config.ignoreMarkTtl);
+    if (mark != m_ignoreMarks.end())
+        mark->second = {mark->second.mask | file.mask, expires, pathFd};
+    else
+        m_ignoreMarks.emplace(id, IgnoreMark{file.mask, expires, pathFd});
+    m_ignoreMarksInstalled.Add();
+    m_ignoreMarkCount.Set(m_ignoreMarks.size());
+
+#ifdef DEBUG
+    std::stringstream ss;
+    ss << "Hot file " << path << " of white-listed programs is ignored";
+    TRACE(m_tracer, std::move(ss.str()));
+#endif
+}
+
+bool EncryptorDetector::IsCanary(const std::string& path, int fd) const
+{
+    struct stat st = {};
+    if (fd >= 0 && fstat(fd, &st) == 0)
+        return m_canaryIds.count({st.st_dev, st.st_ino}) > 0;
+
+    return m_canaryPaths.count(path) > 0;
+}
+
+void EncryptorDetector::HandleCanary(int pid, const std::string& path)
+{
+    m_canaryHits.Add();
+
+    std::stringstream ss;
+    ss << "Canary file " << path << " has been touched by pid = " << pid;
+    TRACE(m_tracer, std::move(ss.str()));
+
+    // white list is checked by the response, frozen pids are killed at once
+    HandleSuspect(pid, m_source->Now(), true);
+}
+
+void EncryptorDetector::CheckIgnoreMarks()
+{
+    auto now = m_source->Now();
+    if (now - m_hotWindowStart < m_hotWindow)
+        return ;
+    m_hotWindowStart = now;
+    m_hotFiles.clear();
+
+    // marks are removed through pinned inodes, so renamed files lose them too and another file with the name keeps its own
+    for (auto it = m_ignoreMarks.begin(); it != m_ignoreMarks.end();)
+    {
+        if (now < it->second.expires)
+        {
+            ++it;
+            continue ;
+        }
+
+        try
+        {
+            m_source->Mark(FAN_MARK_REMOVE | FAN_MARK_IGNORED_MASK, it->second.mask, AT_FDCWD, DescriptorPath(it->second.fd));
+        }
+        catch (const std::runtime_error&)
+        {
+            // mark has been cleared by a write already
+        }
+        close(it->second.fd);
+        it = m_ignoreMarks.erase(it);
+    }
+
+    m_ignoreMarkCount.Set(m_ignoreMarks.size());
+}
+
+void EncryptorDetector::RespondToSuspects()
+{
+    // pin every suspect before any of them is signaled, executable is checked after pinning,
+    // so the white list is applied to the process that is signaled afterwards
+    std::vector<std::pair<Suspect, int>> pinned;
+    pinned.reserve(m_suspects.size());
+    for (auto& suspect : m_suspects)
+    {
+        auto frozen = m_frozenPids.find(suspect.pid);
+        if (frozen != m_frozenPids.end())
+        {
+            // frozen pid is pinned already, proof of encryption is its verdict
+            if (suspect.isProven)
             {
-                if (path == execName)
-                {
-                    // do nothing with white-listed binaries
-                    pidsToRemove.push_back(pid);
-                    isWhiteListed = true;
-                    break;
-                }
+                auto info = frozen->second;
+                m_frozenPids.erase(frozen);
+                KillSuspect(suspect.pid, info.pidfd, info.group);
             }
-     
-            if (isWhiteListed)
-                continue ;
+            continue ;
+        }
 
+        int pidfd = -1;
+        m_profiler.Enter(STAGE_KILL);
+        bool isPinned = m_source->OpenProcess(suspect.pid, suspect.seen, pidfd);
+        m_profiler.Leave();
+        if (!isPinned)
+        {
+            m_staleSuspects.Add();
             std::stringstream ss;
-            ss << "Suspicious pid = " << pid << " has been found";
+            ss << "Suspicious pid = " << suspect.pid << " has exited or has been reused by another process";
             TRACE(m_tracer, std::move(ss.str()));
+            continue ;
+        }
+
+        if (IsWhiteListed(suspect.pid))
+        {
+            if (pidfd >= 0)
+                close(pidfd);
+            continue ;
+        }
 
-            // kill this pid
-            kill(pid, SIGKILL);
+        pinned.emplace_back(suspect, pidfd);
+    }
+    m_suspects.clear();
 
-            ss.str("");
-            ss << "Suspicious pid = " << pid << " has been killed successfully";
-            TRACE(m_tracer, std::move(ss.str()));
+    for (auto& [suspect, pidfd] : pinned)
+    {
+        if (m_config.freezeTimeout > 0 && !suspect.isProven)
+            FreezeSuspect(suspect.pid, pidfd);
+        else
+            KillSuspect(suspect.pid, pidfd, StoppedGroup{0, {}});
+    }
+}
 
-            pidsToRemove.push_back(pid);
+void EncryptorDetector::FreezeSuspect(int pid, int pidfd)
+{
+    m_profiler.Enter(STAGE_KILL);
+    // white-listed programs that share the process group with the suspect are spared
+    StoppedGroup group{0, {}};
+    bool isFrozen = m_source->Freeze(pid, pidfd, group, m_config.whiteList);
+    m_profiler.Leave();
+    if (!isFrozen)
+    {
+        // process has already exited
+        if (pidfd >= 0)
+            close(pidfd);
+        return ;
+    }
+
+    auto pgid = group.pgid;
+    bool isPartial = !group.members.empty();
+    m_frozenPids.emplace(pid, FrozenInfo{m_source->Now(), pidfd, std::move(group)});
+    m_freezes.Add();
+    if (m_backup)
+        m_backup->MarkSuspect(pid, GetStartTime(pid));
+
+    std::stringstream ss;
+    ss << "Suspicious pid = " << pid;
+    if (pgid != 0)
+        ss << " and its process group " << pgid << (isPartial ? " (except white-listed members)" : "");
+    ss << " has been frozen until the verdict";
+    m_profiler.Enter(STAGE_TRACE);
+    TRACE(m_tracer, std::move(ss.str()));
+    m_profiler.Leave();
+}
+
+void EncryptorDetector::KillSuspect(int pid, int pidfd, const StoppedGroup& group)
+{
+    std::stringstream ss;
+    ss << "Suspicious pid = " << pid << " has been found";
+    m_profiler.Enter(STAGE_TRACE);
+    TRACE(m_tracer, std::move(ss.str()));
+    m_profiler.Leave();
+
+    // start time is read while the process lives, frozen one is marked already
+    if (m_backup)
+        m_backup->MarkSuspect(pid, GetStartTime(pid));
+
+    // kill this pid, stopped process is killed as well
+    m_profiler.Enter(STAGE_KILL);
+    m_source->Kill(pid, pidfd, group);
+    m_kills.Add();
+    if (m_backup)
+        m_backup->ReleaseSuspect(pid, true);
+    if (pidfd >= 0)
+        close(pidfd);
+    m_profiler.Leave();
+
+    ss.str("");
+    ss << "Suspicious pid = " << pid << " has been killed successfully";
+    m_profiler.Enter(STAGE_TRACE);
+    TRACE(m_tracer, std::move(ss.str()));
+    m_profiler.Leave();
+}
+
+void EncryptorDetector::CheckFrozenPids()
+{
+    auto now = m_source->Now();
+    for (auto it = m_frozenPids.begin(); it != m_frozenPids.end();)
+    {
+        int pid = it->first;
+        int pidfd = it->second.pidfd;
+        auto group = std::move(it->second.group);
+        bool isExpired = std::chrono::duration_cast<ms>(now - it->second.frozen).count() >= m_config.freezeTimeout;
+
+        // files written before freezing may still be waiting in the sampler queue
+        auto entropy = m_entropyMap.find(pid);
+        unsigned sampled = entropy != m_entropyMap.end() ? entropy->second.sampled : 0;
+        unsigned highEntropy = entropy != m_entropyMap.end() ? entropy->second.highEntropy : 0;
+        if (sampled < m_config.entropyMinFiles && !isExpired)
+        {
+            ++it;
+            continue ;
+        }
+
+        it = m_frozenPids.erase(it);
+        std::stringstream ss;
+        ss << "Frozen pid = " << pid << ": " << highEntropy << " of " << sampled << " sampled files have high entropy";
+        TRACE(m_tracer, std::move(ss.str()));
+
+        // nothing acquits the pid if none of its files is sampled
+        if (sampled == 0 || highEntropy >= m_config.entropyRatio * sampled)
+        {
+            KillSuspect(pid, pidfd, group);
+            continue ;
         }
+
+        m_source->Thaw(pid, pidfd, group);
+        if (pidfd >= 0)
+            close(pidfd);
+        m_thaws.Add();
+        if (m_backup)
+            m_backup->ReleaseSuspect(pid, false);
+
+        ss.str("");
+        ss << "Frozen pid = " << pid << " has been thawed";
+        TRACE(m_tracer, std::move(ss.str()));
     }
+}
+
+void EncryptorDetector::CheckForSuspiciousPids()
+{
+    StageScope stage(m_profiler, STAGE_SUSPICION);
+
+    // new samples of entropy make their pids dirty, so they are collected before pids are judged
+    std::vector<int> pidsToRemove;
+    if (m_entropy)
+        CheckEntropy(pidsToRemove);
+
+    // check for suspicious pids, counters of the rest haven't changed since the previous check
+    pidsToRemove.reserve(pidsToRemove.size() + m_dirtyPids.size());
+    if (m_config.scoreModel.IsEnabled())
+        CheckScores(pidsToRemove);
+    else
+        CheckRules(pidsToRemove);
+    m_dirtyPids.clear();
+
+    if (!m_suspectGroups.empty())
+        CheckSuspiciousGroups(pidsToRemove);
+
+    if (!m_suspects.empty())
+        RespondToSuspects();
+
+    if (!m_frozenPids.empty())
+        CheckFrozenPids();
 
     for (auto& pid : pidsToRemove)
-        m_pidEventMap.erase(pid);
+    {
+        auto it = m_pidEventMap.find(pid);
+        if (it != m_pidEventMap.end())
+            RemovePid(it);
+    }
+
+    m_trackedPids.Set(m_pidEventMap.size());
+    m_trackedGroups.Set(m_groupMap.size());
+}
+
+void EncryptorDetector::CheckRules(std::vector<int>& pidsToRemove)
+{
+    for (auto pid : m_dirtyPids)
+    {
+        // pid might be removed after it has become dirty, or judged by entropy already
+        auto it = m_pidEventMap.find(pid);
+        if (it == m_pidEventMap.end() || !it->second.isDirty)
+            continue ;
+
+        auto& procInfo = it->second;
+        procInfo.isDirty = false;
+        if (IsCopying(procInfo) || IsReplacing(procInfo))
+        {
+            HandleSuspect(pid, procInfo.lastActive);
+            pidsToRemove.push_back(pid);
+        }
+    }
+}
+
+void EncryptorDetector::CheckScores(std::vector<int>& pidsToRemove)
+{
+    // features of all dirty pids are gathered by columns first, then the model scores them in one pass
+    m_scoredPids.clear();
+    for (auto& column : m_featureColumns)
+        column.clear();
+
+    float toRate = 1000.0f / std::max<int64_t>(m_config.fileIOMaxAge, 1);
+    constexpr float bits = sizeof(ProcInfo::files) * 8;
+    for (auto pid : m_dirtyPids)
+    {
+        auto it = m_pidEventMap.find(pid);
+        if (it == m_pidEventMap.end() || !it->second.isDirty)
+            continue ;
+
+        auto& procInfo = it->second;
+        procInfo.isDirty = false;
+        m_scoredPids.push_back(pid);
+
+        auto& count = procInfo.eventsCount;
+        m_featureColumns[FEATURE_READS].push_back(count[EVENT_READ] * toRate);
+        m_featureColumns[FEATURE_WRITES].push_back(count[EVENT_WRITE] * toRate);
+        m_featureColumns[FEATURE_OPENS].push_back(count[EVENT_OPEN] * toRate);
+        m_featureColumns[FEATURE_CLOSES].push_back(count[EVENT_CLOSE] * toRate);
+        m_featureColumns[FEATURE_CREATES].push_back(count[EVENT_CREATE] * toRate);
+        m_featureColumns[FEATURE_DELETES].push_back(count[EVENT_DELETE] * toRate);
+        m_featureColumns[FEATURE_RENAMES].push_back(count[EVENT_RENAME] * toRate);
+
+        // n = -m * ln(zero bits / m), all bits set means "at least m * ln(m)"
+        unsigned ones = 0;
+        for (auto word : procInfo.files)
+            ones += __builtin_popcountll(word);
+        float zeros = std::max(bits - ones, 1.0f);
+        m_featureColumns[FEATURE_UNIQUE_FILES].push_back(-bits * std::log(zeros / bits));
+
+        auto entropy = m_entropyMap.find(pid);
+        bool isSampled = entropy != m_entropyMap.end() && entropy->second.sampled > 0;
+        m_featureColumns[FEATURE_ENTROPY].push_back(isSampled ?
+            static_cast<float>(entropy->second.highEntropy) / entropy->second.sampled : 0.0f);
+        m_featureColumns[FEATURE_EXTENSION_CHANGES].push_back(procInfo.extensionChanges);
+    }
+
+    m_config.scoreModel.Score(m_featureColumns, m_scoredPids.size(), m_scores);
+
+    for (size_t idx = 0; idx < m_scoredPids.size(); ++idx)
+    {
+        if (m_scores[idx] < m_config.scoreModel.Threshold())
+            continue ;
+
+        auto pid = m_scoredPids[idx];
+        std::stringstream ss;
+        ss << "Pid = " << pid << " has score " << m_scores[idx] << " (threshold " << m_config.scoreModel.Threshold() << ")";
+        TRACE(m_tracer, std::move(ss.str()));
+
+        HandleSuspect(pid, m_pidEventMap[pid].lastActive);
+        pidsToRemove.push_back(pid);
+    }
+}
+
+void EncryptorDetector::CountExtensionChange(int pid, uint64_t mask, const std::string& path)
+{
+    auto it = m_pidEventMap.find(pid);
+    if (it == m_pidEventMap.end())
+        return ;
+
+    // extension of the file name, not of a directory in the path
+    auto name = path.rfind('/');
+    auto dot = path.rfind('.');
+    auto extension = (dot != std::string::npos && (name == std::string::npos || dot > name)) ?
+        std::hash<std::string_view>{}(std::string_view(path).substr(dot)) | 1 : 1;
+
+    auto& procInfo = it->second;
+    if (mask & FAN_MOVED_FROM)
+        procInfo.movedFromExtension = extension;
+    else if (procInfo.movedFromExtension)
+    {
+        if (procInfo.movedFromExtension != extension)
+        {
+            procInfo.extensionChanges++;
+            MarkDirty(pid, procInfo);
+        }
+        procInfo.movedFromExtension = 0;
+    }
+}
+
+bool EncryptorDetector::IsCopying(const ProcInfo& procInfo) const
+{
+    if (procInfo.bucketCounts.empty())
+        return procInfo.eventsCount[EVENT_READ] >= m_config.fileIOSuspect.reads &&
+            procInfo.eventsCount[EVENT_WRITE] >= m_config.fileIOSuspect.writes;
+
+    for (size_t bucket = 0; bucket < procInfo.bucketCounts.size(); ++bucket)
+    {
+        auto& count = procInfo.bucketCounts[bucket];
+        auto& suspect = m_bucketSuspects[bucket];
+        if (count[EVENT_READ] >= suspect.reads && count[EVENT_WRITE] >= suspect.writes)
+            return true;
+    }
+
+    return false;
+}
+
+bool EncryptorDetector::IsWriting(const ProcInfo& procInfo) const
+{
+    if (procInfo.bucketCounts.empty())
+        return procInfo.eventsCount[EVENT_WRITE] >= m_config.fileIOSuspect.writes;
+
+    for (size_t bucket = 0; bucket < procInfo.bucketCounts.size(); ++bucket)
+    {
+        if (procInfo.bucketCounts[bucket][EVENT_WRITE] >= m_bucketSuspects[bucket].writes)
+            return true;
+    }
+
+    return false;
+}
+
+bool EncryptorDetector::IsReplacing(const ProcInfo& procInfo) const
+{
+    // encrypted copies are written and originals are deleted, or files are encrypted and renamed in place
+    auto& count = procInfo.eventsCount;
+    return m_config.replaceSuspect > 0 && count[EVENT_WRITE] >= m_config.fileIOSuspect.writes &&
+        count[EVENT_DELETE] + count[EVENT_RENAME] >= m_config.replaceSuspect;
+}
+
+void EncryptorDetector::CheckEntropy(std::vector<int>& pidsToRemove)
+{
+    auto now = m_source->Now();
+    for (auto& sample : m_entropy->TakeResults())
+    {
+        auto& info = m_entropyMap[sample.pid];
+        info.sampled++;
+        info.lastSample = now;
+        m_entropySamples.Add();
+        if (sample.entropy >= m_config.entropyThreshold)
+        {
+            info.highEntropy++;
+            m_highEntropySamples.Add();
+        }
+
+        // the ratio is a feature of score model, the pid is scored again with it
+        auto tracked = m_pidEventMap.find(sample.pid);
+        if (tracked != m_pidEventMap.end())
+            MarkDirty(sample.pid, tracked->second);
+        if (m_config.scoreModel.IsEnabled())
+            continue ;
+
+        // the pid is judged on every sample while the ratio is high enough
+        if (info.sampled < m_config.entropyMinFiles || info.highEntropy < m_config.entropyRatio * info.sampled)
+            continue ;
+
+        // copies of photos and videos, unpacked archives and browser caches are compressed data too,
+        // the ratio is a verdict only for a pid that writes or replaces many files
+        if (tracked == m_pidEventMap.end() || !(IsWriting(tracked->second) || IsReplacing(tracked->second)))
+            continue ;
+
+        std::stringstream ss;
+        ss << "High entropy writes of pid = " << sample.pid << ": " << info.highEntropy << " of " << info.sampled << " sampled files";
+        TRACE(m_tracer, std::move(ss.str()));
+
+        // the pid is surely alive at its last event, it closed the sampled file, it isn't judged by rules again
+        HandleSuspect(sample.pid, tracked->second.lastActive, true);
+        tracked->second.isDirty = false;
+        pidsToRemove.push_back(sample.pid);
+        m_entropyMap.erase(sample.pid);
+    }
+
+    // pids that didn't write for a long time are forgotten, the rest are kept to catch slow encryptors
+    if (now - m_lastEntropySweep < m_entropySweepPeriod)
+        return ;
+    m_lastEntropySweep = now;
+
+    for (auto it = m_entropyMap.begin(); it != m_entropyMap.end();)
+    {
+        if (now - it->second.lastSample >= m_entropyMaxIdle)
+            it = m_entropyMap.erase(it);
+        else
+            ++it;
+    }
+}
+
+LatencyHistogram::Snapshot EncryptorDetector::PermissionLatency() const
+{
+    auto snapshot = m_permLatency.Take();
+    if (m_backup)
+        snapshot += m_backup->Latency().Take();
+    return snapshot;
+}
+
+StatsSnapshot EncryptorDetector::Stats() const
+{
+    StatsSnapshot stats;
+    for (size_t idx = 0; idx < EVENT_COUNT; ++idx)
+        stats.events[idx] = m_eventCounters[idx].Get();
+
+    // stats server is started at the end of constructor, paths of mounts don't change afterwards, only counters do
+    stats.mounts.reserve(m_mounts.size());
+    for (auto& mount : m_mounts)
+    {
+        auto& item = stats.mounts.emplace_back();
+        item.path = mount.path;
+        for (size_t idx = 0; idx < EVENT_COUNT; ++idx)
+            item.events[idx] = mount.events[idx].Get();
+    }
+
+    stats.trackedPids = m_trackedPids.Get();
+    stats.overflows = m_overflows.Get();
+    stats.kills = m_kills.Get();
+    stats.freezes = m_freezes.Get();
+    stats.thaws = m_thaws.Get();
+    stats.staleSuspects = m_staleSuspects.Get();
+    stats.whiteListHits = m_whiteListHits.Get();
+    stats.evictedPids = m_evictedPids.Get();
+    stats.memoryBudget = m_config.pidStateMaxSize > 0 ? m_config.pidStateMaxSize : 0;
+    stats.pidTableBytes = m_pidTableBytes.Get();
+    stats.eventQueueBytes = m_eventQueueBytes.Get();
+    stats.recorderBytes = m_recorderBytes.Get();
+    stats.entropyTableBytes = m_entropyTableBytes.Get();
+    stats.entropySamples = m_entropySamples.Get();
+    stats.highEntropySamples = m_highEntropySamples.Get();
+    stats.entropyDropped = m_entropy ? m_entropy->Dropped() : 0;
+    stats.trackedGroups = m_trackedGroups.Get();
+    stats.groupDetections = m_groupDetections.Get();
+    stats.groupTableBytes = m_groupTableBytes.Get();
+    stats.processCacheBytes = m_processCacheBytes.Get();
+    stats.processCacheHits = m_processTree.Hits();
+    stats.processCacheMisses = m_processTree.Misses();
+    stats.ignoreMarks = m_ignoreMarkCount.Get();
+    stats.canaries = m_canaryCount.Get();
+    stats.canaryHits = m_canaryHits.Get();
+    stats.ignoreMarksInstalled = m_ignoreMarksInstalled.Get();
+    stats.loopTime = m_loopTime.Take();
+    stats.permissionLatency = PermissionLatency();
+    if (m_backup)
+        m_backup->AddStats(stats);
+
+    return stats;
+}
+
+void EncryptorDetector::ReportLatency()
+{
+    if (m_config.latencyReportPeriod <= 0)
+        return ;
+
+    auto now = clock::now();
+    if (now - m_lastLatencyReport < std::chrono::seconds(m_config.latencyReportPeriod))
+        return ;
+    m_lastLatencyReport = now;
+
+    auto total = PermissionLatency();
+    auto window = total;
+    window -= m_reportedLatency;
+    m_reportedLatency = total;
+
+    if (window.Count() == 0)
+        return ;
+
+    std::stringstream ss;
+    ss << "Permission latency (us): events = " << window.Count() << ", p50 = " << window.Percentile(0.5) / 1000.0
+        << ", p99 = " << window.Percentile(0.99) / 1000.0 << ", p999 = " << window.Percentile(0.999) / 1000.0
+        << ", max = " << window.Max() / 1000.0;
+    TRACE(m_tracer, std::move(ss.str()));
+}
+
+void EncryptorDetector::DumpProfile()
+{
+    if (!g_isProfileRequested)
+        return ;
+    g_isProfileRequested = 0;
+
+    StageScope stage(m_profiler, STAGE_TRACE);
+    TRACE(m_tracer, "Stage profile since start:");
+    for (auto& line : m_profiler.Dump())
+        TRACE(m_tracer, line);
 }
 
 void EncryptorDetector::Launch()
@@ -173,13 +1379,52 @@ void EncryptorDetector::Launch()
 #endif
 
     // set up main loop
-    while (m_fanotify.WaitForEvent())
+    m_profiler.Enter(STAGE_WAIT);
+    while (m_source->WaitForEvent())
     {
+        m_profiler.Leave();
+
+        // waiting is not a part of the iteration
+        auto start = clock::now();
+
         CheckForOutdatedEvents();
         ProcessEvents();
         CheckForSuspiciousPids();
+        CheckMemoryBudget();
+        if (m_config.ignoreHotEvents > 0)
+            CheckIgnoreMarks();
+
+        m_profiler.Enter(STAGE_TRACE);
+        ReportLatency();
+        if (m_recorder)
+            m_recorder->Flush();
+        m_profiler.Leave();
+
+        DumpProfile();
+
+        m_loopTime.Record(std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count());
+        m_profiler.Enter(STAGE_WAIT);
     }
+    m_profiler.Leave();
 
     TRACE(m_tracer, "Finishing the program...");
 }
 
+EncryptorDetector::~EncryptorDetector()
+{
+    // Launch() may be left by an exception of the event source, frozen pids are thawed here on any exit
+    for (auto& [pid, frozen] : m_frozenPids)
+    {
+        m_source->Thaw(pid, frozen.pidfd, frozen.group);
+        if (frozen.pidfd >= 0)
+            close(frozen.pidfd);
+        std::stringstream ss;
+        ss << "Frozen pid = " << pid << " has been thawed on exit";
+        TRACE(m_tracer, std::move(ss.str()));
+    }
+    m_frozenPids.clear();
+
+    for (auto& [id, mark] : m_ignoreMarks)
+        close(mark.fd);
+}
+
@@ -0,0 +1,163 @@
+#include <fanotify/entropy_sampler.h>
+
+// c includes
+#include <sys/stat.h>
+#include <unistd.h>
+
+// c++ includes
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace fn
+{
+
+double ShannonEntropy(const uint8_t* data, size_t size)
+{
+    if (size == 0)
+        return 0;
+
+    uint32_t tables[4][256] = {};
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        tables[0][word & 0xff]++;
+        tables[1][(word >> 8) & 0xff]++;
+        tables[2][(word >> 16) & 0xff]++;
+        tables[3][(word >> 24) & 0xff]++;
+        tables[0][(word >> 32) & 0xff]++;
+        tables[1][(word >> 40) & 0xff]++;
+        tables[2][(word >> 48) & 0xff]++;
+        tables[3][word >> 56]++;
+    }
+    for (; i < size; ++i)
+        tables[0][data[i]]++;
+
+    // H = log2(n) - sum(c * log2(c)) / n
+    double sum = 0;
+    for (size_t value = 0; value < 256; ++value)
+    {
+        uint32_t count = tables[0][value] + tables[1][value] + tables[2][value] + tables[3][value];
+        if (count)
+            sum += count * std::log2(static_cast<double>(count));
+    }
+
+    return std::log2(static_cast<double>(size)) - sum / size;
+}
+
+EntropySampler::EntropySampler(EventSource& source, size_t threads, size_t pages, size_t maxQueue) :
+    m_source(source),
+    m_pages(std::max<size_t>(pages, 1)),
+    m_maxQueue(maxQueue),
+    m_tasks(),
+    m_results(),
+    m_mutex(),
+    m_condition(),
+    m_stop(false),
+    m_threads()
+{
+    for (size_t i = 0; i < threads; ++i)
+        m_threads.emplace_back(&EntropySampler::Run, this);
+}
+
+bool EntropySampler::Submit(const fanotify_event_metadata& event)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_tasks.size() >= m_maxQueue)
+        {
+            m_dropped.Add();
+            return false;
+        }
+        m_tasks.push(event);
+    }
+
+    m_condition.notify_one();
+    return true;
+}
+
+std::vector<EntropySample> EntropySampler::TakeResults()
+{
+    std::vector<EntropySample> results;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    results.swap(m_results);
+    return results;
+}
+
+bool EntropySampler::Sample(const fanotify_event_metadata& event, std::vector<uint8_t>& buffer, double& entropy)
+{
+    int fd = m_source.GetContentFd(event);
+    if (fd < 0)
+        return false;
+
+    struct stat st = {};
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) < m_minFileSize)
+        return false;
+
+    // pages are spread evenly from the beginning to the end of the file
+    size_t size = st.st_size;
+    size_t pages = std::min(m_pages, (size + m_pageSize - 1) / m_pageSize);
+    size_t lastPage = size > m_pageSize ? (size - m_pageSize) / m_pageSize : 0;
+
+    entropy = 0;
+    bool isSampled = false;
+    for (size_t i = 0; i < pages; ++i)
+    {
+        size_t page = pages > 1 ? lastPage * i / (pages - 1) : 0;
+        auto bytes = pread(fd, buffer.data(), buffer.size(), page * m_pageSize);
+        if (bytes < static_cast<ssize_t>(m_minFileSize))
+            continue ;
+
+        entropy = std::max(entropy, ShannonEntropy(buffer.data(), bytes));
+        isSampled = true;
+    }
+
+    return isSampled;
+}
+
+void EntropySampler::Run()
+{
+    std::vector<uint8_t> buffer(m_pageSize);
+    while (true)
+    {
+        fanotify_event_metadata event;
+        bool isStopped = false;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_condition.wait(lock, [this]{ return m_stop || !m_tasks.empty(); });
+            if (m_tasks.empty())
+                return ;
+
+            event = m_tasks.front();
+            m_tasks.pop();
+            isStopped = m_stop;
+        }
+
+        // on shutdown pending events are just released
+        double entropy = 0;
+        bool isSampled = !isStopped && Sample(event, buffer, entropy);
+        m_source.Release(event);
+
+        if (isSampled)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_results.push_back({event.pid, entropy});
+        }
+    }
+}
+
+EntropySampler::~EntropySampler()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    m_condition.notify_all();
+    for (auto& thread : m_threads)
+        thread.join();
+}
+
+}
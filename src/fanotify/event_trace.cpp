@@ -0,0 +1,188 @@
+#include <fanotify/event_trace.h>
+#include <fanotify/fanotify_helpers.h>
+
+// c++ includes
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+using namespace fn;
+
+constexpr size_t g_traceBufferSize = 1 << 20;
+// node of unordered container: next pointer and cached hash, plus a bucket pointer
+constexpr size_t g_hashNodeBytes = 3 * sizeof(void*);
+
+EventTraceWriter::EventTraceWriter(const std::string& path) :
+    m_file(fopen(path.c_str(), "wb")),
+    m_buffer(g_traceBufferSize),
+    m_start(clock::now()),
+    m_tableBytes(0)
+{
+    if (!m_file)
+        throw std::runtime_error("Can't open event trace file");
+
+    setvbuf(m_file, m_buffer.data(), _IOFBF, m_buffer.size());
+
+    int64_t startWallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+    Write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+    Write(TRACE_VERSION);
+    Write(startWallNs);
+    Flush();
+}
+
+void EventTraceWriter::Write(const void* data, size_t size)
+{
+    if (fwrite(data, 1, size, m_file) != size)
+        throw std::runtime_error("Can't write to event trace file");
+}
+
+void EventTraceWriter::Record(std::chrono::time_point<clock> time, uint64_t mask, int32_t pid, const std::string& path)
+{
+    auto [pathIt, isNewPath] = m_pathIds.try_emplace(path, m_pathIds.size());
+    if (isNewPath)
+    {
+        m_tableBytes += g_hashNodeBytes + sizeof(std::pair<const std::string, uint32_t>) + path.capacity();
+        Write(TRACE_PATH);
+        Write(pathIt->second);
+        Write((uint32_t) path.size());
+        Write(path.data(), path.size());
+    }
+
+    if (m_knownPids.insert(pid).second)
+    {
+        m_tableBytes += g_hashNodeBytes + sizeof(int32_t);
+        // executable is needed for white list on replay, the process might be gone by then
+        std::string execName;
+        try
+        {
+            execName = GetFilenameByPid(pid);
+        }
+        catch (const std::runtime_error&)
+        {
+            // process has already exited, leave it empty
+        }
+
+        Write(TRACE_PROC);
+        Write(pid);
+        Write((uint32_t) execName.size());
+        Write(execName.data(), execName.size());
+    }
+
+    uint64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(time - m_start).count();
+    Write(TRACE_EVENT);
+    Write(timeNs);
+    Write(mask);
+    Write(pid);
+    Write(pathIt->second);
+}
+
+void EventTraceWriter::Flush()
+{
+    fflush(m_file);
+}
+
+EventTraceWriter::~EventTraceWriter()
+{
+    fclose(m_file);
+}
+
+/*
+    Cursor over the loaded trace. Reads return false on the truncated tail,
+    which happens when detector is killed in the middle of the write
+*/
+class TraceCursor
+{
+    const std::vector<char>& m_data;
+    size_t m_offset;
+public:
+    TraceCursor(const std::vector<char>& data) : m_data(data), m_offset(0) {}
+
+    bool Read(void* value, size_t size)
+    {
+        if (m_data.size() - m_offset < size)
+            return false;
+
+        std::memcpy(value, m_data.data() + m_offset, size);
+        m_offset += size;
+        return true;
+    }
+
+    template <typename T>
+    bool Read(T& value)
+    {
+        return Read(&value, sizeof(value));
+    }
+
+    bool Read(std::string& value)
+    {
+        uint32_t size;
+        if (!Read(size))
+            return false;
+
+        value.resize(size);
+        return Read(value.data(), size);
+    }
+};
+
+EventTrace fn::ReadEventTrace(const std::string& path)
+{
+    std::ifstream fileStream(path, std::ios::binary);
+    if (!fileStream)
+        throw std::runtime_error("Can't open event trace file");
+
+    std::vector<char> data((std::istreambuf_iterator<char>(fileStream)), std::istreambuf_iterator<char>());
+    TraceCursor cursor(data);
+
+    char magic[sizeof(TRACE_MAGIC)];
+    uint32_t version;
+    EventTrace trace{};
+    if (!cursor.Read(magic, sizeof(magic)) || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 ||
+        !cursor.Read(version) || !cursor.Read(trace.startWallNs))
+        throw std::runtime_error("Not an event trace file");
+
+    if (version != TRACE_VERSION)
+        throw std::runtime_error("Unsupported event trace version");
+
+    uint8_t tag;
+    while (cursor.Read(tag))
+    {
+        if (tag == TRACE_PATH)
+        {
+            uint32_t id;
+            std::string path;
+            if (!cursor.Read(id) || !cursor.Read(path))
+                break;
+
+            if (id != trace.paths.size())
+                throw std::runtime_error("Malformed event trace: unexpected path id");
+            trace.paths.push_back(std::move(path));
+        }
+        else if (tag == TRACE_PROC)
+        {
+            int32_t pid;
+            std::string execName;
+            if (!cursor.Read(pid) || !cursor.Read(execName))
+                break;
+
+            // pid might be reused, keep the latest executable
+            trace.executables[pid] = std::move(execName);
+        }
+        else if (tag == TRACE_EVENT)
+        {
+            TraceEvent event;
+            if (!cursor.Read(event.timeNs) || !cursor.Read(event.mask) ||
+                !cursor.Read(event.pid) || !cursor.Read(event.pathId))
+                break;
+
+            if (event.pathId >= trace.paths.size())
+                throw std::runtime_error("Malformed event trace: unknown path id");
+            trace.events.push_back(event);
+        }
+        else
+            throw std::runtime_error("Malformed event trace: unknown record");
+    }
+
+    return trace;
+}
@@ -1,13 +1,29 @@
 #include <fanotify/fanotify_helpers.h>
 
 // c++ include
+#include <fstream>
 #include <sstream>
 #include <stdexcept>
 
 // c include
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+// system call numbers are common for all architectures, but old headers don't have them
+#ifndef SYS_pidfd_send_signal
+#define SYS_pidfd_send_signal 424
+#endif
+#ifndef SYS_pidfd_open
+#define SYS_pidfd_open 434
+#endif
+
 namespace fn
 {
 
@@ -28,6 +44,14 @@ EventType FanotifyEventToIdx(size_t type)
         case FAN_CLOSE_NOWRITE:
         case FAN_CLOSE_WRITE:
             return EVENT_CLOSE;
+        // rename is counted once, by its source, the new name appears in the target like a created file
+        case FAN_CREATE:
+        case FAN_MOVED_TO:
+            return EVENT_CREATE;
+        case FAN_DELETE:
+            return EVENT_DELETE;
+        case FAN_MOVED_FROM:
+            return EVENT_RENAME;
         default:
             return EVENT_COUNT; // error
     }
@@ -53,6 +77,14 @@ std::string StringizeEventType(size_t type)
             return "FAN_CLOSE_NOWRITE";
         case FAN_CLOSE_WRITE:
             return "FAN_CLOSE_WRITE";
+        case FAN_CREATE:
+            return "FAN_CREATE";
+        case FAN_DELETE:
+            return "FAN_DELETE";
+        case FAN_MOVED_FROM:
+            return "FAN_MOVED_FROM";
+        case FAN_MOVED_TO:
+            return "FAN_MOVED_TO";
         default:
             return "";
     }
@@ -116,6 +148,14 @@ ssize_t StringToMarkFlag(const std::string& str)
         return FAN_CLOSE_WRITE;
     if (str == "FAN_OPEN_EXEC")
         return FAN_OPEN_EXEC;
+    if (str == "FAN_CREATE")
+        return FAN_CREATE;
+    if (str == "FAN_DELETE")
+        return FAN_DELETE;
+    if (str == "FAN_MOVED_FROM")
+        return FAN_MOVED_FROM;
+    if (str == "FAN_MOVED_TO")
+        return FAN_MOVED_TO;
     
     return -1;
 }
@@ -139,6 +179,175 @@ std::string GetFilenameByFd(int fd)
     return fileName;
 }
 
+bool ReadProcessStat(int pid, ProcessStat& stat)
+{
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    FILE* file = fopen(path, "re");
+    if (!file)
+        return false;
+
+    char buffer[1024];
+    size_t size = fread(buffer, 1, sizeof(buffer) - 1, file);
+    fclose(file);
+    buffer[size] = '\0';
+
+    // command name is in parentheses and might contain spaces and parentheses itself
+    char* fields = strrchr(buffer, ')');
+    if (!fields)
+        return false;
+
+    // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime cutime cstime
+    // priority nice num_threads itrealvalue starttime
+    unsigned long long startTime = 0;
+    int parsed = sscanf(fields + 1, " %*c %d %d %d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %llu",
+        &stat.ppid, &stat.pgid, &stat.sid, &startTime);
+    if (parsed != 4)
+        return false;
+
+    stat.startTime = startTime;
+    return true;
+}
+
+bool ReadProcessCgroup(int pid, std::string& cgroup)
+{
+    std::ifstream file("/proc/" + std::to_string(pid) + "/cgroup");
+    if (!file)
+        return false;
+
+    // every line is "hierarchy-ID:controller-list:cgroup-path", the unified hierarchy has ID 0 and no controllers,
+    // on hybrid systems processes usually stay in its root and only v1 hierarchies tell containers apart
+    cgroup.clear();
+    std::string line;
+    std::string v1Cgroup;
+    while (std::getline(file, line))
+    {
+        auto first = line.find(':');
+        auto second = first == std::string::npos ? first : line.find(':', first + 1);
+        if (second == std::string::npos)
+            continue ;
+
+        auto path = line.substr(second + 1);
+        if (line.compare(0, second + 1, "0::") == 0)
+            cgroup = path;
+        else if (v1Cgroup.empty() || v1Cgroup == "/")
+            v1Cgroup = path;
+    }
+
+    if (cgroup.empty() || (cgroup == "/" && !v1Cgroup.empty()))
+        cgroup = v1Cgroup;
+
+    return !cgroup.empty();
+}
+
+// start time of the process is counted in clock ticks since boot (CLOCK_BOOTTIME),
+// steady clock is CLOCK_MONOTONIC that doesn't count time in suspend
+static bool IsStartedBefore(uint64_t startTime, std::chrono::steady_clock::time_point time)
+{
+    timespec monotonic = {};
+    timespec boot = {};
+    clock_gettime(CLOCK_MONOTONIC, &monotonic);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+    int64_t suspendedNs = (boot.tv_sec - monotonic.tv_sec) * 1000000000LL + (boot.tv_nsec - monotonic.tv_nsec);
+
+    static const int64_t tickNs = 1000000000LL / sysconf(_SC_CLK_TCK);
+    int64_t timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count() + suspendedNs;
+    return static_cast<int64_t>(startTime) * tickNs <= timeNs;
+}
+
+int64_t StartTimeToUnix(uint64_t startTime)
+{
+    timespec real = {};
+    timespec boot = {};
+    clock_gettime(CLOCK_REALTIME, &real);
+    clock_gettime(CLOCK_BOOTTIME, &boot);
+
+    static const int64_t tickNs = 1000000000LL / sysconf(_SC_CLK_TCK);
+    int64_t sinceStartNs = boot.tv_sec * 1000000000LL + boot.tv_nsec - static_cast<int64_t>(startTime) * tickNs;
+    return (real.tv_sec * 1000000000LL + real.tv_nsec - sinceStartNs) / 1000000000LL;
+}
+
+bool PinProcess(int pid, std::chrono::steady_clock::time_point seen, int& pidfd)
+{
+    // pidfd isn't available on old kernels (ENOSYS) and might be forbidden by seccomp, signals go by pid then
+    pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0));
+    if (pidfd < 0 && errno == ESRCH)
+        return false;
+
+    // stat is read after pidfd is open: if the pid is reused later, pidfd still refers to the exited process
+    ProcessStat stat;
+    if (ReadProcessStat(pid, stat) && IsStartedBefore(stat.startTime, seen))
+        return true;
+
+    if (pidfd >= 0)
+        close(pidfd);
+    pidfd = -1;
+    return false;
+}
+
+bool SignalProcess(int pid, int pidfd, int sig)
+{
+    if (pidfd >= 0)
+        return syscall(SYS_pidfd_send_signal, pidfd, sig, nullptr, 0) == 0;
+
+    return kill(pid, sig) == 0;
+}
+
+int GetSignalableGroup(int pid)
+{
+    ProcessStat stat;
+    if (!ReadProcessStat(pid, stat) || stat.pgid <= 1 || stat.pgid == getpgrp())
+        return 0;
+
+    // the process leads its group itself, or it is a job of a shell with job control
+    if (stat.pgid == pid || stat.pgid != stat.sid)
+        return stat.pgid;
+
+    return 0;
+}
+
+bool SignalProcessGroup(int pid, int pidfd, int pgid, int sig)
+{
+    if (!SignalProcess(pid, pidfd, 0))
+        return false;
+
+    return kill(-pgid, sig) == 0;
+}
+
+std::vector<int> GetGroupMembers(int pgid)
+{
+    std::vector<int> members;
+    DIR* proc = opendir("/proc");
+    if (!proc)
+        return members;
+
+    while (auto entry = readdir(proc))
+    {
+        char* end = nullptr;
+        long pid = std::strtol(entry->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0)
+            continue ; // not a process
+
+        ProcessStat stat;
+        if (ReadProcessStat(pid, stat) && stat.pgid == pgid)
+            members.push_back(pid);
+    }
+
+    closedir(proc);
+    return members;
+}
+
+void SignalGroupMembers(int pgid, const std::vector<int>& members, int sig)
+{
+    for (auto member : members)
+    {
+        ProcessStat stat;
+        if (ReadProcessStat(member, stat) && stat.pgid == pgid)
+            kill(member, sig);
+    }
+}
+
 std::string GetFilenameByPid(int pid)
 {
     std::stringstream filePath;
@@ -0,0 +1,120 @@
+#include <fanotify/detector.h>
+#include <fanotify/replay_source.h>
+
+// c++ includes
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+
+using namespace fn;
+
+/*
+    Replay of the recorded event trace (see "record_path" in config) through the detector.
+    Thresholds are taken from the config and can be overriden to tune them on the same recording.
+*/
+
+struct ReplayOptions
+{
+    std::string tracePath;
+    bool isPaced = false;
+    int64_t reads = -1;
+    int64_t writes = -1;
+    int64_t lifetimeMs = -1;
+};
+
+static void PrintUsage()
+{
+    std::cerr << "Usage: ./fanotify_replay <trace> [--paced] [--read-suspect <n>] [--write-suspect <n>] [--lifetime-ms <ms>]" << std::endl;
+}
+
+static bool ParseOptions(int argc, char* argv[], ReplayOptions& options)
+{
+    if (argc < 2)
+        return false;
+
+    options.tracePath = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (option == "--paced")
+        {
+            options.isPaced = true;
+            continue ;
+        }
+
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+        if (option == "--read-suspect")
+            options.reads = std::atoll(value);
+        else if (option == "--write-suspect")
+            options.writes = std::atoll(value);
+        else if (option == "--lifetime-ms")
+            options.lifetimeMs = std::atoll(value);
+        else
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    ReplayOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    try
+    {
+        Config cfg = GetConfig();
+        cfg.logPath = "/dev/null";
+        cfg.backupPaths.clear();
+        cfg.recordPath.clear();
+        if (options.reads >= 0)
+            cfg.fileIOSuspect.reads = options.reads;
+        if (options.writes >= 0)
+            cfg.fileIOSuspect.writes = options.writes;
+        if (options.lifetimeMs >= 0)
+            cfg.fileIOMaxAge = options.lifetimeMs;
+
+        auto trace = ReadEventTrace(options.tracePath);
+        uint64_t recordedNs = trace.events.empty() ? 0 : trace.events.back().timeNs;
+
+        auto source = std::make_unique<ReplaySource>(std::move(trace), options.isPaced);
+        auto& sourceRef = *source;
+        EncryptorDetector detector(std::move(source), "/", cfg);
+
+        auto start = std::chrono::steady_clock::now();
+        detector.Launch();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "thresholds: reads = " << cfg.fileIOSuspect.reads << ", writes = " << cfg.fileIOSuspect.writes
+            << ", lifetime = " << cfg.fileIOMaxAge << " ms" << std::endl;
+        std::cout << "replayed " << sourceRef.Replayed() << " events (" << std::fixed << std::setprecision(3)
+            << recordedNs / 1e9 << " s recorded) in " << seconds << " s, "
+            << std::setprecision(0) << sourceRef.Replayed() / seconds << " events/s, "
+            << sourceRef.Dropped() << " events of killed pids dropped" << std::endl;
+
+        auto& decisions = sourceRef.Decisions();
+        std::cout << decisions.size() << " detection decisions" << std::endl;
+        for (auto& decision : decisions)
+        {
+            std::cout << "  pid = " << decision.pid << " (" << (decision.executable.empty() ? "?" : decision.executable)
+                << "), time to detect = " << std::setprecision(3) << decision.timeToDetectNs / 1e6 << " ms, events = "
+                << decision.events << std::endl;
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception from replay: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
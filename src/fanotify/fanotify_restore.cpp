@@ -0,0 +1,180 @@
+#include <fanotify/config.h>
+#include <sqlite/backup_store.h>
+
+// c includes
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// c++ includes
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+using namespace fn;
+
+struct RestoreOptions
+{
+    int pid = -1;
+    int64_t since = -1;
+    int64_t until = INT64_MAX;
+    unsigned threads = std::thread::hardware_concurrency();
+};
+
+static void PrintUsage()
+{
+    std::cerr << "Usage: ./fanotify_restore (--pid <pid> | --since <unix time> [--until <unix time>]) [--threads <n>]" << std::endl;
+}
+
+static bool ParseOptions(int argc, char* argv[], RestoreOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string option = argv[i];
+        if (i + 1 >= argc)
+            return false;
+
+        const char* value = argv[++i];
+        if (option == "--pid")
+            options.pid = std::atoi(value);
+        else if (option == "--since")
+            options.since = std::atoll(value);
+        else if (option == "--until")
+            options.until = std::atoll(value);
+        else if (option == "--threads")
+            options.threads = std::atoi(value);
+        else
+            return false;
+    }
+
+    // exactly one of selectors must be chosen
+    if ((options.pid < 0) == (options.since < 0))
+        return false;
+
+    if (options.threads == 0)
+        options.threads = 1;
+
+    return true;
+}
+
+/*
+    Restore one file: content is written to the temporary file in the same directory,
+    which then replaces the original file with rename(), so the file is never seen half-restored.
+    Returns amount of restored bytes.
+*/
+static off_t RestoreFile(sqlite::BackupStore& store, const std::string& path)
+{
+    std::string tmpPath = path + ".restore.XXXXXX";
+    int fd = mkstemp(tmpPath.data());
+    if (fd < 0)
+        throw std::runtime_error(std::string("Can't create temporary file: ") + strerror(errno));
+
+    struct stat st = {};
+    try
+    {
+        store.RestoreFile(path.c_str(), fd);
+
+        // keep access mode of the current file, if it still exists
+        struct stat original = {};
+        fchmod(fd, stat(path.c_str(), &original) == 0 ? original.st_mode & 07777 : 0644);
+
+        if (fsync(fd) < 0 || fstat(fd, &st) < 0)
+            throw std::runtime_error(std::string("Can't flush restored file: ") + strerror(errno));
+    }
+    catch (...)
+    {
+        close(fd);
+        unlink(tmpPath.c_str());
+        throw;
+    }
+
+    close(fd);
+    if (rename(tmpPath.c_str(), path.c_str()) < 0)
+    {
+        unlink(tmpPath.c_str());
+        throw std::runtime_error(std::string("Can't replace file: ") + strerror(errno));
+    }
+
+    return st.st_size;
+}
+
+int main(int argc, char* argv[])
+{
+    RestoreOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    try
+    {
+        Config cfg = GetConfig();
+        if (access(cfg.backupDbPath.c_str(), F_OK) < 0)
+            throw std::runtime_error("Can't find backup database: " + cfg.backupDbPath);
+
+        // every worker has its own connection to the database
+        std::vector<std::unique_ptr<sqlite::BackupStore>> stores;
+        for (unsigned i = 0; i < options.threads; ++i)
+            stores.push_back(sqlite::OpenBackupStore(cfg.backupDbPath, cfg.backupDir));
+
+        auto files = (options.pid >= 0) ? stores[0]->GetFilesFromPid(options.pid) :
+            stores[0]->GetFilesFromTime(options.since, options.until);
+
+        std::atomic<size_t> nextFile = 0;
+        std::atomic<size_t> restoredFiles = 0;
+        std::atomic<uint64_t> restoredBytes = 0;
+        std::mutex errorMutex;
+
+        auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < options.threads; ++i)
+        {
+            workers.emplace_back([&, i]
+            {
+                size_t idx = 0;
+                while ((idx = nextFile++) < files.size())
+                {
+                    try
+                    {
+                        restoredBytes += RestoreFile(*stores[i], files[idx]);
+                        restoredFiles++;
+                    }
+                    catch (const std::exception& e)
+                    {
+                        std::lock_guard<std::mutex> lock(errorMutex);
+                        std::cerr << "Failed to restore " << files[idx] << ": " << e.what() << std::endl;
+                    }
+                }
+            });
+        }
+
+        for (auto& worker : workers)
+            worker.join();
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        double megabytes = restoredBytes / (1024.0 * 1024.0);
+
+        std::cout << "Restored " << restoredFiles << "/" << files.size() << " files, "
+            << megabytes << " MiB in " << seconds << " s with " << options.threads << " threads" << std::endl;
+        if (seconds > 0)
+            std::cout << "Throughput: " << restoredFiles / seconds << " files/s, " << megabytes / seconds << " MiB/s" << std::endl;
+
+        if (restoredFiles != files.size())
+            return -1;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception while restoring: " << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
@@ -1,15 +1,23 @@
 #include <fanotify/fanotify_wrapper.h>
+#include <fanotify/fanotify_helpers.h>
 
 #include <poll.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <string_view>
 
 using namespace fn;
 
 FanotifyWrapper::FanotifyWrapper(unsigned flags, unsigned event_f_flags) :
     m_fds(),
-    m_notificationGroupFd(fanotify_init(flags, event_f_flags))
+    m_notificationGroupFd(fanotify_init(flags, event_f_flags)),
+    m_waitTimeoutMs(-1),
+    m_isReadable(false),
+    m_directoryGroupFd(-1),
+    m_isDirectoryReadable(false),
+    m_mountFds(),
+    m_directoryCache()
 {
     if (m_notificationGroupFd < 0)
         throw std::runtime_error("fanotify_init error");
@@ -21,6 +29,9 @@ FanotifyWrapper::FanotifyWrapper(unsigned flags, unsigned event_f_flags) :
 
     m_fds[FANOTIFY_FD_IDX].fd = m_notificationGroupFd;
     m_fds[FANOTIFY_FD_IDX].events = POLLIN;
+
+    m_fds[DIRECTORY_FD_IDX].fd = -1;
+    m_fds[DIRECTORY_FD_IDX].events = POLLIN;
 }
 
 void FanotifyWrapper::Mark(unsigned flags, uint64_t mask, int dfd, const std::string& pathName)
@@ -33,11 +44,19 @@ bool FanotifyWrapper::WaitForEvent()
 {
     while (true)
     {
-        auto pollNum = poll(m_fds, NFDS, -1);
+        auto pollNum = poll(m_fds, NFDS, m_waitTimeoutMs);
         
         if (pollNum < 0 && errno != EINTR)
             throw std::runtime_error("poll error");
 
+        if (pollNum <= 0)
+        {
+            // timeout or signal, let the caller do its periodic work
+            m_isReadable = false;
+            m_isDirectoryReadable = false;
+            return true;
+        }
+
         if (pollNum > 0)
         {
         #ifndef DAEMON_FANOTIFY
@@ -50,10 +69,10 @@ bool FanotifyWrapper::WaitForEvent()
                 return false; // end
             }
         #endif
-            if (m_fds[FANOTIFY_FD_IDX].revents & POLLIN)
-            {
+            m_isReadable = m_fds[FANOTIFY_FD_IDX].revents & POLLIN;
+            m_isDirectoryReadable = m_fds[DIRECTORY_FD_IDX].revents & POLLIN;
+            if (m_isReadable || m_isDirectoryReadable)
                 return true;
-            }
         }
     }
 
@@ -81,7 +100,144 @@ void FanotifyWrapper::ResponseDeny(const fanotify_event_metadata& metadata) cons
     Response(metadata, FAN_DENY);
 }
 
+void FanotifyWrapper::SetWaitTimeout(int timeoutMs)
+{
+    m_waitTimeoutMs = timeoutMs;
+}
+
 EventContainer FanotifyWrapper::GetEvents()
 {
+    // wait timed out, don't block on read if notification group is not opened with FAN_NONBLOCK
+    if (!m_isReadable)
+        return EventContainer(nullptr, 0);
+
     return EventContainer(m_notificationGroupFd);
 }
+
+static uint64_t FsidKey(const void* fsid)
+{
+    uint64_t key = 0;
+    std::memcpy(&key, fsid, sizeof(key));
+    return key;
+}
+
+void FanotifyWrapper::MarkDirectories(uint64_t mask, const std::string& pathName)
+{
+    if (m_directoryGroupFd < 0)
+    {
+        m_directoryGroupFd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_CLOEXEC | FAN_NONBLOCK,
+            O_RDONLY | O_LARGEFILE);
+        if (m_directoryGroupFd < 0)
+            throw std::runtime_error("fanotify_init error: directory events need FAN_REPORT_DFID_NAME");
+        m_fds[DIRECTORY_FD_IDX].fd = m_directoryGroupFd;
+    }
+
+    // mark is added last, so a failure doesn't leave it without a mount fd to resolve handles with
+    int mountFd = open(pathName.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct statfs stat = {};
+    if (mountFd < 0 || fstatfs(mountFd, &stat) < 0)
+    {
+        if (mountFd >= 0)
+            close(mountFd);
+        throw std::runtime_error("Can't open marked directory");
+    }
+
+    if (fanotify_mark(m_directoryGroupFd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, AT_FDCWD, pathName.c_str()) < 0)
+    {
+        close(mountFd);
+        throw std::runtime_error("fanotify_mark error: filesystem doesn't support directory events");
+    }
+
+    // fsid is the same as in events of this filesystem
+    auto [it, isNew] = m_mountFds.try_emplace(FsidKey(&stat.f_fsid), mountFd);
+    if (!isNew)
+        close(mountFd);
+}
+
+std::string FanotifyWrapper::ResolveDirectory(const DirEntryInfo& info)
+{
+    std::string key(reinterpret_cast<const char*>(&info.fsid), sizeof(info.fsid));
+    key.append(reinterpret_cast<const char*>(info.handle), sizeof(file_handle) + info.handle->handle_bytes);
+
+    auto now = clock::now();
+    auto it = m_directoryCache.find(key);
+    if (it != m_directoryCache.end() && now - it->second.loaded < m_directoryMaxAge)
+        return it->second.path;
+
+    std::string path;
+    auto mount = m_mountFds.find(FsidKey(&info.fsid));
+    if (mount != m_mountFds.end())
+    {
+        // handle is only read by the kernel
+        int fd = open_by_handle_at(mount->second, const_cast<file_handle*>(info.handle), O_PATH | O_CLOEXEC);
+        if (fd >= 0)
+        {
+            try
+            {
+                path = GetFilenameByFd(fd);
+            }
+            catch (const std::runtime_error&)
+            {
+                // link can't be read, only the name is known
+            }
+            close(fd);
+
+            // readlink of a deleted directory succeeds with a suffix, its path doesn't exist anymore
+            static constexpr std::string_view deletedSuffix = " (deleted)";
+            if (path.size() >= deletedSuffix.size() &&
+                path.compare(path.size() - deletedSuffix.size(), deletedSuffix.size(), deletedSuffix) == 0)
+                path.clear();
+        }
+    }
+
+    if (m_directoryCache.size() >= m_maxCachedDirectories)
+        m_directoryCache.clear();
+    m_directoryCache[std::move(key)] = {path, now};
+    return path;
+}
+
+std::vector<DirectoryEvent> FanotifyWrapper::GetDirectoryEvents()
+{
+    std::vector<DirectoryEvent> events;
+    if (!m_isDirectoryReadable)
+        return events;
+
+    EventContainer container(m_directoryGroupFd);
+    if (container.IsEmpty())
+        return events;
+
+    for (auto& event : container)
+    {
+        // there is no fd to close, directory events carry handles instead
+        DirEntryInfo info;
+        if (event.mask & FAN_Q_OVERFLOW)
+            events.push_back({event.mask, event.pid, ""});
+        else if (GetDirEntryInfo(event, info))
+            events.push_back({event.mask, event.pid, ResolveDirectory(info) + "/" + info.name});
+    }
+
+    return events;
+}
+
+std::string FanotifyWrapper::GetPath(const fanotify_event_metadata& metadata)
+{
+    return GetFilenameByFd(metadata.fd);
+}
+
+int FanotifyWrapper::GetContentFd(const fanotify_event_metadata& metadata)
+{
+    return metadata.fd;
+}
+
+void FanotifyWrapper::Release(const fanotify_event_metadata& metadata)
+{
+    close(metadata.fd);
+}
+
+FanotifyWrapper::~FanotifyWrapper()
+{
+    for (auto& [fsid, fd] : m_mountFds)
+        close(fd);
+    if (m_directoryGroupFd >= 0)
+        close(m_directoryGroupFd);
+}
@@ -0,0 +1,100 @@
+#include <fanotify/process_tree.h>
+
+using namespace fn;
+
+// node of unordered_map: next pointer, cached hash and a bucket
+constexpr size_t g_hashNodeBytes = 3 * sizeof(void*);
+
+ProcessTree::ProcessTree(EventSource& source) :
+    m_source(source),
+    m_cache(),
+    m_lastSweep(),
+    m_cgroupBytes(0),
+    m_hits(),
+    m_misses()
+{}
+
+ProcessTree::Entry& ProcessTree::Lookup(int pid)
+{
+    auto now = m_source.Now();
+    auto [it, isNew] = m_cache.try_emplace(pid);
+    auto& entry = it->second;
+    if (!isNew && now - entry.loaded < m_maxAge)
+    {
+        m_hits.Add();
+        return entry;
+    }
+
+    // processes that don't exist are cached too, so events of exited process don't read /proc again
+    m_misses.Add();
+    entry.isAlive = m_source.GetProcessStat(pid, entry.stat);
+    entry.loaded = now;
+    entry.isCgroupLoaded = false;
+    m_cgroupBytes -= entry.cgroup.size();
+    entry.cgroup.clear();
+    return entry;
+}
+
+const ProcessStat* ProcessTree::Get(int pid)
+{
+    auto& entry = Lookup(pid);
+    return entry.isAlive ? &entry.stat : nullptr;
+}
+
+const std::string* ProcessTree::Cgroup(int pid)
+{
+    auto& entry = Lookup(pid);
+    if (!entry.isAlive)
+        return nullptr;
+
+    if (!entry.isCgroupLoaded)
+    {
+        entry.isCgroupLoaded = true;
+        m_source.GetCgroup(pid, entry.cgroup);
+        m_cgroupBytes += entry.cgroup.size();
+    }
+
+    return entry.cgroup.empty() ? nullptr : &entry.cgroup;
+}
+
+std::vector<int> ProcessTree::Ancestors(int pid, unsigned depth)
+{
+    std::vector<int> ancestors;
+    ancestors.reserve(depth);
+    while (ancestors.size() < depth)
+    {
+        auto stat = Get(pid);
+        // parent of init and kernel threads is 0, kernel threads are children of kthreadd (pid 2)
+        if (!stat || stat->ppid <= 2)
+            break;
+
+        pid = stat->ppid;
+        ancestors.push_back(pid);
+    }
+
+    return ancestors;
+}
+
+void ProcessTree::Sweep()
+{
+    auto now = m_source.Now();
+    if (now - m_lastSweep < m_maxAge)
+        return ;
+    m_lastSweep = now;
+
+    for (auto it = m_cache.begin(); it != m_cache.end();)
+    {
+        if (now - it->second.loaded >= m_maxAge)
+        {
+            m_cgroupBytes -= it->second.cgroup.size();
+            it = m_cache.erase(it);
+        }
+        else
+            ++it;
+    }
+}
+
+size_t ProcessTree::MemoryUsage() const
+{
+    return m_cache.size() * (g_hashNodeBytes + sizeof(std::pair<const int, Entry>)) + m_cgroupBytes;
+}
@@ -0,0 +1,155 @@
+#include <fanotify/replay_source.h>
+
+// c++ includes
+#include <stdexcept>
+#include <thread>
+
+using namespace fn;
+
+ReplaySource::ReplaySource(EventTrace trace, bool isPaced) :
+    m_trace(std::move(trace)),
+    m_isPaced(isPaced),
+    m_next(0),
+    m_dropped(0),
+    m_nowNs(0),
+    m_start(clock::now())
+{
+    // map recorded pids to replay ones, so detector can't touch real processes
+    std::unordered_map<int32_t, int32_t> replayPids;
+    for (size_t i = 0; i < m_trace.events.size(); ++i)
+    {
+        auto& event = m_trace.events[i];
+        auto [it, isNew] = replayPids.try_emplace(event.pid, FAKE_PID_BASE + m_originalPids.size());
+        if (isNew)
+        {
+            m_originalPids.push_back(event.pid);
+            m_firstEvents.push_back(i);
+        }
+        event.pid = it->second;
+    }
+
+    m_eventCounts.resize(m_originalPids.size());
+    m_isKilled.resize(m_originalPids.size());
+    m_batch.reserve(EVENTS_BUFFER_SIZE);
+}
+
+int ReplaySource::ReplayPid(int pid) const
+{
+    size_t idx = pid - FAKE_PID_BASE;
+    if (pid < FAKE_PID_BASE || idx >= m_originalPids.size())
+        throw std::runtime_error("Unknown replay pid");
+
+    return idx;
+}
+
+void ReplaySource::Mark(unsigned int, uint64_t, int, const std::string&)
+{
+    // nothing is marked, all events are recorded already
+}
+
+bool ReplaySource::WaitForEvent()
+{
+    if (m_next >= m_trace.events.size())
+        return false;
+
+    if (m_isPaced)
+        std::this_thread::sleep_until(m_start + std::chrono::nanoseconds(m_trace.events[m_next].timeNs));
+
+    return true;
+}
+
+EventContainer ReplaySource::GetEvents()
+{
+    auto& events = m_trace.events;
+    uint64_t batchStartNs = events[m_next].timeNs;
+    // paced batch contains everything that is due by now, fast one is limited by recorded time span
+    uint64_t batchEndNs = batchStartNs + m_maxBatchSpanNs;
+    if (m_isPaced)
+        batchEndNs = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_start).count();
+
+    m_batch.clear();
+    m_directoryBatch.clear();
+    while (m_next < events.size() && m_batch.size() < EVENTS_BUFFER_SIZE &&
+        (m_batch.empty() || events[m_next].timeNs <= batchEndNs))
+    {
+        auto& recorded = events[m_next++];
+        m_nowNs = recorded.timeNs;
+
+        if (m_isKilled[recorded.pid - FAKE_PID_BASE])
+        {
+            m_dropped++;
+            continue ;
+        }
+
+        m_eventCounts[recorded.pid - FAKE_PID_BASE]++;
+        if (recorded.mask & DIRECTORY_EVENTS)
+        {
+            m_directoryBatch.push_back({recorded.mask, recorded.pid, m_trace.paths[recorded.pathId]});
+            continue ;
+        }
+
+        fanotify_event_metadata event{};
+        event.event_len = FAN_EVENT_METADATA_LEN;
+        event.vers = FANOTIFY_METADATA_VERSION;
+        event.metadata_len = FAN_EVENT_METADATA_LEN;
+        event.mask = recorded.mask;
+        event.fd = m_fdBase + recorded.pathId;
+        event.pid = recorded.pid;
+        m_batch.push_back(event);
+    }
+
+    return EventContainer(m_batch.data(), m_batch.size());
+}
+
+std::vector<DirectoryEvent> ReplaySource::GetDirectoryEvents()
+{
+    std::vector<DirectoryEvent> events;
+    events.swap(m_directoryBatch);
+    return events;
+}
+
+void ReplaySource::ResponseAllow(const fanotify_event_metadata&) const
+{
+}
+
+void ReplaySource::ResponseDeny(const fanotify_event_metadata&) const
+{
+}
+
+std::string ReplaySource::GetPath(const fanotify_event_metadata& metadata)
+{
+    return m_trace.paths[metadata.fd - m_fdBase];
+}
+
+void ReplaySource::Release(const fanotify_event_metadata&)
+{
+}
+
+EventSource::time_point ReplaySource::Now()
+{
+    return m_start + std::chrono::nanoseconds(m_nowNs);
+}
+
+std::string ReplaySource::GetExecutable(int pid)
+{
+    auto it = m_trace.executables.find(m_originalPids[ReplayPid(pid)]);
+    if (it == m_trace.executables.end() || it->second.empty())
+        throw std::runtime_error("Executable of the pid is not recorded");
+
+    return it->second;
+}
+
+void ReplaySource::Kill(int pid, int, const StoppedGroup&)
+{
+    int idx = ReplayPid(pid);
+    int32_t originalPid = m_originalPids[idx];
+    m_isKilled[idx] = true;
+
+    auto it = m_trace.executables.find(originalPid);
+    m_decisions.push_back({
+        .pid = originalPid,
+        .executable = (it != m_trace.executables.end()) ? it->second : "",
+        .timeToDetectNs = m_nowNs - m_trace.events[m_firstEvents[idx]].timeNs,
+        .events = m_eventCounts[idx],
+    });
+}
@@ -0,0 +1,106 @@
+#include <fanotify/score_model.h>
+
+// c++ includes
+#include <stdexcept>
+
+namespace fn
+{
+
+static const char* g_featureNames[FEATURE_COUNT] = {
+    "reads", "writes", "opens", "closes", "creates", "deletes", "renames", "unique_files", "entropy", "extension_changes"
+};
+
+bool FeatureByName(const std::string& name, Feature& feature)
+{
+    for (size_t idx = 0; idx < FEATURE_COUNT; ++idx)
+    {
+        if (name == g_featureNames[idx])
+        {
+            feature = static_cast<Feature>(idx);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+ScoreModel::ScoreModel() :
+    m_kind(MODEL_NONE),
+    m_weights(),
+    m_bias(0),
+    m_nodes(),
+    m_threshold(0)
+{}
+
+ScoreModel ScoreModel::Linear(const std::array<float, FEATURE_COUNT>& weights, float bias, float threshold)
+{
+    ScoreModel model;
+    model.m_kind = MODEL_LINEAR;
+    model.m_weights = weights;
+    model.m_bias = bias;
+    model.m_threshold = threshold;
+    return model;
+}
+
+ScoreModel ScoreModel::Tree(std::vector<Node> nodes, float threshold)
+{
+    if (nodes.empty())
+        throw std::runtime_error("Decision tree has no nodes");
+
+    // children after parents: the walk always ends in a leaf
+    for (size_t idx = 0; idx < nodes.size(); ++idx)
+    {
+        auto& node = nodes[idx];
+        if (node.feature >= FEATURE_COUNT)
+            throw std::runtime_error("Unknown feature in decision tree");
+
+        if (node.feature >= 0 && (node.left <= idx || node.right <= idx || node.left >= nodes.size() ||
+            node.right >= nodes.size()))
+            throw std::runtime_error("Children of decision tree node must follow it");
+    }
+
+    ScoreModel model;
+    model.m_kind = MODEL_TREE;
+    model.m_nodes = std::move(nodes);
+    model.m_threshold = threshold;
+    return model;
+}
+
+float ScoreModel::ScoreTree(const Columns& columns, size_t pid) const
+{
+    size_t idx = 0;
+    while (m_nodes[idx].feature >= 0)
+    {
+        auto& node = m_nodes[idx];
+        idx = columns[node.feature][pid] < node.threshold ? node.left : node.right;
+    }
+
+    return m_nodes[idx].value;
+}
+
+void ScoreModel::Score(const Columns& columns, size_t count, std::vector<float>& scores) const
+{
+    if (m_kind == MODEL_TREE)
+    {
+        scores.resize(count);
+        for (size_t pid = 0; pid < count; ++pid)
+            scores[pid] = ScoreTree(columns, pid);
+        return ;
+    }
+
+    // column by column, the inner loop is a plain multiply-add over contiguous floats
+    scores.assign(count, m_bias);
+    float* out = scores.data();
+    for (size_t feature = 0; feature < FEATURE_COUNT; ++feature)
+    {
+        float weight = m_weights[feature];
+        if (weight == 0)
+            continue ;
+
+        const float* column = columns[feature].data();
+        for (size_t pid = 0; pid < count; ++pid)
+            out[pid] += weight * column[pid];
+    }
+}
+
+}
@@ -0,0 +1,54 @@
+#include <fanotify/stage_profiler.h>
+
+// c++ includes
+#include <iomanip>
+#include <sstream>
+
+namespace fn
+{
+
+std::string StringizeProfileStage(size_t stage)
+{
+    switch (stage)
+    {
+        case STAGE_WAIT:
+            return "wait";
+        case STAGE_READ:
+            return "read";
+        case STAGE_CLASSIFY:
+            return "classify";
+        case STAGE_EXPIRY:
+            return "expiry";
+        case STAGE_SUSPICION:
+            return "suspicion";
+        case STAGE_KILL:
+            return "kill";
+        case STAGE_TRACE:
+            return "trace";
+        default:
+            return "";
+    }
+}
+
+std::vector<std::string> StageProfiler::Dump() const
+{
+    auto profiled = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - m_start).count();
+
+    std::vector<std::string> lines;
+    for (size_t stage = 0; stage < STAGE_COUNT; ++stage)
+    {
+        auto histogram = m_histograms[stage].Take();
+        auto count = histogram.Count();
+
+        std::stringstream ss;
+        ss << std::fixed << std::setprecision(3) << "Stage " << StringizeProfileStage(stage) << ": count = " << count
+            << ", total ms = " << m_totals[stage] / 1e6 << ", share % = " << (profiled ? 100.0 * m_totals[stage] / profiled : 0)
+            << ", mean us = " << (count ? m_totals[stage] / 1e3 / count : 0) << ", p50 us = " << histogram.Percentile(0.5) / 1e3
+            << ", p99 us = " << histogram.Percentile(0.99) / 1e3 << ", max us = " << histogram.Max() / 1e3;
+        lines.push_back(ss.str());
+    }
+
+    return lines;
+}
+
+}
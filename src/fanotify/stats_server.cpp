@@ -0,0 +1,327 @@
+#include <fanotify/stats_server.h>
+
+// c includes
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <unistd.h>
+
+// c++ includes
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <stdexcept>
+
+using namespace fn;
+
+static const char* g_eventTypeNames[EVENT_COUNT] = {"read", "write", "open", "close", "create", "delete", "rename"};
+
+StatsServer::StatsServer(const std::string& path, std::function<StatsSnapshot()> collect) :
+    m_path(path),
+    m_collect(std::move(collect)),
+    m_listenFd(-1),
+    m_epollFd(-1),
+    m_stopFd(-1),
+    m_clients(),
+    m_previous(),
+    m_previousTime(clock::now())
+{
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (m_path.size() >= sizeof(address.sun_path))
+        throw std::runtime_error("Stats socket path is too long");
+    strcpy(address.sun_path, m_path.c_str());
+
+    m_listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0)
+        throw std::runtime_error("Can't create stats socket");
+
+    // socket file of the previous run is left if it was killed
+    unlink(m_path.c_str());
+    if (bind(m_listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(m_listenFd, m_maxClients) < 0)
+    {
+        close(m_listenFd);
+        throw std::runtime_error("Can't listen on stats socket " + m_path);
+    }
+
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    m_stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_epollFd < 0 || m_stopFd < 0)
+    {
+        close(m_listenFd);
+        close(m_epollFd);
+        close(m_stopFd);
+        throw std::runtime_error("Can't create epoll for stats socket");
+    }
+
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = m_listenFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_listenFd, &event);
+    event.data.fd = m_stopFd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_stopFd, &event);
+
+    m_thread = std::thread(&StatsServer::Run, this);
+}
+
+void StatsServer::Run()
+{
+    constexpr int maxEvents = 16;
+    epoll_event events[maxEvents];
+
+    while (true)
+    {
+        int count = epoll_wait(m_epollFd, events, maxEvents, -1);
+        if (count < 0)
+        {
+            if (errno == EINTR)
+                continue ;
+            return ;
+        }
+
+        for (int i = 0; i < count; ++i)
+        {
+            int fd = events[i].data.fd;
+            if (fd == m_stopFd)
+                return ;
+
+            if (fd == m_listenFd)
+            {
+                Accept();
+                continue ;
+            }
+
+            auto it = m_clients.find(fd);
+            if (it == m_clients.end())
+                continue ;
+
+            bool isAlive = true;
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+                isAlive = it->second.response.empty() ? Read(fd, it->second) : false;
+            else if (events[i].events & EPOLLIN)
+                isAlive = Read(fd, it->second);
+            else if (events[i].events & EPOLLOUT)
+                isAlive = Write(fd, it->second);
+
+            if (!isAlive)
+                Close(fd);
+        }
+    }
+}
+
+void StatsServer::Accept()
+{
+    while (true)
+    {
+        int fd = accept4(m_listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return ; // EAGAIN - no more pending connections
+
+        if (m_clients.size() >= m_maxClients)
+        {
+            close(fd);
+            continue ;
+        }
+
+        epoll_event event = {};
+        event.events = EPOLLIN;
+        event.data.fd = fd;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0)
+        {
+            close(fd);
+            continue ;
+        }
+
+        m_clients[fd] = Client{};
+    }
+}
+
+bool StatsServer::Read(int fd, Client& client)
+{
+    char buffer[512];
+    bool isClosed = false;
+    while (true)
+    {
+        auto size = read(fd, buffer, sizeof(buffer));
+        if (size > 0)
+        {
+            client.request.append(buffer, size);
+            if (client.request.size() > m_maxRequestSize)
+                return false;
+            continue ;
+        }
+
+        if (size == 0)
+            isClosed = true;
+        else if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+        break;
+    }
+
+    // wait for the first line, unless the client has finished writing
+    auto lineEnd = client.request.find('\n');
+    if (lineEnd == std::string::npos && !isClosed)
+        return true;
+
+    // HTTP client waits for the end of headers to be read, but they don't matter
+    auto body = Format();
+    if (client.request.compare(0, 4, "GET ") == 0)
+    {
+        std::stringstream ss;
+        ss << "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " << body.size()
+            << "\r\nConnection: close\r\n\r\n" << body;
+        client.response = ss.str();
+    }
+    else
+        client.response = std::move(body);
+
+    epoll_event event = {};
+    event.events = EPOLLOUT;
+    event.data.fd = fd;
+    epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event);
+
+    return Write(fd, client);
+}
+
+bool StatsServer::Write(int fd, Client& client)
+{
+    while (client.written < client.response.size())
+    {
+        auto size = send(fd, client.response.data() + client.written, client.response.size() - client.written, MSG_NOSIGNAL);
+        if (size < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        client.written += size;
+    }
+
+    return false; // response is sent
+}
+
+void StatsServer::Close(int fd)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+    close(fd);
+    m_clients.erase(fd);
+}
+
+// Write histogram of nanoseconds as Prometheus summary in seconds
+static void FormatSummary(std::stringstream& ss, const char* name, const char* help, const LatencyHistogram::Snapshot& histogram)
+{
+    ss << "# HELP " << name << " " << help << "\n";
+    ss << "# TYPE " << name << " summary\n";
+    for (double quantile : {0.5, 0.9, 0.99, 0.999})
+        ss << name << "{quantile=\"" << quantile << "\"} " << histogram.Percentile(quantile) / 1e9 << "\n";
+    ss << name << "{quantile=\"1\"} " << histogram.Max() / 1e9 << "\n";
+    ss << name << "_count " << histogram.Count() << "\n";
+}
+
+static void FormatMetric(std::stringstream& ss, const char* name, const char* type, const char* help, uint64_t value)
+{
+    ss << "# HELP " << name << " " << help << "\n";
+    ss << "# TYPE " << name << " " << type << "\n";
+    ss << name << " " << value << "\n";
+}
+
+std::string StatsServer::Format()
+{
+    auto stats = m_collect();
+    auto now = clock::now();
+    double seconds = std::chrono::duration<double>(now - m_previousTime).count();
+
+    std::stringstream ss;
+    ss << "# HELP fanotify_events_total Events of other processes by type.\n";
+    ss << "# TYPE fanotify_events_total counter\n";
+    for (size_t type = 0; type < EVENT_COUNT; ++type)
+        ss << "fanotify_events_total{type=\"" << g_eventTypeNames[type] << "\"} " << stats.events[type] << "\n";
+
+    // rate since the previous request, so it is meaningful without Prometheus too
+    ss << "# HELP fanotify_events_per_second Events per second by type since the previous request.\n";
+    ss << "# TYPE fanotify_events_per_second gauge\n";
+    for (size_t type = 0; type < EVENT_COUNT; ++type)
+    {
+        double rate = seconds > 0 ? (stats.events[type] - m_previous.events[type]) / seconds : 0;
+        ss << "fanotify_events_per_second{type=\"" << g_eventTypeNames[type] << "\"} " << rate << "\n";
+    }
+
+    ss << "# HELP fanotify_mount_events_total Events of other processes by watched mount and type.\n";
+    ss << "# TYPE fanotify_mount_events_total counter\n";
+    for (auto& mount : stats.mounts)
+    {
+        for (size_t type = 0; type < EVENT_COUNT; ++type)
+            ss << "fanotify_mount_events_total{mount=\"" << mount.path << "\",type=\"" << g_eventTypeNames[type]
+                << "\"} " << mount.events[type] << "\n";
+    }
+
+    ss << "# HELP fanotify_mount_events_per_second Events per second by watched mount and type since the previous request.\n";
+    ss << "# TYPE fanotify_mount_events_per_second gauge\n";
+    for (size_t idx = 0; idx < stats.mounts.size(); ++idx)
+    {
+        auto& mount = stats.mounts[idx];
+        // mounts of the previous snapshot are empty before the first request, the rate is counted since start then
+        bool hasPrevious = idx < m_previous.mounts.size();
+        for (size_t type = 0; type < EVENT_COUNT; ++type)
+        {
+            uint64_t previous = hasPrevious ? m_previous.mounts[idx].events[type] : 0;
+            double rate = seconds > 0 ? (mount.events[type] - previous) / seconds : 0;
+            ss << "fanotify_mount_events_per_second{mount=\"" << mount.path << "\",type=\"" << g_eventTypeNames[type]
+                << "\"} " << rate << "\n";
+        }
+    }
+
+    FormatMetric(ss, "fanotify_tracked_pids", "gauge", "Pids that have events in the time window.", stats.trackedPids);
+    FormatMetric(ss, "fanotify_queue_overflows_total", "counter", "Overflows of fanotify event queue.", stats.overflows);
+    FormatMetric(ss, "fanotify_kills_total", "counter", "Processes killed as encryptors.", stats.kills);
+    FormatMetric(ss, "fanotify_freezes_total", "counter", "Suspects stopped until the verdict.", stats.freezes);
+    FormatMetric(ss, "fanotify_thaws_total", "counter", "Frozen suspects resumed as benign.", stats.thaws);
+    FormatMetric(ss, "fanotify_stale_suspects_total", "counter", "Suspects that exited or whose pid was reused before the response.", stats.staleSuspects);
+    FormatMetric(ss, "fanotify_ignore_marks", "gauge", "Hot files of white-listed programs ignored by the kernel.", stats.ignoreMarks);
+    FormatMetric(ss, "fanotify_ignore_marks_installed_total", "counter", "Ignore marks installed on hot files.", stats.ignoreMarksInstalled);
+    FormatMetric(ss, "fanotify_canaries", "gauge", "Canary files in place.", stats.canaries);
+    FormatMetric(ss, "fanotify_canary_hits_total", "counter", "Writes, renames and deletes of canary files.", stats.canaryHits);
+    FormatMetric(ss, "fanotify_whitelist_hits_total", "counter", "Suspicious processes skipped because of white list.", stats.whiteListHits);
+    FormatMetric(ss, "fanotify_evicted_pids_total", "counter", "Pids evicted because pid state was over memory budget.", stats.evictedPids);
+    FormatMetric(ss, "fanotify_pid_state_budget_bytes", "gauge", "Memory budget of pid state (0 - no limit).", stats.memoryBudget);
+    ss << "# HELP fanotify_memory_bytes Estimated memory of detector structures.\n";
+    ss << "# TYPE fanotify_memory_bytes gauge\n";
+    ss << "fanotify_memory_bytes{structure=\"pid_table\"} " << stats.pidTableBytes << "\n";
+    ss << "fanotify_memory_bytes{structure=\"event_queues\"} " << stats.eventQueueBytes << "\n";
+    ss << "fanotify_memory_bytes{structure=\"recorder\"} " << stats.recorderBytes << "\n";
+    ss << "fanotify_memory_bytes{structure=\"backup_queue\"} " << stats.backupQueueBytes << "\n";
+    ss << "fanotify_memory_bytes{structure=\"entropy_table\"} " << stats.entropyTableBytes << "\n";
+    ss << "fanotify_memory_bytes{structure=\"group_table\"} " << stats.groupTableBytes << "\n";
+    ss << "fanotify_memory_bytes{structure=\"process_cache\"} " << stats.processCacheBytes << "\n";
+    FormatMetric(ss, "fanotify_tracked_groups", "gauge", "Groups of processes (ancestors, process groups, sessions) with tracked members.", stats.trackedGroups);
+    FormatMetric(ss, "fanotify_group_detections_total", "counter", "Groups of processes that reached aggregate thresholds.", stats.groupDetections);
+    ss << "# HELP fanotify_process_cache_lookups_total Lookups of /proc/<pid>/stat served from cache (hit) and from /proc (miss).\n";
+    ss << "# TYPE fanotify_process_cache_lookups_total counter\n";
+    ss << "fanotify_process_cache_lookups_total{result=\"hit\"} " << stats.processCacheHits << "\n";
+    ss << "fanotify_process_cache_lookups_total{result=\"miss\"} " << stats.processCacheMisses << "\n";
+    FormatMetric(ss, "fanotify_entropy_samples_total", "counter", "Written files sampled for entropy.", stats.entropySamples);
+    FormatMetric(ss, "fanotify_high_entropy_samples_total", "counter", "Sampled files with entropy above threshold.", stats.highEntropySamples);
+    FormatMetric(ss, "fanotify_entropy_dropped_total", "counter", "Written files not sampled because sampler queue was full.", stats.entropyDropped);
+    FormatMetric(ss, "fanotify_backup_files_total", "counter", "Snapshots taken by backup worker.", stats.backupFiles);
+    FormatMetric(ss, "fanotify_backup_bytes_total", "counter", "Size of snapshots taken by backup worker.", stats.backupBytes);
+    FormatSummary(ss, "fanotify_loop_iteration_seconds", "Duration of main loop iterations.", stats.loopTime);
+    FormatSummary(ss, "fanotify_permission_latency_seconds", "Time from reading permission event to the answer.", stats.permissionLatency);
+
+    m_previous = stats;
+    m_previousTime = now;
+    return ss.str();
+}
+
+StatsServer::~StatsServer()
+{
+    uint64_t value = 1;
+    if (write(m_stopFd, &value, sizeof(value)) < 0)
+        std::terminate(); // thread can't be stopped, it is not possible with eventfd
+    m_thread.join();
+
+    for (auto& pair : m_clients)
+        close(pair.first);
+
+    close(m_listenFd);
+    close(m_epollFd);
+    close(m_stopFd);
+    unlink(m_path.c_str());
+}
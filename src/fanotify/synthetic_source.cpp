@@ -0,0 +1,143 @@
+#include <fanotify/synthetic_source.h>
+
+// c++ includes
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+
+using namespace fn;
+
+SyntheticSource::SyntheticSource(const SyntheticOptions& options) :
+    m_options(options),
+    m_weightSum(0),
+    m_hotBound(0),
+    m_state(options.seed ? options.seed : 1),
+    m_generated(0),
+    m_released(0),
+    m_start(clock::now())
+{
+    if (m_options.pids == 0 || m_options.files == 0)
+        throw std::runtime_error("Synthetic source needs at least one pid and one file");
+
+    m_options.batchSize = std::clamp<size_t>(m_options.batchSize, 1, EVENTS_BUFFER_SIZE);
+    m_options.hotPids = std::min(m_options.hotPids, m_options.pids);
+
+    for (auto& [mask, weight] : m_options.typeWeights)
+    {
+        if (weight == 0)
+            continue ;
+
+        m_weightSum += weight;
+        m_typeBounds.push_back({m_weightSum, mask});
+    }
+
+    if (m_typeBounds.empty())
+        throw std::runtime_error("Synthetic source needs at least one event type with non-zero weight");
+
+    if (m_options.hotPids > 0)
+        m_hotBound = std::clamp(m_options.hotShare, 0.0, 1.0) * (double) (1ull << 32);
+
+    m_paths.reserve(m_options.files);
+    for (unsigned i = 0; i < m_options.files; ++i)
+        m_paths.push_back("/synthetic/dir" + std::to_string(i % 100) + "/file" + std::to_string(i));
+
+    m_batch.reserve(m_options.batchSize);
+}
+
+uint64_t SyntheticSource::Next()
+{
+    // xorshift64*, good enough for workload shaping and much cheaper than std::mt19937
+    m_state ^= m_state >> 12;
+    m_state ^= m_state << 25;
+    m_state ^= m_state >> 27;
+    return m_state * 0x2545F4914F6CDD1Dull;
+}
+
+// map 32 random bits to [0, n) without division
+static inline uint64_t Bounded(uint64_t random, uint64_t n)
+{
+    return ((random & 0xFFFFFFFFull) * n) >> 32;
+}
+
+fanotify_event_metadata SyntheticSource::Generate()
+{
+    uint64_t random = Next();
+
+    unsigned pidIdx;
+    if ((random >> 32) < m_hotBound)
+        pidIdx = Bounded(random, m_options.hotPids);
+    else
+        pidIdx = Bounded(random, m_options.pids);
+
+    random = Next();
+    uint64_t typeValue = Bounded(random, m_weightSum);
+    uint64_t mask = m_typeBounds.back().second;
+    for (auto& [bound, typeMask] : m_typeBounds)
+    {
+        if (typeValue < bound)
+        {
+            mask = typeMask;
+            break;
+        }
+    }
+
+    fanotify_event_metadata event{};
+    event.event_len = FAN_EVENT_METADATA_LEN;
+    event.vers = FANOTIFY_METADATA_VERSION;
+    event.metadata_len = FAN_EVENT_METADATA_LEN;
+    event.mask = mask;
+    event.fd = m_fdBase + Bounded(random >> 32, m_options.files);
+    event.pid = FAKE_PID_BASE + pidIdx;
+    return event;
+}
+
+void SyntheticSource::Mark(unsigned int, uint64_t, int, const std::string&)
+{
+    // nothing is marked, all events are generated
+}
+
+bool SyntheticSource::WaitForEvent()
+{
+    if (m_generated >= m_options.totalEvents)
+        return false;
+
+    if (m_options.rate > 0)
+    {
+        // event with number m_generated is due at m_start + m_generated / rate
+        auto due = m_start + std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>((double) m_generated / m_options.rate));
+        std::this_thread::sleep_until(due);
+    }
+
+    return true;
+}
+
+EventContainer SyntheticSource::GetEvents()
+{
+    size_t count = std::min<uint64_t>(m_options.batchSize, m_options.totalEvents - m_generated);
+
+    m_batch.clear();
+    for (size_t i = 0; i < count; ++i)
+        m_batch.push_back(Generate());
+
+    m_generated += count;
+    return EventContainer(m_batch.data(), m_batch.size());
+}
+
+void SyntheticSource::ResponseAllow(const fanotify_event_metadata&) const
+{
+}
+
+void SyntheticSource::ResponseDeny(const fanotify_event_metadata&) const
+{
+}
+
+std::string SyntheticSource::GetPath(const fanotify_event_metadata& metadata)
+{
+    return m_paths[metadata.fd - m_fdBase];
+}
+
+void SyntheticSource::Release(const fanotify_event_metadata&)
+{
+    ++m_released;
+}
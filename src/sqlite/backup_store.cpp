@@ -0,0 +1,16 @@
+#include <sqlite/backup_store.h>
+#include <sqlite/filedb.h>
+#include <sqlite/reflink_store.h>
+
+namespace sqlite
+{
+
+std::unique_ptr<BackupStore> OpenBackupStore(const std::string& dbPath, const std::string& storeDir)
+{
+    if (storeDir.empty())
+        return std::make_unique<FileDB>(dbPath.c_str());
+
+    return std::make_unique<ReflinkStore>(dbPath.c_str(), storeDir.c_str());
+}
+
+}
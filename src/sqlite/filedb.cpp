@@ -3,9 +3,50 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <ctime>
+
+#include <unistd.h>
 
 using namespace sqlite;
 
+void FileDB::InitSchema()
+{
+    if (GetUserVersion() == m_schemaVersion)
+        return ;
+
+    if (!IsTableExists("files"))
+    {
+        // auto_vacuum must be set before any table is created
+        Exec("PRAGMA auto_vacuum = INCREMENTAL;");
+
+        Transaction transaction(*this);
+        Exec(m_createTables);
+        Exec(("PRAGMA user_version = " + std::to_string(m_schemaVersion) + ";").c_str());
+        transaction.Commit();
+        return ;
+    }
+
+    // previous layout: files(path, content, pid[, timestamp, size]) without any indexes
+    std::string timestamp = IsColumnExists("files", "timestamp") ? "timestamp" : "0";
+
+    Transaction transaction(*this);
+    Exec("ALTER TABLE files RENAME TO files_legacy;");
+    Exec(m_createTables);
+    Exec(("INSERT OR REPLACE INTO files( path, pid, timestamp, size ) "
+        "SELECT path, pid, " + timestamp + ", length(content) FROM files_legacy ORDER BY rowid;").c_str());
+    Exec("INSERT OR REPLACE INTO contents( id, content ) "
+        "SELECT files.id, files_legacy.content FROM files_legacy JOIN files ON files.path = files_legacy.path;");
+    Exec("DROP TABLE files_legacy;");
+    // replaced duplicates don't fire delete trigger
+    Exec("UPDATE totals SET size = (SELECT COALESCE(SUM(size), 0) FROM files);");
+    Exec(("PRAGMA user_version = " + std::to_string(m_schemaVersion) + ";").c_str());
+    transaction.Commit();
+
+    // switching auto_vacuum mode of existing database requires full vacuum
+    Exec("PRAGMA auto_vacuum = INCREMENTAL;");
+    Exec("VACUUM;");
+}
+
 void FileDB::DeleteFile(const char* path)
 {
     auto stmt = PrepareV2(m_delete);
@@ -13,24 +54,59 @@ void FileDB::DeleteFile(const char* path)
     stmt.Step();
 }
 
-void FileDB::AddFile(const char* path, int pid)
+void FileDB::Insert(const char* path, std::vector<char>& buffer, int pid)
 {
+    Transaction transaction(*this);
+
     // delete previous file content, if exists
     DeleteFile(path);
 
+    // table columns: 'path', 'pid', 'timestamp', 'size'
+    auto stmt = PrepareV2(m_insertSql);
+    
+    stmt.Bind(1, path);
+    stmt.Bind(2, pid);
+    stmt.Bind(3, (sqlite3_int64) time(nullptr));
+    stmt.Bind(4, (sqlite3_int64) buffer.size());
+    CHECK_SQL_DONE(stmt.Step());
+
+    // table columns: 'id', 'content'
+    auto contentStmt = PrepareV2(m_insertContentSql);
+    contentStmt.Bind(1, buffer);
+    CHECK_SQL_DONE(contentStmt.Step());
+
+    transaction.Commit();
+}
+
+void FileDB::AddFile(const char* path, int pid)
+{
     // read file as blob
     std::ifstream inputFile(path, std::ios::binary);
     std::vector<char> buffer(std::istreambuf_iterator<char>(inputFile), {});
 
-    // prepare cmd
-    // table columns: 'path', 'content', 'pid'
-    auto stmt = PrepareV2(m_insertSql);
-    
-    stmt.Bind(1, path);
-    stmt.Bind(2, buffer);
-    stmt.Bind(3, pid);
-    
-    stmt.Step();
+    Insert(path, buffer, pid);
+}
+
+void FileDB::AddFile(int fd, const char* path, int pid)
+{
+    // read file as blob without moving file offset of the given descriptor
+    std::vector<char> buffer;
+    const size_t blockSize = 64 * 1024;
+    off_t offset = 0;
+    ssize_t readBytes = 0;
+    do
+    {
+        buffer.resize(offset + blockSize);
+        readBytes = pread(fd, buffer.data() + offset, blockSize, offset);
+        if (readBytes < 0)
+            throw std::runtime_error("Can't read file to back it up");
+        
+        offset += readBytes;
+    }
+    while (readBytes > 0);
+    buffer.resize(offset);
+
+    Insert(path, buffer, pid);
 }
 
 bool FileDB::IsExists(const char* path)
@@ -41,23 +117,34 @@ bool FileDB::IsExists(const char* path)
     return (stmt.Step() == SQLITE_ROW);
 }
 
-std::basic_string<unsigned char> FileDB::GetFileContent(const char* path)
+bool FileDB::GetSnapshot(const char* path, int64_t& timestamp, int64_t& size, int& pid)
 {
-    std::basic_string<unsigned char> fileContent;
+    auto stmt = PrepareV2(m_selectSnapshot);
+    stmt.Bind(1, path);
+    if (stmt.Step() != SQLITE_ROW)
+        return false;
 
+    timestamp = stmt.ColumnInt64(0);
+    size = stmt.ColumnInt64(1);
+    pid = stmt.ColumnInt(2);
+    return true;
+}
+
+std::basic_string<unsigned char> FileDB::GetFileContent(const char* path)
+{
     auto stmt = PrepareV2(m_selectFileByPath);
     stmt.Bind(1, path);
 
-    int res = 0;
-    while ((res = stmt.Step()) == SQLITE_ROW)
-    {
-        fileContent += stmt.ColumnText(1);
-    }
+    int res = stmt.Step();
+    if (res == SQLITE_DONE)
+        return {};
 
-    if (res != SQLITE_DONE)
+    if (res != SQLITE_ROW)
         CHECK_SQL(res);
-    
-    return fileContent;
+
+    // content is binary, it must not be treated as zero-terminated text
+    auto content = stmt.ColumnBlob(0);
+    return std::basic_string<unsigned char>(content.data(), content.size());
 }
 
 std::vector<std::string> FileDB::GetFilesFromPid(int pid)
@@ -70,7 +157,6 @@ std::vector<std::string> FileDB::GetFilesFromPid(int pid)
     int res = 0;
     while ((res = stmt.Step()) == SQLITE_ROW)
     {
-        std::cout << stmt.ColumnText(1) << std::endl; 
         files.push_back(std::string((char*) stmt.ColumnText(0))); // files can be always read like char* (not unsigned)
     }
 
@@ -80,3 +166,86 @@ std::vector<std::string> FileDB::GetFilesFromPid(int pid)
     return files;
 }
 
+
+std::vector<std::string> FileDB::GetFilesFromTime(int64_t from, int64_t to)
+{
+    std::vector<std::string> files;
+
+    auto stmt = PrepareV2(m_selectFilesByTime);
+    stmt.Bind(1, (sqlite3_int64) from);
+    stmt.Bind(2, (sqlite3_int64) to);
+
+    int res = 0;
+    while ((res = stmt.Step()) == SQLITE_ROW)
+        files.push_back(std::string((char*) stmt.ColumnText(0)));
+
+    if (res != SQLITE_DONE)
+        CHECK_SQL(res);
+
+    return files;
+}
+
+void FileDB::RestoreFile(const char* path, int fd)
+{
+    auto stmt = PrepareV2(m_selectIdByPath);
+    stmt.Bind(1, path);
+
+    if (stmt.Step() != SQLITE_ROW)
+        throw std::runtime_error("There is no backup of the requested file");
+
+    OpenBlob("contents", "content", stmt.ColumnInt64(0)).WriteTo(fd);
+}
+
+int64_t FileDB::GetSize()
+{
+    auto stmt = PrepareV2(m_selectSize);
+    return (stmt.Step() == SQLITE_ROW) ? stmt.ColumnInt64(0) : 0;
+}
+
+void FileDB::EvictOlderThan(int64_t timestamp)
+{
+    auto stmt = PrepareV2(m_deleteOlder);
+    stmt.Bind(1, (sqlite3_int64) timestamp);
+    stmt.Step();
+}
+
+void FileDB::EvictPid(int pid, int64_t since)
+{
+    auto stmt = PrepareV2(m_deletePid);
+    stmt.Bind(1, pid);
+    stmt.Bind(2, (sqlite3_int64) since);
+    stmt.Step();
+}
+
+void FileDB::EvictToSize(int64_t maxSize)
+{
+    int64_t size = GetSize();
+    if (size <= maxSize)
+        return ;
+
+    std::vector<sqlite3_int64> rows;
+    {
+        auto select = PrepareV2(m_selectOldest);
+        while (size > maxSize && select.Step() == SQLITE_ROW)
+        {
+            rows.push_back(select.ColumnInt64(0));
+            size -= select.ColumnInt64(1);
+        }
+    }
+
+    // delete in one transaction not to sync the database on each row
+    Transaction transaction(*this);
+    for (auto& row : rows)
+    {
+        auto stmt = PrepareV2(m_deleteRow);
+        stmt.Bind(1, row);
+        stmt.Step();
+    }
+    transaction.Commit();
+}
+
+int FileDB::Vacuum(int pages)
+{
+    IncrementalVacuum(pages);
+    return GetFreePages();
+}
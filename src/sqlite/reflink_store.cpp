@@ -0,0 +1,408 @@
+#include <sqlite/reflink_store.h>
+
+// c includes
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+// c++ includes
+#include <array>
+#include <ctime>
+#include <sstream>
+#include <stdexcept>
+
+using namespace sqlite;
+
+ReflinkStore::ReflinkStore(const char* dbPath, const char* storeDir) :
+    DataBase(dbPath),
+    m_storeDir(storeDir),
+    m_storeDirFd(-1),
+    m_counter(0)
+{
+    if (mkdir(storeDir, S_IRWXU) < 0 && errno != EEXIST)
+        throw std::runtime_error("Can't create backup store directory");
+
+    m_storeDirFd = open(storeDir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (m_storeDirFd < 0)
+        throw std::runtime_error("Can't open backup store directory");
+
+    try
+    {
+        InitSchema();
+    }
+    catch (...)
+    {
+        // destructor isn't called for a partially constructed object
+        close(m_storeDirFd);
+        m_storeDirFd = -1;
+        throw;
+    }
+}
+
+void ReflinkStore::InitSchema()
+{
+    if (GetUserVersion() == m_schemaVersion)
+        return ;
+
+    if (!IsTableExists("snapshots"))
+    {
+        // auto_vacuum must be set before any table is created
+        Exec("PRAGMA auto_vacuum = INCREMENTAL;");
+
+        Transaction transaction(*this);
+        Exec(m_createTables);
+        Exec(("PRAGMA user_version = " + std::to_string(m_schemaVersion) + ";").c_str());
+        transaction.Commit();
+        return ;
+    }
+
+    Transaction transaction(*this);
+    if (!IsColumnExists("snapshots", "size"))
+    {
+        Exec("ALTER TABLE snapshots ADD COLUMN size INTEGER NOT NULL DEFAULT 0;");
+
+        // sizes are taken from snapshot files, a missing file counts as empty
+        std::vector<std::pair<sqlite3_int64, sqlite3_int64>> sizes;
+        {
+            auto select = PrepareV2(m_selectLocations);
+            while (select.Step() == SQLITE_ROW)
+            {
+                struct stat st = {};
+                if (fstatat(m_storeDirFd, (const char*) select.ColumnText(1), &st, 0) == 0)
+                    sizes.emplace_back(select.ColumnInt64(0), st.st_size);
+            }
+        }
+
+        for (auto& [row, size] : sizes)
+        {
+            auto stmt = PrepareV2(m_updateSize);
+            stmt.Bind(1, size);
+            stmt.Bind(2, row);
+            stmt.Step();
+        }
+    }
+    // indexes added after the first layout
+    Exec(m_createTables);
+    Exec(("PRAGMA user_version = " + std::to_string(m_schemaVersion) + ";").c_str());
+    transaction.Commit();
+
+    // switching auto_vacuum mode of existing database requires full vacuum
+    Exec("PRAGMA auto_vacuum = INCREMENTAL;");
+    Exec("VACUUM;");
+}
+
+void ReflinkStore::CloneFile(int srcFd, int dstFd)
+{
+    // 1) reflink - new file shares extents with the original one, no data is copied
+    if (ioctl(dstFd, FICLONE, srcFd) == 0)
+        return ;
+
+    struct stat st = {};
+    if (fstat(srcFd, &st) < 0)
+        throw std::runtime_error("Can't stat file to back it up");
+
+    // 2) in-kernel copy, explicit offset is used not to move offset of the source descriptor
+    loff_t offset = 0;
+    while (offset < st.st_size)
+    {
+        ssize_t copied = copy_file_range(srcFd, &offset, dstFd, nullptr, st.st_size - offset, 0);
+        if (copied == 0)
+            return ; // file was truncated while copying
+
+        if (copied < 0)
+        {
+            if (offset == 0 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP))
+                break ; // not supported for these descriptors, fall back to userspace copy
+
+            throw std::runtime_error("copy_file_range error while backing up file");
+        }
+    }
+
+    if (offset >= st.st_size)
+        return ;
+
+    // 3) plain copy through userspace buffer
+    std::array<char, 64 * 1024> buffer;
+    ssize_t readBytes = 0;
+    while ((readBytes = pread(srcFd, buffer.data(), buffer.size(), offset)) > 0)
+    {
+        if (write(dstFd, buffer.data(), readBytes) != readBytes)
+            throw std::runtime_error("Can't write snapshot file");
+
+        offset += readBytes;
+    }
+
+    if (readBytes < 0)
+        throw std::runtime_error("Can't read file to back it up");
+}
+
+int ReflinkStore::CreateSnapshotFile(std::string& location)
+{
+    timespec now = {};
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    while (true)
+    {
+        std::stringstream name;
+        name << now.tv_sec << "." << now.tv_nsec << "-" << m_counter++ << ".snapshot";
+        location = name.str();
+
+        // never overwrite existing snapshot, it might be the only copy of the file
+        int fd = openat(m_storeDirFd, location.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (fd >= 0)
+            return fd;
+
+        if (errno != EEXIST)
+            throw std::runtime_error("Can't create snapshot file");
+    }
+}
+
+bool ReflinkStore::IsExists(const char* path)
+{
+    auto stmt = PrepareV2(m_ifExists);
+    stmt.Bind(1, path);
+
+    return (stmt.Step() == SQLITE_ROW);
+}
+
+bool ReflinkStore::GetSnapshot(const char* path, int64_t& timestamp, int64_t& size, int& pid)
+{
+    auto stmt = PrepareV2(m_selectSnapshot);
+    stmt.Bind(1, path);
+    if (stmt.Step() != SQLITE_ROW)
+        return false;
+
+    timestamp = stmt.ColumnInt64(0);
+    size = stmt.ColumnInt64(1);
+    pid = stmt.ColumnInt(2);
+    return true;
+}
+
+void ReflinkStore::DeleteFile(const char* path)
+{
+    auto select = PrepareV2(m_selectLocation);
+    select.Bind(1, path);
+    if (select.Step() == SQLITE_ROW)
+        unlinkat(m_storeDirFd, (const char*) select.ColumnText(0), 0);
+
+    auto stmt = PrepareV2(m_delete);
+    stmt.Bind(1, path);
+    stmt.Step();
+}
+
+void ReflinkStore::AddFile(const char* path, int pid)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw std::runtime_error("Can't open file to back it up");
+
+    try
+    {
+        AddFile(fd, path, pid);
+    }
+    catch (...)
+    {
+        close(fd);
+        throw;
+    }
+
+    close(fd);
+}
+
+void ReflinkStore::AddFile(int fd, const char* path, int pid)
+{
+    std::string location;
+    int snapshotFd = CreateSnapshotFile(location);
+    try
+    {
+        CloneFile(fd, snapshotFd);
+    }
+    catch (...)
+    {
+        close(snapshotFd);
+        unlinkat(m_storeDirFd, location.c_str(), 0);
+        throw;
+    }
+
+    close(snapshotFd);
+
+    // previous snapshot file is removed only after its row is replaced, a failed insert keeps it
+    std::string previousLocation;
+    try
+    {
+        struct stat st = {};
+        if (fstat(fd, &st) < 0)
+            throw std::runtime_error("Can't stat file to back it up");
+
+        Transaction transaction(*this);
+        {
+            auto select = PrepareV2(m_selectLocation);
+            select.Bind(1, path);
+            if (select.Step() == SQLITE_ROW)
+                previousLocation = (const char*) select.ColumnText(0);
+
+            auto remove = PrepareV2(m_delete);
+            remove.Bind(1, path);
+            CHECK_SQL_DONE(remove.Step());
+
+            // table columns: 'path', 'location', 'pid', 'timestamp', 'size'
+            auto stmt = PrepareV2(m_insertSql);
+
+            stmt.Bind(1, path);
+            stmt.Bind(2, location.c_str());
+            stmt.Bind(3, pid);
+            stmt.Bind(4, (sqlite3_int64) time(nullptr));
+            stmt.Bind(5, (sqlite3_int64) st.st_size);
+            CHECK_SQL_DONE(stmt.Step());
+        }
+        transaction.Commit();
+    }
+    catch (...)
+    {
+        unlinkat(m_storeDirFd, location.c_str(), 0);
+        throw;
+    }
+
+    if (!previousLocation.empty())
+        unlinkat(m_storeDirFd, previousLocation.c_str(), 0);
+}
+
+std::vector<std::string> ReflinkStore::GetFilesFromPid(int pid)
+{
+    std::vector<std::string> files;
+
+    auto stmt = PrepareV2(m_selectFilesByPid);
+    stmt.Bind(1, pid);
+
+    int res = 0;
+    while ((res = stmt.Step()) == SQLITE_ROW)
+        files.push_back(std::string((char*) stmt.ColumnText(0)));
+
+    if (res != SQLITE_DONE)
+        CHECK_SQL(res);
+
+    return files;
+}
+
+std::vector<std::string> ReflinkStore::GetFilesFromTime(int64_t from, int64_t to)
+{
+    std::vector<std::string> files;
+
+    auto stmt = PrepareV2(m_selectFilesByTime);
+    stmt.Bind(1, (sqlite3_int64) from);
+    stmt.Bind(2, (sqlite3_int64) to);
+
+    int res = 0;
+    while ((res = stmt.Step()) == SQLITE_ROW)
+        files.push_back(std::string((char*) stmt.ColumnText(0)));
+
+    if (res != SQLITE_DONE)
+        CHECK_SQL(res);
+
+    return files;
+}
+
+void ReflinkStore::RestoreFile(const char* path, int fd)
+{
+    auto select = PrepareV2(m_selectLocation);
+    select.Bind(1, path);
+    if (select.Step() != SQLITE_ROW)
+        throw std::runtime_error("There is no backup of the requested file");
+
+    int snapshotFd = openat(m_storeDirFd, (const char*) select.ColumnText(0), O_RDONLY | O_CLOEXEC);
+    if (snapshotFd < 0)
+        throw std::runtime_error("Can't open snapshot file");
+
+    try
+    {
+        CloneFile(snapshotFd, fd);
+    }
+    catch (...)
+    {
+        close(snapshotFd);
+        throw;
+    }
+
+    close(snapshotFd);
+}
+
+void ReflinkStore::DeleteRows(const std::vector<sqlite3_int64>& rows)
+{
+    // delete in one transaction not to sync the database on each row
+    Transaction transaction(*this);
+    for (auto& row : rows)
+    {
+        auto stmt = PrepareV2(m_deleteRow);
+        stmt.Bind(1, row);
+        stmt.Step();
+    }
+    transaction.Commit();
+}
+
+void ReflinkStore::EvictSelected(Statement& select)
+{
+    std::vector<sqlite3_int64> rows;
+    while (select.Step() == SQLITE_ROW)
+    {
+        rows.push_back(select.ColumnInt64(0));
+        unlinkat(m_storeDirFd, (const char*) select.ColumnText(1), 0);
+    }
+
+    DeleteRows(rows);
+}
+
+int64_t ReflinkStore::GetSize()
+{
+    auto stmt = PrepareV2(m_selectSize);
+    return (stmt.Step() == SQLITE_ROW) ? stmt.ColumnInt64(0) : 0;
+}
+
+void ReflinkStore::EvictOlderThan(int64_t timestamp)
+{
+    auto select = PrepareV2(m_selectOlder);
+    select.Bind(1, (sqlite3_int64) timestamp);
+    EvictSelected(select);
+}
+
+void ReflinkStore::EvictPid(int pid, int64_t since)
+{
+    auto select = PrepareV2(m_selectPid);
+    select.Bind(1, pid);
+    select.Bind(2, (sqlite3_int64) since);
+    EvictSelected(select);
+}
+
+void ReflinkStore::EvictToSize(int64_t maxSize)
+{
+    int64_t size = GetSize();
+    if (size <= maxSize)
+        return ;
+
+    std::vector<sqlite3_int64> rows;
+    {
+        auto select = PrepareV2(m_selectOldest);
+        while (size > maxSize && select.Step() == SQLITE_ROW)
+        {
+            rows.push_back(select.ColumnInt64(0));
+            unlinkat(m_storeDirFd, (const char*) select.ColumnText(1), 0);
+            size -= select.ColumnInt64(2);
+        }
+    }
+
+    DeleteRows(rows);
+}
+
+int ReflinkStore::Vacuum(int pages)
+{
+    IncrementalVacuum(pages);
+    return GetFreePages();
+}
+
+ReflinkStore::~ReflinkStore()
+{
+    if (m_storeDirFd >= 0)
+        close(m_storeDirFd);
+}
@@ -0,0 +1,181 @@
+#include <fanotify/detector.h>
+
+// c++ includes
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/*
+    Checks of detector state that can be driven without root and real mount: events are taken
+    from the prepared batch, pids are above pid_max, so nothing real is ever signaled.
+    Exit code is the amount of failed checks.
+*/
+
+#define CHECK(condition) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            ++g_failures; \
+        } \
+    } while (0)
+
+static int g_failures = 0;
+
+namespace fn
+{
+
+/*
+    Batch Source returns the given batch once, path of the event is made of its fd
+*/
+class BatchSource final : public EventSource
+{
+    std::vector<fanotify_event_metadata> m_batch;
+public:
+    void SetBatch(std::vector<fanotify_event_metadata> batch) { m_batch = std::move(batch); }
+
+    void Mark(unsigned int, uint64_t, int, const std::string&) override {}
+    bool WaitForEvent() override { return false; }
+    EventContainer GetEvents() override
+    {
+        EventContainer container(m_batch.data(), m_batch.size());
+        m_batch.clear();
+        return container;
+    }
+    void ResponseAllow(const fanotify_event_metadata&) const override {}
+    void ResponseDeny(const fanotify_event_metadata&) const override {}
+    std::string GetPath(const fanotify_event_metadata& metadata) override
+    {
+        return "/test/file" + std::to_string(metadata.fd);
+    }
+    void Release(const fanotify_event_metadata&) override {}
+};
+
+/*
+    Detector Test gives access to private state of the detector
+*/
+class DetectorTest
+{
+public:
+    static void ProcessEvents(EncryptorDetector& detector)
+    {
+        detector.ProcessEvents();
+    }
+
+    static void CheckForSuspiciousPids(EncryptorDetector& detector)
+    {
+        detector.CheckForSuspiciousPids();
+    }
+
+    static const EncryptorDetector::ProcInfo* Find(EncryptorDetector& detector, int pid)
+    {
+        auto it = detector.m_pidEventMap.find(pid);
+        return it != detector.m_pidEventMap.end() ? &it->second : nullptr;
+    }
+
+    // features of the only pid scored by the last check
+    static float Feature(EncryptorDetector& detector, Feature feature)
+    {
+        auto& column = detector.m_featureColumns[feature];
+        return column.size() == 1 ? column.front() : -1.0f;
+    }
+};
+
+}
+
+using namespace fn;
+
+static Config TestConfig()
+{
+    Config cfg{};
+    cfg.markFlags = {FAN_ACCESS, FAN_MODIFY, FAN_OPEN_PERM, FAN_CLOSE_WRITE, FAN_CLOSE_NOWRITE};
+    cfg.fileIOSuspect = {100, 100};
+    cfg.fileIOMaxAge = 1000;
+    cfg.logPath = "/dev/null";
+    return cfg;
+}
+
+// pid opens and closes the given amount of distinct files
+static std::vector<fanotify_event_metadata> MakeOpensAndCloses(int pid, int files)
+{
+    std::vector<fanotify_event_metadata> events;
+    for (int i = 0; i < files; ++i)
+    {
+        for (uint64_t mask : {FAN_OPEN_PERM, FAN_CLOSE_NOWRITE})
+        {
+            fanotify_event_metadata event{};
+            event.event_len = FAN_EVENT_METADATA_LEN;
+            event.vers = FANOTIFY_METADATA_VERSION;
+            event.metadata_len = FAN_EVENT_METADATA_LEN;
+            event.mask = mask;
+            event.fd = i + 1;
+            event.pid = pid;
+            events.push_back(event);
+        }
+    }
+    return events;
+}
+
+// opens and closes are counted as features of the score model
+static void TestOpenCloseFeatures()
+{
+    static constexpr int files = 10;
+
+    auto cfg = TestConfig();
+    std::array<float, FEATURE_COUNT> weights{};
+    weights[FEATURE_OPENS] = 1.0f;
+    weights[FEATURE_CLOSES] = 1.0f;
+    // nobody is a suspect
+    cfg.scoreModel = ScoreModel::Linear(weights, 0.0f, 1e9f);
+
+    auto source = std::make_unique<BatchSource>();
+    source->SetBatch(MakeOpensAndCloses(FAKE_PID_BASE, files));
+    EncryptorDetector detector(std::move(source), "/", cfg);
+
+    DetectorTest::ProcessEvents(detector);
+    auto procInfo = DetectorTest::Find(detector, FAKE_PID_BASE);
+    CHECK(procInfo != nullptr);
+    if (procInfo)
+    {
+        CHECK(procInfo->eventsCount[EVENT_OPEN] == files);
+        CHECK(procInfo->eventsCount[EVENT_CLOSE] == files);
+        CHECK(procInfo->eventsCount[EVENT_READ] == 0);
+        CHECK(procInfo->eventsCount[EVENT_WRITE] == 0);
+    }
+
+    DetectorTest::CheckForSuspiciousPids(detector);
+    CHECK(DetectorTest::Feature(detector, FEATURE_OPENS) > 0.0f);
+    CHECK(DetectorTest::Feature(detector, FEATURE_CLOSES) > 0.0f);
+    CHECK(DetectorTest::Feature(detector, FEATURE_UNIQUE_FILES) > 0.0f);
+}
+
+// without the model only reads and writes are tracked, opens and closes don't create pid state
+static void TestOpenCloseWithoutModel()
+{
+    auto source = std::make_unique<BatchSource>();
+    source->SetBatch(MakeOpensAndCloses(FAKE_PID_BASE, 10));
+    EncryptorDetector detector(std::move(source), "/", TestConfig());
+
+    DetectorTest::ProcessEvents(detector);
+    CHECK(DetectorTest::Find(detector, FAKE_PID_BASE) == nullptr);
+}
+
+int main()
+{
+    try
+    {
+        TestOpenCloseFeatures();
+        TestOpenCloseWithoutModel();
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception from test: " << e.what() << std::endl;
+        return -1;
+    }
+
+    if (g_failures == 0)
+        std::cerr << "All checks passed" << std::endl;
+    return g_failures;
+}
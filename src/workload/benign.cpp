@@ -0,0 +1,180 @@
+#include <workload/workload.h>
+
+// c includes
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+// c++ includes
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace fn;
+
+/*
+    Every run of the workload is done by the child process, so if detector kills it
+    (false positive), the rest of workloads go on and the kill is reported
+*/
+
+struct BenignOptions
+{
+    std::vector<WorkloadType> workloads = {WorkloadType::Compiler, WorkloadType::GitCheckout,
+        WorkloadType::TarExtract, WorkloadType::DbCheckpoint, WorkloadType::LogRotation};
+    std::string dir = "./benign_workload";
+    unsigned scale = 1;
+    unsigned iterations = 3;
+};
+
+static void PrintUsage()
+{
+    std::cerr << "Usage: ./benign [--workload compiler,git-checkout,tar-extract,db-checkpoint,log-rotation]"
+        " [--dir <path>] [--scale <n>] [--iterations <n>]" << std::endl;
+}
+
+static bool ParseOptions(int argc, char* argv[], BenignOptions& options)
+{
+    try
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string option = argv[i];
+            if (i + 1 >= argc)
+                return false;
+
+            std::string value = argv[++i];
+            if (option == "--workload")
+            {
+                options.workloads.clear();
+                std::stringstream stream(value);
+                std::string item;
+                while (std::getline(stream, item, ','))
+                {
+                    WorkloadType type;
+                    if (!StringToWorkload(item, type))
+                        return false;
+                    options.workloads.push_back(type);
+                }
+            }
+            else if (option == "--dir")
+                options.dir = value;
+            else if (option == "--scale")
+                options.scale = std::stoul(value);
+            else if (option == "--iterations")
+                options.iterations = std::stoul(value);
+            else
+                return false;
+        }
+    }
+    catch (const std::logic_error&)
+    {
+        return false; // not a number
+    }
+
+    return !options.workloads.empty();
+}
+
+/*
+    Run workload in the child process
+    @param stats stats reported by the child
+    @return exit status of the child (see waitpid)
+*/
+static int RunInChild(const BenignOptions& options, WorkloadType type, WorkloadStats& stats)
+{
+    int statsPipe[2];
+    if (pipe(statsPipe) < 0)
+        throw std::runtime_error("Can't create pipe");
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Can't fork workload");
+
+    if (pid == 0)
+    {
+        close(statsPipe[0]);
+        try
+        {
+            auto dir = options.dir + "/" + StringizeWorkload(type);
+            std::filesystem::remove_all(dir);
+
+            BenignWorkload workload(dir, options.scale);
+            workload.Prepare(type);
+            auto childStats = workload.Run(type);
+            std::filesystem::remove_all(dir);
+
+            if (write(statsPipe[1], &childStats, sizeof(childStats)) != sizeof(childStats))
+                _exit(1);
+        }
+        catch (const std::exception& e)
+        {
+            std::cerr << "Caught exception from workload: " << e.what() << std::endl;
+            _exit(1);
+        }
+        _exit(0);
+    }
+
+    close(statsPipe[1]);
+    stats = {};
+    if (read(statsPipe[0], &stats, sizeof(stats)) != sizeof(stats))
+        stats = {};
+    close(statsPipe[0]);
+
+    int status;
+    waitpid(pid, &status, 0);
+    return status;
+}
+
+int main(int argc, char* argv[])
+{
+    BenignOptions options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return -1;
+    }
+
+    unsigned runs = 0, killed = 0, failed = 0;
+    try
+    {
+        for (auto type : options.workloads)
+        {
+            for (unsigned iteration = 0; iteration < options.iterations; ++iteration)
+            {
+                WorkloadStats stats;
+                int status = RunInChild(options, type, stats);
+                runs++;
+
+                std::cout << std::setw(14) << StringizeWorkload(type) << std::setw(4) << iteration;
+                if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL)
+                {
+                    killed++;
+                    std::cout << "  KILLED" << std::endl;
+                    continue ;
+                }
+
+                if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+                {
+                    failed++;
+                    std::cout << "  FAILED" << std::endl;
+                    continue ;
+                }
+
+                std::cout << std::fixed << std::setprecision(3) << std::setw(10) << stats.seconds << " s"
+                    << std::setw(10) << stats.files << " files" << std::setw(10) << stats.reads << " reads"
+                    << std::setw(10) << stats.writes << " writes" << std::setprecision(2) << std::setw(10)
+                    << stats.bytes / (1024.0 * 1024.0) / stats.seconds << " MB/s" << std::endl;
+            }
+        }
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << "Caught exception: " << e.what() << std::endl;
+        return -1;
+    }
+
+    std::cout << runs << " runs, " << killed << " killed (false positives), " << failed << " failed" << std::endl;
+    return 0;
+}
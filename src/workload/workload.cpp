@@ -0,0 +1,341 @@
+#include <workload/workload.h>
+
+// c includes
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// c++ includes
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <random>
+#include <stdexcept>
+
+using namespace fn;
+
+constexpr size_t g_ioSize = 64 * 1024;
+constexpr size_t g_pageSize = 4096;
+
+BenignWorkload::BenignWorkload(const std::string& dir, unsigned scale) :
+    m_dir(dir),
+    m_scale(std::max(scale, 1u)),
+    m_stats()
+{
+    std::filesystem::create_directories(m_dir);
+}
+
+void BenignWorkload::ReadFile(const std::string& path, std::vector<char>& buffer)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Can't open file for reading: " + path);
+
+    ssize_t readBytes;
+    while ((readBytes = read(fd, buffer.data(), buffer.size())) > 0)
+    {
+        m_stats.reads++;
+        m_stats.bytes += readBytes;
+    }
+    close(fd);
+
+    if (readBytes < 0)
+        throw std::runtime_error("Can't read file: " + path);
+    m_stats.files++;
+}
+
+void BenignWorkload::WriteFile(const std::string& path, size_t size, std::vector<char>& buffer, int flags)
+{
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | flags, 0644);
+    if (fd < 0)
+        throw std::runtime_error("Can't open file for writing: " + path);
+
+    for (size_t written = 0; written < size; )
+    {
+        ssize_t writtenBytes = write(fd, buffer.data(), std::min(buffer.size(), size - written));
+        if (writtenBytes < 0)
+        {
+            close(fd);
+            throw std::runtime_error("Can't write file: " + path);
+        }
+        written += writtenBytes;
+        m_stats.writes++;
+        m_stats.bytes += writtenBytes;
+    }
+    close(fd);
+    m_stats.files++;
+}
+
+/*
+    Compiler: every translation unit reads its source and a subset of common headers
+    and writes one object file
+*/
+void BenignWorkload::PrepareCompiler()
+{
+    std::vector<char> buffer(g_ioSize, 'c');
+    std::filesystem::create_directories(m_dir + "/include");
+    std::filesystem::create_directories(m_dir + "/src");
+    std::filesystem::create_directories(m_dir + "/obj");
+
+    for (unsigned i = 0; i < 200 * m_scale; ++i)
+        WriteFile(m_dir + "/include/header" + std::to_string(i) + ".h", 8 * 1024, buffer);
+    for (unsigned i = 0; i < 50 * m_scale; ++i)
+        WriteFile(m_dir + "/src/source" + std::to_string(i) + ".cpp", 16 * 1024, buffer);
+}
+
+void BenignWorkload::RunCompiler()
+{
+    std::vector<char> buffer(g_ioSize, 'o');
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<unsigned> header(0, 200 * m_scale - 1);
+
+    for (unsigned i = 0; i < 50 * m_scale; ++i)
+    {
+        ReadFile(m_dir + "/src/source" + std::to_string(i) + ".cpp", buffer);
+        for (unsigned j = 0; j < 30; ++j)
+            ReadFile(m_dir + "/include/header" + std::to_string(header(rng)) + ".h", buffer);
+
+        WriteFile(m_dir + "/obj/source" + std::to_string(i) + ".o", 32 * 1024, buffer);
+    }
+}
+
+/*
+    Git checkout: objects are read from pack file, every file of the work tree is replaced
+    (unlink and create), then index is written
+*/
+void BenignWorkload::PrepareGitCheckout()
+{
+    std::vector<char> buffer(g_ioSize, 'g');
+    std::filesystem::create_directories(m_dir + "/.git");
+    WriteFile(m_dir + "/.git/pack", 500 * m_scale * 8 * 1024, buffer);
+
+    for (unsigned i = 0; i < 500 * m_scale; ++i)
+    {
+        if (i % 50 == 0)
+            std::filesystem::create_directories(m_dir + "/tree/dir" + std::to_string(i / 50));
+        WriteFile(m_dir + "/tree/dir" + std::to_string(i / 50) + "/file" + std::to_string(i), 8 * 1024, buffer);
+    }
+}
+
+void BenignWorkload::RunGitCheckout()
+{
+    std::vector<char> buffer(8 * 1024);
+    int packFd = open((m_dir + "/.git/pack").c_str(), O_RDONLY);
+    if (packFd < 0)
+        throw std::runtime_error("Can't open pack file");
+
+    for (unsigned i = 0; i < 500 * m_scale; ++i)
+    {
+        ssize_t readBytes = pread(packFd, buffer.data(), buffer.size(), (off_t) i * buffer.size());
+        if (readBytes < 0)
+        {
+            close(packFd);
+            throw std::runtime_error("Can't read pack file");
+        }
+        m_stats.reads++;
+        m_stats.bytes += readBytes;
+
+        auto path = m_dir + "/tree/dir" + std::to_string(i / 50) + "/file" + std::to_string(i);
+        unlink(path.c_str());
+        WriteFile(path, readBytes, buffer);
+    }
+    close(packFd);
+
+    std::vector<char> index(g_ioSize, 'i');
+    WriteFile(m_dir + "/.git/index.lock", 500 * m_scale * 64, index);
+    std::filesystem::rename(m_dir + "/.git/index.lock", m_dir + "/.git/index");
+}
+
+/*
+    Tar extract: archive is read sequentially, every entry becomes a new file
+*/
+void BenignWorkload::PrepareTarExtract()
+{
+    std::vector<char> buffer(g_ioSize, 't');
+    WriteFile(m_dir + "/archive.tar", 300 * m_scale * 16 * 1024, buffer);
+    std::filesystem::remove_all(m_dir + "/extracted");
+    std::filesystem::create_directories(m_dir + "/extracted");
+}
+
+void BenignWorkload::RunTarExtract()
+{
+    std::vector<char> buffer(16 * 1024);
+    int archiveFd = open((m_dir + "/archive.tar").c_str(), O_RDONLY);
+    if (archiveFd < 0)
+        throw std::runtime_error("Can't open archive");
+
+    for (unsigned i = 0; i < 300 * m_scale; ++i)
+    {
+        ssize_t readBytes = read(archiveFd, buffer.data(), buffer.size());
+        if (readBytes <= 0)
+            break;
+        m_stats.reads++;
+        m_stats.bytes += readBytes;
+
+        WriteFile(m_dir + "/extracted/entry" + std::to_string(i), readBytes, buffer, O_EXCL);
+    }
+    close(archiveFd);
+}
+
+/*
+    Database checkpoint: transactions append pages to WAL, checkpoint copies them
+    to random places of the database file, syncs it and truncates WAL
+*/
+void BenignWorkload::PrepareDbCheckpoint()
+{
+    std::vector<char> buffer(g_ioSize, 'd');
+    WriteFile(m_dir + "/data.db", 16 * 1024 * 1024 * (size_t) m_scale, buffer);
+    unlink((m_dir + "/data.db-wal").c_str());
+}
+
+void BenignWorkload::RunDbCheckpoint()
+{
+    std::vector<char> page(g_pageSize, 'p');
+    std::mt19937 rng(1);
+    size_t dbPages = 16 * 1024 * 1024 * (size_t) m_scale / g_pageSize;
+    std::uniform_int_distribution<size_t> pageIdx(0, dbPages - 1);
+
+    int dbFd = open((m_dir + "/data.db").c_str(), O_RDWR);
+    int walFd = open((m_dir + "/data.db-wal").c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (dbFd < 0 || walFd < 0)
+        throw std::runtime_error("Can't open database files");
+
+    constexpr unsigned transactions = 2000;
+    constexpr unsigned checkpointEvery = 500;
+    for (unsigned i = 0; i < transactions * m_scale; ++i)
+    {
+        if (write(walFd, page.data(), page.size()) != (ssize_t) page.size())
+            throw std::runtime_error("Can't write WAL");
+        m_stats.writes++;
+        m_stats.bytes += page.size();
+
+        if ((i + 1) % checkpointEvery != 0)
+            continue ;
+
+        // checkpoint
+        fdatasync(walFd);
+        for (unsigned j = 0; j < checkpointEvery; ++j)
+        {
+            if (pread(walFd, page.data(), page.size(), (off_t) j * page.size()) < 0 ||
+                pwrite(dbFd, page.data(), page.size(), (off_t) pageIdx(rng) * page.size()) < 0)
+                throw std::runtime_error("Can't checkpoint WAL");
+            m_stats.reads++;
+            m_stats.writes++;
+            m_stats.bytes += 2 * page.size();
+        }
+        fdatasync(dbFd);
+        if (ftruncate(walFd, 0) < 0 || lseek(walFd, 0, SEEK_SET) < 0)
+            throw std::runtime_error("Can't truncate WAL");
+    }
+
+    close(walFd);
+    close(dbFd);
+    m_stats.files += 2;
+}
+
+/*
+    Log rotation: application appends lines one write per line, then generations are shifted
+    with rename, the oldest one is removed and the rotated log is compressed to a new file
+*/
+void BenignWorkload::PrepareLogRotation()
+{
+    std::filesystem::create_directories(m_dir + "/log");
+    std::vector<char> buffer(g_ioSize, 'l');
+    for (unsigned generation = 1; generation <= 5; ++generation)
+        WriteFile(m_dir + "/log/app.log." + std::to_string(generation) + ".z", 256 * 1024, buffer);
+}
+
+void BenignWorkload::RunLogRotation()
+{
+    std::string log = m_dir + "/log/app.log";
+    std::string line(120, 'x');
+    line.back() = '\n';
+    std::vector<char> buffer(g_ioSize);
+
+    for (unsigned rotation = 0; rotation < 4 * m_scale; ++rotation)
+    {
+        int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if (fd < 0)
+            throw std::runtime_error("Can't open log");
+
+        for (unsigned i = 0; i < 5000; ++i)
+        {
+            if (write(fd, line.data(), line.size()) != (ssize_t) line.size())
+                throw std::runtime_error("Can't write log");
+            m_stats.writes++;
+            m_stats.bytes += line.size();
+        }
+        close(fd);
+        m_stats.files++;
+
+        // shift generations
+        unlink((log + ".5.z").c_str());
+        for (unsigned generation = 4; generation >= 1; --generation)
+            rename((log + "." + std::to_string(generation) + ".z").c_str(),
+                (log + "." + std::to_string(generation + 1) + ".z").c_str());
+
+        // "compress" rotated log: read it and write a smaller file
+        rename(log.c_str(), (log + ".1").c_str());
+        ReadFile(log + ".1", buffer);
+        WriteFile(log + ".1.z", 5000 * line.size() / 4, buffer);
+        unlink((log + ".1").c_str());
+    }
+}
+
+void BenignWorkload::Prepare(WorkloadType type)
+{
+    switch (type)
+    {
+        case WorkloadType::Compiler: PrepareCompiler(); break;
+        case WorkloadType::GitCheckout: PrepareGitCheckout(); break;
+        case WorkloadType::TarExtract: PrepareTarExtract(); break;
+        case WorkloadType::DbCheckpoint: PrepareDbCheckpoint(); break;
+        case WorkloadType::LogRotation: PrepareLogRotation(); break;
+    }
+}
+
+WorkloadStats BenignWorkload::Run(WorkloadType type)
+{
+    m_stats = {};
+    auto start = std::chrono::steady_clock::now();
+
+    switch (type)
+    {
+        case WorkloadType::Compiler: RunCompiler(); break;
+        case WorkloadType::GitCheckout: RunGitCheckout(); break;
+        case WorkloadType::TarExtract: RunTarExtract(); break;
+        case WorkloadType::DbCheckpoint: RunDbCheckpoint(); break;
+        case WorkloadType::LogRotation: RunLogRotation(); break;
+    }
+
+    m_stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return m_stats;
+}
+
+std::string fn::StringizeWorkload(WorkloadType type)
+{
+    switch (type)
+    {
+        case WorkloadType::Compiler: return "compiler";
+        case WorkloadType::GitCheckout: return "git-checkout";
+        case WorkloadType::TarExtract: return "tar-extract";
+        case WorkloadType::DbCheckpoint: return "db-checkpoint";
+        case WorkloadType::LogRotation: return "log-rotation";
+    }
+    return "";
+}
+
+bool fn::StringToWorkload(const std::string& str, WorkloadType& type)
+{
+    for (auto candidate : {WorkloadType::Compiler, WorkloadType::GitCheckout, WorkloadType::TarExtract,
+        WorkloadType::DbCheckpoint, WorkloadType::LogRotation})
+    {
+        if (StringizeWorkload(candidate) == str)
+        {
+            type = candidate;
+            return true;
+        }
+    }
+    return false;
+}